@@ -0,0 +1,159 @@
+#ifndef mc_simulation_checkpoint
+#define mc_simulation_checkpoint
+
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <ql_extensions.hpp>
+
+namespace qe = QuantLibExt;
+
+// Identity of the run that writes a checkpoint: the run identity of the
+// options and a hash (FNV-1a of the full precision text) of the outer path
+// parameters, which come from the parameter file
+std::string checkpointIdentity(const std::string& runIdentity,
+        const std::vector<std::vector<double> >& parameters)
+{
+    std::ostringstream text;
+    text << std::setprecision(17);
+    for (unsigned i=0; i<parameters.size(); ++i)
+        for (unsigned j=0; j<parameters[i].size(); ++j)
+            text << parameters[i][j] << (j+1 < parameters[i].size() ? "," : ";");
+    std::string s = text.str();
+    boost::uint64_t hash = 14695981039346656037ULL;
+    for (std::string::size_type k=0; k<s.size(); ++k) {
+        hash ^= static_cast<unsigned char>(s[k]);
+        hash *= 1099511628211ULL;
+    }
+    std::ostringstream id;
+    id << runIdentity << " parameters=" << std::hex << hash;
+    return id.str();
+}
+
+// Append-only record of the finished outer paths, one line 'i,V,C,D,Res,Surr'
+// per path, written as soon as the path is done, after a first line
+// '# identity' of the run. The doubles are written with full precision, so
+// a resumed run gives the same output as one without interruption.
+class CheckpointFile {
+  public:
+    // The file starts with the paths finished so far. It is replaced as a
+    // whole (write and rename), so a line cut off by an interruption is
+    // dropped and an interruption while it is replaced loses nothing.
+    CheckpointFile(const std::string& filename, const std::string& identity,
+                   const std::map<unsigned, qe::ValueVector>& finished) {
+        std::string tmpname = filename + ".tmp";
+        std::ofstream tmp(tmpname.c_str());
+        QL_REQUIRE(tmp.is_open(), "Can't open file " + tmpname);
+        tmp << std::setprecision(17) << "# " << identity << "\n";
+        for (std::map<unsigned, qe::ValueVector>::const_iterator 
+                it = finished.begin(); it != finished.end(); ++it)
+            tmp << it->first << "," << it->second << "\n";
+        tmp.close();
+        QL_REQUIRE(tmp && std::rename(tmpname.c_str(), filename.c_str()) == 0,
+            "CheckpointFile: can't replace " + filename);
+
+        out_.open(filename.c_str(), std::ios::app);
+        QL_REQUIRE(out_.is_open(), "Can't open file " + filename);
+        out_ << std::setprecision(17);
+    }
+
+    void write(unsigned i, const qe::ValueVector& result) {
+        boost::mutex::scoped_lock lock(mutex_);
+        out_ << i << "," << result << std::endl;
+    }
+
+  private:
+    boost::mutex mutex_;
+    std::ofstream out_;
+};
+
+// Whether the file is missing or empty, so writing a checkpoint to it
+// loses nothing
+bool noCheckpoint(const std::string& filename)
+{
+    std::ifstream in(filename.c_str());
+    return not in.is_open() || in.peek() == std::ifstream::traits_type::eof();
+}
+
+// The fields of a checkpoint line, read with strtod, which (unlike
+// operator>>) reads back the nan and inf that operator<< writes. False if
+// a field is not a whole number or there are not 6 of them.
+bool parseCheckpointLine(const std::string& line, unsigned& i,
+                         qe::ValueVector& v)
+{
+    double* fields[] = { &v.V, &v.C, &v.D, &v.Res, &v.Surr };
+    const char* begin = line.c_str();
+    char* end;
+    unsigned long index = std::strtoul(begin, &end, 10);
+    if (end == begin || *end != ',')
+        return false;
+    i = index;
+    for (unsigned k=0; k<5; ++k) {
+        begin = end + 1;
+        *fields[k] = std::strtod(begin, &end);
+        if (end == begin || *end != (k < 4 ? ',' : '\0'))
+            return false;
+    }
+    return true;
+}
+
+// The finished paths of a checkpoint file, which has to be written by a run
+// with the same identity. A last line without newline was cut off by the
+// interruption and is ignored. A missing or empty file is no paths.
+std::map<unsigned, qe::ValueVector> readCheckpoint(const std::string& filename,
+                                                   unsigned nPaths,
+                                                   const std::string& identity)
+{
+    std::map<unsigned, qe::ValueVector> finished;
+    std::ifstream in(filename.c_str());
+    std::string line;
+    if (not std::getline(in, line))
+        return finished;
+    QL_REQUIRE(line == "# " + identity,
+        "readCheckpoint: " + filename + " was written by a different run\n"
+        "  checkpoint: " + line + "\n  this run:   # " + identity);
+    while (std::getline(in, line) && not in.eof()) {
+        unsigned i;
+        qe::ValueVector v;
+        QL_REQUIRE(parseCheckpointLine(line, i, v),
+            "readCheckpoint: corrupt line '" + line + "'");
+        QL_REQUIRE(i < nPaths,
+            "readCheckpoint: path index beyond nPaths in " + filename);
+        finished[i] = v;
+    }
+    return finished;
+}
+
+// Runs the simulation of outer path i and records the result
+class CheckpointedSimulation {
+  public:
+    typedef boost::function<qe::ValueVector (unsigned)> Simulation;
+
+    CheckpointedSimulation(const Simulation& simulate,
+                           const boost::shared_ptr<CheckpointFile>& file)
+        : simulate_(simulate), file_(file) {}
+
+    qe::ValueVector operator()(unsigned i) const {
+        qe::ValueVector result = simulate_(i);
+        if (file_)
+            file_->write(i, result);
+        return result;
+    }
+
+  private:
+    Simulation simulate_;
+    boost::shared_ptr<CheckpointFile> file_;
+};
+
+#endif
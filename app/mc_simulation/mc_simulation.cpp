@@ -6,12 +6,41 @@
 
 #include "program_options.hpp"
 #include "helpers.hpp"
+#include "checkpoint.hpp"
 
 namespace qe=QuantLibExt;
  
+// Binary columnar output (see utils/columnar.hpp), one column per component
+void writeColumnarResults(const std::vector<qe::ValueVector>& results,
+                          const std::string& outfilename,
+                          unsigned blockRows)
+{
+    std::vector<std::string> names;
+    names.push_back("V");
+    names.push_back("C");
+    names.push_back("D");
+    names.push_back("Res");
+    names.push_back("Surr");
+    std::vector<std::vector<double> > columns(names.size());
+    BOOST_FOREACH(const qe::ValueVector& res, results) {
+        columns[0].push_back(res.V);
+        columns[1].push_back(res.C);
+        columns[2].push_back(res.D);
+        columns[3].push_back(res.Res);
+        columns[4].push_back(res.Surr);
+    }
+    qe::writeColumnar(outfilename, names, columns, blockRows);
+}
+
 void writeResults(const std::vector<qe::ValueVector>& results,
-                  const std::string& outfilename) 
+                  const ProgramOptions& options) 
 {
+    std::string outfilename = options.outputFilename();
+    if (options.columnarOutput()) {
+        writeColumnarResults(results, outfilename, options.columnarBlockRows());
+        return;
+    }
+
     std::ofstream out;
     out.open(outfilename.c_str());
     QL_REQUIRE(out.is_open(), "Can't open file " + outfilename);
@@ -39,6 +68,92 @@ void expandOrCropParameters(std::vector<std::vector<double> >& parameters, unsig
     }
 }
 
+// The batch kernels are concrete types, so the model is dispatched here
+qe::InsContrMCPricingModelFactory* makeBatchedPricingFactory(
+         const ProgramOptions& options,
+         const qe::ModelDynamics& riskNeutralDynamics,
+         const qe::HedgeTraits& hedgeTraits)
+{
+    std::vector<double> p = options.getRiskNeutralParameters();
+    if (options.model() == "CevCkls") {
+        return new qe::BatchedInsContrMCPricingModelFactory<qe::RnCevCklsBatchKernel>(
+                    hedgeTraits.nSamplesInnerMC,
+                    hedgeTraits.dt,
+                    riskNeutralDynamics,
+                    qe::RnCevCklsBatchKernel(p),
+                    options.getContractTraits(),
+                    hedgeTraits.offset_S,
+                    hedgeTraits.offset_r,
+                    hedgeTraits.innerMC);
+    } else if (options.model() == "BS_Vas") {
+        return new qe::BatchedInsContrMCPricingModelFactory<qe::RnBSVasicekBatchKernel>(
+                    hedgeTraits.nSamplesInnerMC,
+                    hedgeTraits.dt,
+                    riskNeutralDynamics,
+                    qe::RnBSVasicekBatchKernel(p),
+                    options.getContractTraits(),
+                    hedgeTraits.offset_S,
+                    hedgeTraits.offset_r,
+                    hedgeTraits.innerMC);
+    } else {
+        QL_FAIL("makeBatchedPricingFactory: Illegal model_name: " + options.model());
+    }
+}
+
+// The model is dispatched here once, the inner MC then runs on the
+// concrete dynamics
+qe::InsContrMCPricingModelFactory* makePricingFactory(
+         const ProgramOptions& options,
+         const qe::HedgeTraits& hedgeTraits)
+{
+    std::vector<double> p = options.getRiskNeutralParameters();
+    if (options.model() == "CevCkls") {
+        return new qe::StaticInsContrMCPricingModelFactory<qe::RnCevCklsDynamics>(
+                    hedgeTraits.nSamplesInnerMC,
+                    hedgeTraits.dt,
+                    qe::RnCevCklsDynamics(p),
+                    options.getContractTraits(),
+                    hedgeTraits.offset_S,
+                    hedgeTraits.offset_r,
+                    hedgeTraits.innerMC);
+    } else if (options.model() == "BS_Vas") {
+        return new qe::StaticInsContrMCPricingModelFactory<qe::RnBSVasicekDynamics>(
+                    hedgeTraits.nSamplesInnerMC,
+                    hedgeTraits.dt,
+                    qe::RnBSVasicekDynamics(p),
+                    options.getContractTraits(),
+                    hedgeTraits.offset_S,
+                    hedgeTraits.offset_r,
+                    hedgeTraits.innerMC);
+    } else {
+        QL_FAIL("makePricingFactory: Illegal model_name: " + options.model());
+    }
+}
+
+qe::InsContrMCPricingModelFactory* makePathwisePricingFactory(
+         const ProgramOptions& options,
+         const qe::HedgeTraits& hedgeTraits)
+{
+    std::vector<double> p = options.getRiskNeutralParameters();
+    if (options.model() == "CevCkls") {
+        return new qe::PathwiseInsContrMCPricingModelFactory<qe::RnCevCklsDynamics>(
+                    hedgeTraits.nSamplesInnerMC,
+                    hedgeTraits.dt,
+                    qe::RnCevCklsDynamics(p),
+                    options.getContractTraits(),
+                    hedgeTraits.innerMC);
+    } else if (options.model() == "BS_Vas") {
+        return new qe::PathwiseInsContrMCPricingModelFactory<qe::RnBSVasicekDynamics>(
+                    hedgeTraits.nSamplesInnerMC,
+                    hedgeTraits.dt,
+                    qe::RnBSVasicekDynamics(p),
+                    options.getContractTraits(),
+                    hedgeTraits.innerMC);
+    } else {
+        QL_FAIL("makePathwisePricingFactory: Illegal model_name: " + options.model());
+    }
+}
+
 qe::ProfitAndLossComputer setupProfitAndLossComputingFunction(
          const ProgramOptions& options,
          const qe::ModelDynamics& riskNeutralDynamics,
@@ -47,21 +162,33 @@ qe::ProfitAndLossComputer setupProfitAndLossComputingFunction(
     qe::ProfitAndLossComputer computeProfitAndLoss;
     if (options.doHedging()) {
         qe::HedgeTraits hedgeTraits = options.getHedgeTraits();
-        boost::shared_ptr<qe::InsContrMCPricingModelFactory> 
-          p_PricingFactory(
-            new qe::InsContrMCPricingModelFactory(
-                    hedgeTraits.nSamplesInnerMC,
+        boost::shared_ptr<qe::InsContrMCPricingModelFactory> p_PricingFactory;
+        if (hedgeTraits.regressionPaths > 0) {
+            p_PricingFactory.reset(
+              new qe::RegressionInsContrPricingModelFactory(
+                    hedgeTraits.regressionPaths,
                     hedgeTraits.dt,
-                    qe::NormalRandomNumberGenerator(options.getSeed()),
                     riskNeutralDynamics,
                     options.getContractTraits(),
+                    options.getAssetPathTraits().initialAssetValues,
                     hedgeTraits.offset_S,
-                    hedgeTraits.offset_r));
+                    hedgeTraits.offset_r,
+                    hedgeTraits.nSamplesInnerMC,
+                    hedgeTraits.innerMC));
+        } else if (hedgeTraits.batchedInnerMC) {
+            p_PricingFactory.reset(
+              makeBatchedPricingFactory(options,riskNeutralDynamics,hedgeTraits));
+        } else if (hedgeTraits.pathwiseDeltas) {
+            p_PricingFactory.reset(
+              makePathwisePricingFactory(options,hedgeTraits));
+        } else {
+            p_PricingFactory.reset(makePricingFactory(options,hedgeTraits));
+        }
 
         computeProfitAndLoss = boost::bind(
                 qe::computeReplicationProfitAndLoss,
                 initialValue,
-                _1,_2,_3,
+                _1,_2,_3,_4,
                 p_PricingFactory,hedgeTraits.dt);
     } else {
         computeProfitAndLoss = boost::bind(
@@ -71,6 +198,89 @@ qe::ProfitAndLossComputer setupProfitAndLossComputingFunction(
     return computeProfitAndLoss;
 }
 
+// One contract per line: g, y, delta, L, Ap and optionally the term in
+// years, by default the contract maturity of the command line
+qe::PolicyBook setupPolicyBook(const ProgramOptions& options)
+{
+    qe::ContractTraits ct = options.getContractTraits();
+    qe::PolicyBook book;
+    std::vector<std::vector<double> > contracts 
+        = parseParameters(options.portfolioFilename());
+    BOOST_FOREACH(const std::vector<double>& c, contracts) {
+        QL_REQUIRE(c.size() == 5 || c.size() == 6, 
+            "setupPolicyBook: a contract needs g, y, delta, L, Ap [,term]");
+        qe::rational T = (c.size() == 6) ? qe::rational(int(c[5])) : ct.T;
+        book.add(qe::ContractTraits(c[0],c[1],c[2],c[3],c[4],ct.dt,T));
+    }
+    return book;
+}
+
+// The contracts of a portfolio share the contract maturity
+qe::ContractPortfolio setupPortfolio(const ProgramOptions& options)
+{
+    qe::ContractTraits ct = options.getContractTraits();
+    qe::ContractPortfolio portfolio(ct.dt, ct.T);
+    qe::PolicyBook book = setupPolicyBook(options);
+    for (unsigned i=0; i<book.size(); ++i)
+        portfolio.add(book.policy(i));
+    return portfolio;
+}
+
+// Portfolio mode: the values at 0 of all contracts on the same scenarios,
+// one line per contract and the total in the last line
+void writePortfolioValues(const ProgramOptions& options,
+                          const qe::ModelDynamics& riskNeutralDynamics)
+{
+    qe::Array<qe::ValueVector> values 
+        = qe::portfolioMC(options.nPathsInitialMc(),
+                          options.getSeed(),
+                          riskNeutralDynamics,
+                          options.getAssetPathTraits(),
+                          setupPortfolio(options));
+    std::vector<qe::ValueVector> results(values.begin(), values.end());
+    results.push_back(qe::portfolioTotal(values));
+    writeResults(results,options);
+}
+
+// Portfolio mode with model points: one line per model point (by term)
+// and the total in the last line, the compression error on a sample of
+// the policies goes to stdout
+void writeModelPointValues(const ProgramOptions& options,
+                           const qe::ModelDynamics& riskNeutralDynamics)
+{
+    qe::PolicyBook book = setupPolicyBook(options);
+    qe::ModelPoints mp 
+        = qe::compressPolicyBook(book, options.getCompressionTraits());
+    qe::ModelPointValues values 
+        = qe::valueModelPoints(mp,
+                               options.nPathsInitialMc(),
+                               options.getSeed(),
+                               riskNeutralDynamics,
+                               options.getAssetPathTraits());
+    std::vector<qe::ValueVector> results;
+    for (qe::ModelPointValues::const_iterator it = values.begin();
+            it != values.end(); ++it)
+        results.insert(results.end(), it->second.begin(), it->second.end());
+    results.push_back(qe::modelPointTotal(values));
+    writeResults(results,options);
+
+    qe::CompressionDiagnostics diag 
+        = qe::diagnoseCompression(book, mp, values,
+                                  options.compressionSample(),
+                                  options.nPathsInitialMc(),
+                                  options.getSeed(),
+                                  riskNeutralDynamics,
+                                  options.getAssetPathTraits());
+    std::cout << "policies         : " << diag.nPolicies << std::endl;
+    std::cout << "modelPoints      : " << diag.nModelPoints << std::endl;
+    std::cout << "sampledPolicies  : " << diag.nSampled << std::endl;
+    std::cout << "sampleExact      : " << diag.sampleExact << std::endl;
+    std::cout << "sampleCompressed : " << diag.sampleCompressed << std::endl;
+    std::cout << "relativeError    : " << diag.relativeError << std::endl;
+    std::cout << "meanPolicyError  : " << diag.meanPolicyError << std::endl;
+    std::cout << "maxPolicyError   : " << diag.maxPolicyError << std::endl;
+}
+
 std::vector<std::vector<double> > setupParameters(const ProgramOptions& options)
 {
     std::vector<std::vector<double> > parameters
@@ -79,12 +289,22 @@ std::vector<std::vector<double> > setupParameters(const ProgramOptions& options)
     return parameters;
 }
 
-std::vector<unsigned> setupSeeds(const ProgramOptions& options) 
+// Outer path i has its own parameters and is drawn from seed + i, or is
+// path i of the Philox streams, so it does not depend on the other paths
+qe::ValueVector simulateOuterPath(unsigned i,
+                                  const ProgramOptions& options,
+                                  const std::vector<std::vector<double> >& parameters,
+                                  const qe::ProfitAndLossComputer& computeProfitAndLoss)
 {
-    std::vector<unsigned> seeds(options.getNumberOfPaths());
-    for (unsigned i=0; i<seeds.size(); ++i)
-        seeds[i] = options.getSeed() + i;
-    return seeds;
+    if (options.counterBasedRng())
+        return qe::counterBasedProfitAndLossSimulation(parameters[i],
+                    options.model(), i, options.getSeed(),
+                    options.getAssetPathTraits(), options.getContractTraits(),
+                    computeProfitAndLoss);
+    return qe::singleProfitAndLossSimulation(parameters[i],
+                options.model(), options.getSeed() + i,
+                options.getAssetPathTraits(), options.getContractTraits(),
+                computeProfitAndLoss);
 }
 
 int main(int ac, char** av) 
@@ -93,12 +313,34 @@ int main(int ac, char** av)
     options.parseCommandline(ac,av);
     options.debugPrint();
 
-    std::vector<std::vector<double> > parameters = setupParameters(options);
-
     qe::ModelDynamics riskNeutralDynamics
 		= qe::makeRiskNeutralDynamics(options.getRiskNeutralParameters(),
 									  options.model());
 
+    if (not options.portfolioFilename().empty()) {
+        if (options.modelPoints())
+            writeModelPointValues(options,riskNeutralDynamics);
+        else
+            writePortfolioValues(options,riskNeutralDynamics);
+        return 0;
+    }
+
+    std::vector<std::vector<double> > parameters = setupParameters(options);
+    std::string identity = checkpointIdentity(options.runIdentity(),
+                                              parameters);
+
+    // Paths finished by an interrupted run are taken from its checkpoint.
+    // Without --resume a checkpoint with paths in it is only replaced with
+    // --force.
+    std::map<unsigned, qe::ValueVector> finished;
+    if (options.resume())
+        finished = readCheckpoint(options.checkpointFilename(),
+                                  options.getNumberOfPaths(), identity);
+    else if (not options.checkpointFilename().empty())
+        QL_REQUIRE(options.force() || noCheckpoint(options.checkpointFilename()),
+            "Checkpoint file " + options.checkpointFilename() + " is not "
+            "empty, use --resume to continue it or --force to overwrite it");
+
     qe::ValueVector initialValue = simpleMC(options.nPathsInitialMc(),
                                             options.getSeed(),
                                             riskNeutralDynamics,
@@ -109,13 +351,33 @@ int main(int ac, char** av)
         setupProfitAndLossComputingFunction(options,riskNeutralDynamics,initialValue);
 
     std::vector<qe::ValueVector> results(options.getNumberOfPaths());
-    std::vector<unsigned> seeds = setupSeeds(options);
 
-    std::transform(parameters.begin(),parameters.end(),seeds.begin(),results.begin(),
-                   boost::bind(qe::singleProfitAndLossSimulation,_1,options.model(),_2,
-                               options.getAssetPathTraits(),options.getContractTraits(),
-                               computeProfitAndLoss));
+    std::vector<unsigned> pending;
+    for (unsigned i=0; i<results.size(); ++i) {
+        std::map<unsigned, qe::ValueVector>::const_iterator it = finished.find(i);
+        if (it != finished.end())
+            results[i] = it->second;
+        else
+            pending.push_back(i);
+    }
+
+    boost::shared_ptr<CheckpointFile> checkpoint;
+    if (not options.checkpointFilename().empty())
+        checkpoint.reset(new CheckpointFile(options.checkpointFilename(),
+                                            identity, finished));
+
+    // Outer paths are independent (own seed, own parameters), results are
+    // written in path order, so the output does not depend on nThreads
+    std::vector<qe::ValueVector> pendingResults(pending.size());
+    qe::parallel_transform(pending.begin(),pending.end(),pendingResults.begin(),
+               CheckpointedSimulation(
+                   boost::bind(simulateOuterPath,_1,boost::cref(options),
+                               boost::cref(parameters),computeProfitAndLoss),
+                   checkpoint),
+               options.nThreads());
+    for (unsigned k=0; k<pending.size(); ++k)
+        results[pending[k]] = pendingResults[k];
 
-    writeResults(results,options.outputFilename());
+    writeResults(results,options);
     return 0;
 }
@@ -2,6 +2,9 @@
 #define command_line_parameters
 
 #include <string>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
 
 #include <ql_extensions.hpp>
 
@@ -9,7 +12,17 @@ namespace qe = QuantLibExt;
 
 class ProgramOptions {
   public:
-    ProgramOptions() : didYouParseYet_(false) {}
+    ProgramOptions() 
+        : didYouParseYet_(false), nThreads_(1), nBlocksInnerMC_(1),
+          nThreadsInnerMC_(1), pathwiseDeltas_(false), batchedInnerMC_(false),
+          quasiMonteCarlo_(false), antithetic_(false),
+          controlVariates_(false), innerRelativeError_(0.0),
+          innerAbsoluteError_(0.01),
+          innerCheckPaths_(100), regressionPaths_(0),
+          counterBasedRng_(false), analyticBond_(false), modelPoints_(false),
+          compressionSample_(1000), resume_(false), force_(false),
+          columnarOutput_(false),
+          columnarBlockRows_(0) {}
 
     void parseCommandline(int ac, char** av) {
         model_ = std::string(av[1]);
@@ -33,6 +46,8 @@ class ProgramOptions {
         outfilename_ = std::string(av[19]);
         seed_ = atoi(av[20]);
 
+        parseOptionalArguments(ac,av,21);
+
         doHedging_ = nHedges_ > 0;
 
         didYouParseYet_ = true;
@@ -41,7 +56,7 @@ class ProgramOptions {
     std::vector<double> getRiskNeutralParameters() const {
         checkParsed();
         std::vector<double> rnParas;
-        if (model_ == "BSVasicek") {
+        if (model_ == "BS_Vas") {
 			rnParas.push_back(0.0);
 			rnParas.push_back(rnStockVol_);
 			rnParas.push_back(rnIrSpeed_);
@@ -74,6 +89,88 @@ class ProgramOptions {
         return parameterFile_;
     }
 
+    // empty if not in portfolio mode
+    std::string portfolioFilename() const {
+        checkParsed();
+        return portfolioFile_;
+    }
+
+    // compress the portfolio into model points
+    bool modelPoints() const {
+        checkParsed();
+        return modelPoints_;
+    }
+
+    qe::CompressionTraits getCompressionTraits() const {
+        checkParsed();
+        return compressionTraits_;
+    }
+
+    unsigned compressionSample() const {
+        checkParsed();
+        return compressionSample_;
+    }
+
+    // empty if the finished paths are not recorded
+    std::string checkpointFilename() const {
+        checkParsed();
+        return checkpointFile_;
+    }
+
+    // skip the paths in the checkpoint file of an interrupted run
+    bool resume() const {
+        checkParsed();
+        return resume_;
+    }
+
+    // overwrite a checkpoint file that has paths in it
+    bool force() const {
+        checkParsed();
+        return force_;
+    }
+
+    // Everything the results of the outer paths depend on (not the number
+    // of threads or the output format). A checkpoint is only resumed by a
+    // run with the same identity.
+    std::string runIdentity() const {
+        checkParsed();
+        std::ostringstream id;
+        id << std::setprecision(17)
+           << "model=" << model_ << " parameterFile=" << parameterFile_
+           << " nPaths=" << nPaths_ << " nHedges=" << nHedges_
+           << " nPathsInnerMC=" << nPathsInnerMC_
+           << " nPathPoints=" << nPathPoints_ << " r0=" << r0_
+           << " s0=" << s0_ << " L0=" << L0_
+           << " contractMaturity=" << contractMaturity_
+           << " rn=" << rnStockVol_ << "," << rnStockExp_ << ","
+           << rnIrSpeed_ << "," << rnIrLevel_ << "," << rnIrVol_ << ","
+           << rnIrExp_ << "," << rnCorrelation_
+           << " transCosts=" << transCosts_ << " seed=" << seed_
+           << " innerBlocks=" << nBlocksInnerMC_
+           << " pathwise=" << pathwiseDeltas_
+           << " batched=" << batchedInnerMC_
+           << " qmc=" << quasiMonteCarlo_ << " antithetic=" << antithetic_
+           << " controlVariates=" << controlVariates_
+           << " innerError=" << innerRelativeError_ << ","
+           << innerAbsoluteError_ << "," << innerCheckPaths_
+           << " regression=" << regressionPaths_
+           << " philox=" << counterBasedRng_
+           << " analyticBond=" << analyticBond_;
+        return id.str();
+    }
+
+    // write the results as binary columns instead of text
+    bool columnarOutput() const {
+        checkParsed();
+        return columnarOutput_;
+    }
+
+    // rows per compressed block of the columnar output, 0 for uncompressed
+    unsigned columnarBlockRows() const {
+        checkParsed();
+        return columnarBlockRows_;
+    }
+
     std::string outputFilename() const {
         checkParsed();
         return outfilename_;
@@ -93,6 +190,16 @@ class ProgramOptions {
         return seed_;
     }
 
+    unsigned nThreads() const {
+        checkParsed();
+        return nThreads_;
+    }
+
+    bool counterBasedRng() const {
+        checkParsed();
+        return counterBasedRng_;
+    }
+
     qe::HedgeTraits getHedgeTraits() const {
         checkParsed();
         QL_REQUIRE(doHedging_, 
@@ -102,6 +209,20 @@ class ProgramOptions {
         ht.nSamplesInnerMC = nPathsInnerMC_;
         ht.offset_S = 0.005;
         ht.offset_r = 0.002;
+        ht.pathwiseDeltas = pathwiseDeltas_;
+        ht.batchedInnerMC = batchedInnerMC_;
+        ht.regressionPaths = regressionPaths_;
+        ht.innerMC = qe::InnerMCTraits(seed_);
+        ht.innerMC.nBlocks = nBlocksInnerMC_;
+        ht.innerMC.nThreads = nThreadsInnerMC_;
+        ht.innerMC.quasiMonteCarlo = quasiMonteCarlo_;
+        ht.innerMC.varianceReduction 
+            = qe::VarianceReduction(antithetic_,controlVariates_);
+        ht.innerMC.adaptive = qe::AdaptiveMCTraits(innerRelativeError_
+                                                  ,innerCheckPaths_
+                                                  ,innerAbsoluteError_);
+        ht.innerMC.counterBasedRng = counterBasedRng_;
+        ht.innerMC.analyticBond = analyticBond_;
         return ht;
     }
 
@@ -153,6 +274,28 @@ class ProgramOptions {
         std::cout << "transCosts       : " << transCosts_ << std::endl ;
         std::cout << "outfilename      : " << outfilename_ << std::endl ;
         std::cout << "seed             : " << seed_ << std::endl ;
+        std::cout << "threads          : " << nThreads_ << std::endl ;
+        std::cout << "innerBlocks      : " << nBlocksInnerMC_ << std::endl ;
+        std::cout << "innerThreads     : " << nThreadsInnerMC_ << std::endl ;
+        std::cout << "pathwiseDeltas   : " << pathwiseDeltas_ << std::endl ;
+        std::cout << "batchedInnerMC   : " << batchedInnerMC_ << std::endl ;
+        std::cout << "quasiMonteCarlo  : " << quasiMonteCarlo_ << std::endl ;
+        std::cout << "antithetic       : " << antithetic_ << std::endl ;
+        std::cout << "controlVariates  : " << controlVariates_ << std::endl ;
+        std::cout << "innerRelError    : " << innerRelativeError_ << std::endl ;
+        std::cout << "innerAbsError    : " << innerAbsoluteError_ << std::endl ;
+        std::cout << "innerCheckPaths  : " << innerCheckPaths_ << std::endl ;
+        std::cout << "regressionPaths  : " << regressionPaths_ << std::endl ;
+        std::cout << "counterBasedRng  : " << counterBasedRng_ << std::endl ;
+        std::cout << "analyticBond     : " << analyticBond_ << std::endl ;
+        std::cout << "portfolioFile    : " << portfolioFile_ << std::endl ;
+        std::cout << "modelPoints      : " << modelPoints_ << std::endl ;
+        std::cout << "compressionSample: " << compressionSample_ << std::endl ;
+        std::cout << "checkpointFile   : " << checkpointFile_ << std::endl ;
+        std::cout << "resume           : " << resume_ << std::endl ;
+        std::cout << "force            : " << force_ << std::endl ;
+        std::cout << "columnarOutput   : " << columnarOutput_ << std::endl ;
+        std::cout << "columnarBlockRows: " << columnarBlockRows_ << std::endl ;
         std::cout << "doHedging        : " << doHedging_ << std::endl ;
         std::cout << std::string(78,'-') << std::endl ;
         if (doHedging_) {
@@ -163,9 +306,108 @@ class ProgramOptions {
     }
 
   private:
+    // Optional arguments come after the positional ones as '--name value'
+    // or '--flag'
+    void parseOptionalArguments(int ac, char** av, int first) {
+        for (int i=first; i<ac; ++i) {
+            std::string arg(av[i]);
+            if (arg == "--threads" && i+1 < ac) {
+                nThreads_ = std::max(atoi(av[++i]),1);
+            } else if (arg == "--inner-blocks" && i+1 < ac) {
+                nBlocksInnerMC_ = std::max(atoi(av[++i]),1);
+            } else if (arg == "--inner-threads" && i+1 < ac) {
+                nThreadsInnerMC_ = std::max(atoi(av[++i]),1);
+            } else if (arg == "--pathwise-deltas") {
+                pathwiseDeltas_ = true;
+            } else if (arg == "--batched") {
+                batchedInnerMC_ = true;
+            } else if (arg == "--qmc") {
+                quasiMonteCarlo_ = true;
+            } else if (arg == "--antithetic") {
+                antithetic_ = true;
+            } else if (arg == "--control-variates") {
+                controlVariates_ = true;
+            } else if (arg == "--inner-rel-error" && i+1 < ac) {
+                innerRelativeError_ = atof(av[++i]);
+            } else if (arg == "--inner-abs-error" && i+1 < ac) {
+                innerAbsoluteError_ = std::max(atof(av[++i]),0.0);
+            } else if (arg == "--inner-check-paths" && i+1 < ac) {
+                innerCheckPaths_ = std::max(atoi(av[++i]),1);
+            } else if (arg == "--regression" && i+1 < ac) {
+                regressionPaths_ = std::max(atoi(av[++i]),1);
+            } else if (arg == "--philox") {
+                counterBasedRng_ = true;
+            } else if (arg == "--analytic-bond") {
+                analyticBond_ = true;
+            } else if (arg == "--portfolio" && i+1 < ac) {
+                portfolioFile_ = std::string(av[++i]);
+            } else if (arg == "--model-points" && i+4 < ac) {
+                modelPoints_ = true;
+                compressionTraits_ = qe::CompressionTraits(atof(av[i+1])
+                        ,atof(av[i+2]),atof(av[i+3]),atof(av[i+4]));
+                i += 4;
+            } else if (arg == "--compression-sample" && i+1 < ac) {
+                compressionSample_ = std::max(atoi(av[++i]),1);
+            } else if (arg == "--checkpoint" && i+1 < ac) {
+                checkpointFile_ = std::string(av[++i]);
+            } else if (arg == "--resume") {
+                resume_ = true;
+            } else if (arg == "--force") {
+                force_ = true;
+            } else if (arg == "--columnar") {
+                columnarOutput_ = true;
+            } else if (arg == "--columnar-block" && i+1 < ac) {
+                columnarOutput_ = true;
+                columnarBlockRows_ = std::max(atoi(av[++i]),0);
+            } else {
+                QL_FAIL("ProgramOptions: Unknown or incomplete option " + arg);
+            }
+        }
+        QL_REQUIRE(nThreads_ < 2 || nThreadsInnerMC_ < 2,
+            "ProgramOptions: give either --threads or --inner-threads, each "
+            "outer path thread would start its own inner threads for every "
+            "pricing");
+        QL_REQUIRE(not resume_ || not checkpointFile_.empty(),
+            "ProgramOptions: --resume needs --checkpoint file");
+        QL_REQUIRE(not force_ || (not checkpointFile_.empty() && not resume_),
+            "ProgramOptions: --force needs --checkpoint file and no --resume");
+        QL_REQUIRE(not quasiMonteCarlo_ || not counterBasedRng_,
+            "ProgramOptions: --qmc and --philox are two kinds of inner "
+            "scenarios, give only one of them");
+        QL_REQUIRE(not quasiMonteCarlo_ || innerRelativeError_ <= 0.0,
+            "ProgramOptions: --inner-rel-error needs random scenarios, the "
+            "sample standard error of Sobol points is no error estimate");
+        QL_REQUIRE(innerRelativeError_ <= 0.0 || nBlocksInnerMC_ < 2,
+            "ProgramOptions: --inner-rel-error (and with it "
+            "--inner-abs-error) stops a single stream of scenarios, it "
+            "does not take --inner-blocks k > 1");
+        QL_REQUIRE(not batchedInnerMC_ || (nBlocksInnerMC_ < 2 
+                    && not pathwiseDeltas_ && not controlVariates_
+                    && innerRelativeError_ <= 0.0),
+            "ProgramOptions: --batched runs the inner MC in one block with "
+            "finite difference deltas, it does not take --inner-blocks, "
+            "--pathwise-deltas, --control-variates or --inner-rel-error");
+        if (quasiMonteCarlo_ && (nBlocksInnerMC_ < 2 || batchedInnerMC_))
+            std::cerr << "ProgramOptions: --qmc without --inner-blocks k > 1 "
+                      << "(or with --batched) uses the unshifted Sobol "
+                      << "points, the inner MC has no error estimate" 
+                      << std::endl;
+        QL_REQUIRE(regressionPaths_ == 0 || (not pathwiseDeltas_ 
+                    && not batchedInnerMC_ && not analyticBond_),
+            "ProgramOptions: --regression takes its deltas and the bond "
+            "from the fit, it does not take --pathwise-deltas, --batched "
+            "or --analytic-bond");
+        QL_REQUIRE(not controlVariates_ || model_ == "BS_Vas",
+            "ProgramOptions: --control-variates needs a model whose "
+            "discretised discounted stock is a martingale (BS_Vas)");
+        QL_REQUIRE(not analyticBond_ || model_ == "BS_Vas",
+            "ProgramOptions: --analytic-bond needs a model with a closed "
+            "form zero bond price (BS_Vas)");
+    }
+
     void checkCommandlineParameters(int ac, char** av) const {
-        QL_REQUIRE(ac == 21, 
-        "USAGE: model parameterFile nPaths nHedges nPathsInnerMC nPathPoints r0 S0 L0 contractMaturity rnStockVol rnStockExp rnIrSpeed rnIrLevel rnIrVol rnIrExp rnCorrelation transactionCosts ouputFilename seed");
+        QL_REQUIRE(ac >= 21, 
+        "USAGE: model parameterFile nPaths nHedges nPathsInnerMC nPathPoints r0 S0 L0 contractMaturity rnStockVol rnStockExp rnIrSpeed rnIrLevel rnIrVol rnIrExp rnCorrelation transactionCosts ouputFilename seed [--threads n] [--inner-blocks k] [--inner-threads n] [--pathwise-deltas] [--batched] [--qmc] [--antithetic] [--control-variates] [--inner-rel-error e] [--inner-abs-error a] [--inner-check-paths k] [--regression nPaths] [--philox] [--analytic-bond] [--portfolio contractFile] [--model-points gStep yStep deltaStep reserveQuotientStep] [--compression-sample n] [--checkpoint file] [--resume] [--force] [--columnar] [--columnar-block nRows]");
     }
 
     void checkParsed() const {
@@ -193,6 +435,28 @@ class ProgramOptions {
     double transCosts_; 
     std::string outfilename_;
     unsigned seed_;
+    unsigned nThreads_;
+    unsigned nBlocksInnerMC_;
+    unsigned nThreadsInnerMC_;
+    bool pathwiseDeltas_;
+    bool batchedInnerMC_;
+    bool quasiMonteCarlo_;
+    bool antithetic_;
+    bool controlVariates_;
+    double innerRelativeError_, innerAbsoluteError_;
+    unsigned innerCheckPaths_;
+    unsigned regressionPaths_;
+    bool counterBasedRng_;
+    bool analyticBond_;
+    std::string portfolioFile_;
+    bool modelPoints_;
+    qe::CompressionTraits compressionTraits_;
+    unsigned compressionSample_;
+    std::string checkpointFile_;
+    bool resume_;
+    bool force_;
+    bool columnarOutput_;
+    unsigned columnarBlockRows_;
     bool doHedging_;
 };
 
@@ -20,10 +20,12 @@ namespace qe = QuantLibExt;
 
 typedef flens::SyMatrix<flens::FullStorage<double, flens::ColMajor> > SYMatrix;
 
+// Chain k draws from its own Mersenne Twister seeded with 1 + k
 boost::shared_ptr<qe::McmcAlgo> setupMcmcAlgo(const ProgramOptions& options,
-                                              boost::shared_ptr<qe::McmcModel> p_Model)
+                                              boost::shared_ptr<qe::McmcModel> p_Model,
+                                              unsigned chain = 0)
 {
-    boost::mt19937 MersenneTwister(1u);
+    boost::mt19937 MersenneTwister(1u + chain);
     boost::shared_ptr<qe::McmcAlgo> p_McmcAlgo;
 
     if ( options.algo() == "rwalk" ) {
@@ -34,6 +36,17 @@ boost::shared_ptr<qe::McmcAlgo> setupMcmcAlgo(const ProgramOptions& options,
                                               MersenneTwister,
                                               options.tune(),
                                               options.thin()));
+    } else if ( options.algo() == "adaptive" ) {
+        // the proposal adapts during the burn-in only
+        p_McmcAlgo.reset(new qe::AdaptiveMH(p_Model,
+                                            options.start(),
+                                            options.lb(),
+                                            options.ub(),
+                                            MersenneTwister,
+                                            options.tune(),
+                                            options.burn()*options.thin(),
+                                            options.target_acceptance(),
+                                            options.thin()));
     } else if ( options.algo() == "indep" ) {
         p_McmcAlgo.reset(new qe::IndependentMH(p_Model,
                                                options.start(),
@@ -72,19 +85,79 @@ boost::shared_ptr<qe::McmcModel> setupMcmcModel(const ProgramOptions& options) {
     return p_Model;
 }
 
-void writeResults(const std::vector<std::vector<double> >& parameters,
-				  const std::string& outfilename) {
-	std::ofstream ofile(outfilename.c_str());
-	if (ofile) {
-		for (std::vector<std::vector<double> >::const_iterator i = parameters.begin();
-			 i != parameters.end(); ++i) {
-			std::copy(i->begin(), i->end(), std::ostream_iterator<double>(ofile,","));
-			ofile << std::endl;
-		}
-		ofile.close();
-	} else {
-		throw std::runtime_error("Can't open file for writing: " + outfilename);
-	}
+// Column names of the binary output, in the order of the parameter access
+// classes of the models
+std::vector<std::string> parameterNames(const std::string& model) {
+    const char* bs[] = { "drift", "vola" };
+    const char* cev[] = { "drift", "vola", "exp" };
+    const char* ckls[] = { "speed", "mean", "ir_vola", "ir_exp" };
+    std::vector<std::string> names;
+    if ( model == "BS" || model == "BsVasicek" ) {
+        names.assign(bs, bs+2);
+    } else if ( model == "Cev" || model == "CevCkls" ) {
+        names.assign(cev, cev+3);
+    }
+    if ( model == "Vasicek" || model == "BsVasicek" ) {
+        names.insert(names.end(), ckls, ckls+3);
+    } else if ( model == "Ckls" || model == "CevCkls" ) {
+        names.insert(names.end(), ckls, ckls+4);
+    }
+    if ( model == "BsVasicek" || model == "CevCkls" )
+        names.push_back("rho");
+    return names;
+}
+
+// One chain per replica and temperature, all on the same model
+qe::MultiChainMcmc setupMultiChainMcmc(const ProgramOptions& options)
+{
+    boost::shared_ptr<qe::McmcModel> p_Model(setupMcmcModel(options));
+    unsigned n_chains = options.chains()*options.temperatures().size();
+    std::vector<boost::shared_ptr<qe::McmcAlgo> > chains;
+    for (unsigned k=0; k < n_chains; ++k)
+        chains.push_back(setupMcmcAlgo(options, p_Model, k));
+    return qe::MultiChainMcmc(chains, options.temperatures(), options.threads(),
+                              1u + n_chains);
+}
+
+// Names of the output columns, with the replica number last if there are
+// several replicas
+std::vector<std::string> outputNames(const ProgramOptions& options) {
+    std::vector<std::string> names = parameterNames(options.model());
+    if (options.chains() > 1)
+        names.push_back("chain");
+    return names;
+}
+
+// The draws are written in batches as they come, text or binary columns
+boost::shared_ptr<qe::ChainSink> setupChainSink(const ProgramOptions& options) {
+    boost::shared_ptr<qe::ChainSink> p_Sink;
+    std::vector<std::string> names = outputNames(options);
+    if (options.columnar()) {
+        p_Sink.reset(new qe::ColumnarChainWriter(options.outfile(),
+                                                 names,
+                                                 options.N()*options.chains(),
+                                                 options.columnar_block(),
+                                                 options.summary()));
+    } else {
+        p_Sink.reset(new qe::TextChainWriter(options.outfile(),
+                                             names.size(),
+                                             options.summary()));
+    }
+    return p_Sink;
+}
+
+void printMultiChainStatus(const qe::MultiChainMcmc& mcmc,
+                           const std::vector<std::string>& names) {
+    for (unsigned t=0; t+1 < mcmc.temperatures(); ++t)
+        std::cout << "swap rate " << t << "-" << t+1 << "  : "
+                  << mcmc.swap_acceptance_ratio(t) << std::endl;
+    if (mcmc.replicas() > 1) {
+        std::cout << "R-hat        : ";
+        for (unsigned i=0; i < names.size(); ++i)
+            std::cout << names[i] << " " << mcmc.r_hat(i)
+                      << (i+1 < names.size() ? ", " : "");
+        std::cout << std::endl;
+    }
 }
 
 int main(int ac, char** av)
@@ -99,17 +172,33 @@ int main(int ac, char** av)
             options.print_status();
         }
 
-        boost::shared_ptr<qe::McmcAlgo>
-            p_McmcAlgo(setupMcmcAlgo(options, setupMcmcModel(options)));
-
-        for (unsigned i=0; i < options.burn(); ++i)
-            p_McmcAlgo->next_scenario();
-
-        std::vector< std::vector<double> > parameters;
-        for (unsigned i=0; i < options.N(); ++i)
-            parameters.push_back(p_McmcAlgo->next_scenario());
+        // The chains run in segments of swap-interval draws, the draws of
+        // the cold chains are written replica by replica per segment
+        qe::MultiChainMcmc mcmc(setupMultiChainMcmc(options));
+        unsigned interval = options.swap_interval();
+
+        for (unsigned i=0; i < options.burn(); i += interval)
+            mcmc.next_segment(std::min(interval, options.burn() - i));
+        mcmc.reset_statistics();
+
+        boost::shared_ptr<qe::ChainSink> p_Sink(setupChainSink(options));
+        for (unsigned i=0; i < options.N(); i += interval) {
+            const std::vector< std::vector<double> >& draws
+                = mcmc.next_segment(std::min(interval, options.N() - i));
+            for (unsigned r=0; r < draws.size(); ++r) {
+                for (unsigned j=0; j < draws[r].size(); ++j) {
+                    std::vector<double> row(draws[r][j]);
+                    if (options.chains() > 1)
+                        row.push_back(r);
+                    p_Sink->put(row);
+                }
+            }
+        }
+        p_Sink->close();
 
-        writeResults(parameters, options.outfile());
+        printMultiChainStatus(mcmc, parameterNames(options.model()));
+        if (p_Sink->has_summary())
+            p_Sink->summary().print(std::cout, outputNames(options));
 
     } catch (std::exception& e) {
         std::cerr << "main(): caught exception, message: " << std::endl
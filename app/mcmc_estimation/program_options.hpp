@@ -57,6 +57,9 @@ public:
 		std::cout << "burn         : " << burn() << std::endl;
 		std::cout << "tune         : " << tune() << std::endl;
 		std::cout << "thin         : " << thin() << std::endl;
+		if (algo() == "adaptive") {
+			std::cout << "targetAccept : " << target_acceptance() << std::endl;
+		}
 		std::cout << "start        : ";
 		print_vector(start());
 		std::cout << "lb           : ";
@@ -71,6 +74,14 @@ public:
 		if (vm.count("hessian")) {
 			std::cout << "hessian      : " << hessian() << std::endl;
 		}
+		std::cout << "columnar     : " << columnar() << std::endl;
+		std::cout << "columnarBlock: " << columnar_block() << std::endl;
+		std::cout << "summary      : " << summary() << std::endl;
+		std::cout << "chains       : " << chains() << std::endl;
+		std::cout << "temperatures : ";
+		print_vector(temperatures());
+		std::cout << "swapInterval : " << swap_interval() << std::endl;
+		std::cout << "threads      : " << threads() << std::endl;
 	}
 
 	template <class T>
@@ -123,6 +134,31 @@ public:
 	std::string hessian() const {
 		return vm["hessian"].as<std::string>();
 	}
+	bool columnar() const {
+		return vm.count("columnar") || vm.count("columnar-block");
+	}
+	unsigned columnar_block() const {
+		return vm.count("columnar-block") ? vm["columnar-block"].as<unsigned>() : 0;
+	}
+	bool summary() const {
+		return vm.count("summary");
+	}
+	double target_acceptance() const {
+		return vm.count("target-acceptance") ? vm["target-acceptance"].as<double>() : 0.234;
+	}
+	unsigned chains() const {
+		return vm.count("chains") ? std::max(vm["chains"].as<unsigned>(), 1u) : 1;
+	}
+	std::vector<double> temperatures() const {
+		return vm.count("temperatures") ? vm["temperatures"].as< std::vector<double> >()
+			: std::vector<double>(1, 1.0);
+	}
+	unsigned swap_interval() const {
+		return vm.count("swap-interval") ? std::max(vm["swap-interval"].as<unsigned>(), 1u) : 100;
+	}
+	unsigned threads() const {
+		return vm.count("threads") ? std::max(vm["threads"].as<unsigned>(), 1u) : 1;
+	}
 	bool isSinglePathModel() const {
 		return  model() == "BS"  || model() == "Vasicek"
 			|| model() == "Cev" || model() == "Ckls";
@@ -133,7 +169,7 @@ private:
 		config.add_options()
 			("help", "produce help message")
 			("model", po::value<std::string>(), "the asset model to use")
-			("algo", po::value<std::string>(), "MCMC algorithm to use (indep or rwalk)")
+			("algo", po::value<std::string>(), "MCMC algorithm to use (indep, rwalk or adaptive)")
 			("file", po::value<std::string>(), "file containing the time-series")
 			("outfile", po::value<std::string>(), "file to which results are written")
 			("dt", po::value<double>(), "time between observations in years")
@@ -149,6 +185,19 @@ private:
 			("ub", po::value< std::vector<double> >(), "upper bound for parameters")
 			("hessian", po::value<std::string>(),
 			 "filename for file containing hessian matrix at maximum likelihood estimate (optional)")
+			("columnar", "write outfile as binary columns instead of text (optional)")
+			("columnar-block", po::value<unsigned>(),
+			 "rows per compressed block of the binary columns, implies columnar (optional)")
+			("target-acceptance", po::value<double>(),
+			 "acceptance rate the adaptive algorithm tunes its proposal scale to (optional, 0.234)")
+			("summary", "print running mean, covariance and quantiles of the draws (optional)")
+			("chains", po::value<unsigned>(),
+			 "number of independent replicas, R-hat is computed over them (optional, 1)")
+			("temperatures", po::value< std::vector<double> >(),
+			 "temperature ladder of each replica for parallel tempering, starting with 1 (optional, 1)")
+			("swap-interval", po::value<unsigned>(),
+			 "draws between swap attempts of neighbouring temperatures (optional, 100)")
+			("threads", po::value<unsigned>(), "threads the chains run on (optional, 1)")
 			;
 	}
 
@@ -160,7 +209,8 @@ private:
 			&& check_model_valid()
 			&& check_files_exist()
 			&& check_parameter_lengths()
-			&& check_mean();
+			&& check_mean()
+			&& check_temperatures();
 	}
 
 	bool check_help() {
@@ -241,6 +291,18 @@ private:
 		return opts_valid;
 	}
 
+	bool check_temperatures() {
+		std::vector<double> t = temperatures();
+		bool increasing = !t.empty() && t[0] == 1.0;
+		for (unsigned i=1; increasing && i < t.size(); ++i)
+			increasing = t[i] > t[i-1];
+		if (!increasing) {
+			opts_valid = false;
+			errors << "temperatures must start with 1 and increase." << std::endl;
+		}
+		return opts_valid;
+	}
+
     po::options_description cmdline_options;
     po::options_description cfgfile_options;    
     po::options_description config;
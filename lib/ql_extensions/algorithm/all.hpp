@@ -1,2 +1,3 @@
 #include "check.hpp"
 #include "devector_copy.hpp"
+#include "parallel_transform.hpp"
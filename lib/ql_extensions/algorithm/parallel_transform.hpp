@@ -0,0 +1,160 @@
+#ifndef ql_extensions__algorithm__parallel_transform_hpp__
+#define ql_extensions__algorithm__parallel_transform_hpp__
+
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace QuantLibExt {
+
+	// Hands out indices [0,n) one at a time to the worker threads, so that
+	// slow elements do not leave the other workers idle. Also remembers the
+	// first error a worker ran into.
+	class IndexDispenser {
+	public:
+		IndexDispenser(std::size_t n) : next_(0), n_(n), failed_(false) {}
+
+		bool next(std::size_t& i) {
+			boost::mutex::scoped_lock lock(mutex_);
+			if (failed_ || next_ >= n_)
+				return false;
+			i = next_++;
+			return true;
+		}
+
+		void fail(const std::string& message) {
+			boost::mutex::scoped_lock lock(mutex_);
+			if (not failed_) {
+				failed_ = true;
+				message_ = message;
+			}
+		}
+
+		void rethrow() const {
+			if (failed_)
+				throw std::runtime_error("parallel_transform: " + message_);
+		}
+
+	private:
+		boost::mutex mutex_;
+		std::size_t next_, n_;
+		bool failed_;
+		std::string message_;
+	};
+
+	template <class RandomAccessIterator1, class RandomAccessIterator2,
+			  class RandomAccessIterator3, class BinaryOperator>
+	class TransformWorker {
+	public:
+		TransformWorker(RandomAccessIterator1 first1, RandomAccessIterator2 first2,
+						RandomAccessIterator3 result, BinaryOperator f,
+						IndexDispenser& indices)
+			: first1_(first1), first2_(first2), result_(result), f_(f),
+			  indices_(indices) {}
+
+		void operator()() {
+			std::size_t i;
+			try {
+				while (indices_.next(i))
+					*(result_ + i) = f_(*(first1_ + i), *(first2_ + i));
+			} catch (std::exception& e) {
+				indices_.fail(e.what());
+			} catch (...) {
+				indices_.fail("unknown error");
+			}
+		}
+
+	private:
+		RandomAccessIterator1 first1_;
+		RandomAccessIterator2 first2_;
+		RandomAccessIterator3 result_;
+		BinaryOperator f_;
+		IndexDispenser& indices_;
+	};
+
+	template <class RandomAccessIterator1, class RandomAccessIterator2,
+			  class UnaryOperator>
+	class UnaryTransformWorker {
+	public:
+		UnaryTransformWorker(RandomAccessIterator1 first, RandomAccessIterator2 result,
+							 UnaryOperator f, IndexDispenser& indices)
+			: first_(first), result_(result), f_(f), indices_(indices) {}
+
+		void operator()() {
+			std::size_t i;
+			try {
+				while (indices_.next(i))
+					*(result_ + i) = f_(*(first_ + i));
+			} catch (std::exception& e) {
+				indices_.fail(e.what());
+			} catch (...) {
+				indices_.fail("unknown error");
+			}
+		}
+
+	private:
+		RandomAccessIterator1 first_;
+		RandomAccessIterator2 result_;
+		UnaryOperator f_;
+		IndexDispenser& indices_;
+	};
+
+	// Same as the binary std::transform, but the elements are processed by
+	// nThreads worker threads. Every result is written to the position of its
+	// input, so the output does not depend on the number of threads as long
+	// as f does not depend on the order of the calls. Each worker gets its
+	// own copy of f.
+	template <class RandomAccessIterator1, class RandomAccessIterator2,
+			  class RandomAccessIterator3, class BinaryOperator>
+	RandomAccessIterator3 parallel_transform(RandomAccessIterator1 first1,
+											 RandomAccessIterator1 last1,
+											 RandomAccessIterator2 first2,
+											 RandomAccessIterator3 result,
+											 BinaryOperator f,
+											 unsigned nThreads) {
+		std::size_t n = last1 - first1;
+		if (nThreads <= 1 || n <= 1)
+			return std::transform(first1, last1, first2, result, f);
+
+		IndexDispenser indices(n);
+		boost::thread_group workers;
+		for (unsigned k=0; k < nThreads && k < n; ++k) {
+			workers.create_thread(
+				TransformWorker<RandomAccessIterator1, RandomAccessIterator2,
+								RandomAccessIterator3, BinaryOperator>(
+									first1, first2, result, f, indices));
+		}
+		workers.join_all();
+		indices.rethrow();
+		return result + n;
+	}
+
+	// Same as the unary std::transform, see above.
+	template <class RandomAccessIterator1, class RandomAccessIterator2,
+			  class UnaryOperator>
+	RandomAccessIterator2 parallel_transform(RandomAccessIterator1 first,
+											 RandomAccessIterator1 last,
+											 RandomAccessIterator2 result,
+											 UnaryOperator f,
+											 unsigned nThreads) {
+		std::size_t n = last - first;
+		if (nThreads <= 1 || n <= 1)
+			return std::transform(first, last, result, f);
+
+		IndexDispenser indices(n);
+		boost::thread_group workers;
+		for (unsigned k=0; k < nThreads && k < n; ++k) {
+			workers.create_thread(
+				UnaryTransformWorker<RandomAccessIterator1, RandomAccessIterator2,
+									 UnaryOperator>(first, result, f, indices));
+		}
+		workers.join_all();
+		indices.rethrow();
+		return result + n;
+	}
+}
+
+#endif
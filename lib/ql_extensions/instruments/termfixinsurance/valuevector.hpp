@@ -5,6 +5,7 @@
 #include <iomanip>
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 namespace QuantLibExt {
 
@@ -149,6 +150,10 @@ ValueVector sqrt(const ValueVector& o) {
     return temp;
 }
 
+double maxComponent(const ValueVector& o) {
+    return std::max(std::max(std::max(o.V,o.C),std::max(o.D,o.Res)),o.Surr);
+}
+
 
 };
 
@@ -1,2 +1,4 @@
+#include "chain_sink.hpp"
 #include "mcmc_algorithms.hpp"
 #include "mcmc_models.hpp"
+#include "multi_chain.hpp"
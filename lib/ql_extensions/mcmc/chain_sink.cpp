@@ -0,0 +1,243 @@
+#include "chain_sink.hpp"
+
+#include <cmath>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+namespace QuantLibExt {
+
+/*************************************************
+ * P2Quantile
+ ************************************************/
+
+P2Quantile::P2Quantile(double prob)
+	: p(prob), n_seen(0)
+{
+	for (int i=0; i<5; ++i) {
+		q[i] = 0.0;
+		n[i] = i+1;
+	}
+	desired[0] = 1.0;
+	desired[1] = 1.0 + 2.0*p;
+	desired[2] = 1.0 + 4.0*p;
+	desired[3] = 3.0 + 2.0*p;
+	desired[4] = 5.0;
+	increment[0] = 0.0;
+	increment[1] = p/2.0;
+	increment[2] = p;
+	increment[3] = (1.0+p)/2.0;
+	increment[4] = 1.0;
+}
+
+void P2Quantile::add(double x) {
+	if (n_seen < 5) {
+		q[n_seen++] = x;
+		if (n_seen == 5)
+			std::sort(q, q+5);
+		return;
+	}
+	++n_seen;
+
+	int k;
+	if (x < q[0]) {
+		q[0] = x;
+		k = 0;
+	} else if (x >= q[4]) {
+		q[4] = x;
+		k = 3;
+	} else {
+		k = 0;
+		while (x >= q[k+1])
+			++k;
+	}
+	for (int i=k+1; i<5; ++i)
+		n[i] += 1.0;
+	for (int i=0; i<5; ++i)
+		desired[i] += increment[i];
+
+	for (int i=1; i<4; ++i) {
+		double d = desired[i] - n[i];
+		if ((d >= 1.0 && n[i+1]-n[i] > 1.0) || (d <= -1.0 && n[i-1]-n[i] < -1.0)) {
+			int s = d > 0.0 ? 1 : -1;
+			double candidate = parabolic(i, s);
+			if (q[i-1] < candidate && candidate < q[i+1])
+				q[i] = candidate;
+			else
+				q[i] = linear(i, s);
+			n[i] += s;
+		}
+	}
+}
+
+double P2Quantile::parabolic(int i, int d) const {
+	return q[i] + d/(n[i+1]-n[i-1])
+		* ((n[i]-n[i-1]+d)*(q[i+1]-q[i])/(n[i+1]-n[i])
+		   + (n[i+1]-n[i]-d)*(q[i]-q[i-1])/(n[i]-n[i-1]));
+}
+
+double P2Quantile::linear(int i, int d) const {
+	return q[i] + d*(q[i+d]-q[i])/(n[i+d]-n[i]);
+}
+
+double P2Quantile::value() const {
+	if (n_seen >= 5)
+		return q[2];
+	if (n_seen == 0)
+		return 0.0;
+	std::vector<double> sorted(q, q+n_seen);
+	std::sort(sorted.begin(), sorted.end());
+	unsigned rank = unsigned(std::floor(p*(n_seen-1) + 0.5));
+	return sorted[rank];
+}
+
+
+/*************************************************
+ * ChainSummary
+ ************************************************/
+
+ChainSummary::ChainSummary(unsigned n_params,
+						   const std::vector<double>& probabilities)
+	: n_parameters(n_params), n_draws(0),
+	  mean_v(n_params, 0.0), delta(n_params, 0.0),
+	  comoment(n_params*n_params, 0.0),
+	  probs(probabilities)
+{
+	for (unsigned i=0; i < n_parameters; ++i)
+		for (unsigned k=0; k < probs.size(); ++k)
+			quantiles.push_back(P2Quantile(probs[k]));
+}
+
+std::vector<double> ChainSummary::default_probabilities() {
+	std::vector<double> p;
+	p.push_back(0.025);
+	p.push_back(0.5);
+	p.push_back(0.975);
+	return p;
+}
+
+void ChainSummary::add(const ParamType& p) {
+	++n_draws;
+	for (unsigned i=0; i < n_parameters; ++i) {
+		delta[i] = p[i] - mean_v[i];
+		mean_v[i] += delta[i]/n_draws;
+	}
+	for (unsigned i=0; i < n_parameters; ++i)
+		for (unsigned j=i; j < n_parameters; ++j)
+			comoment[i*n_parameters+j] += delta[i]*(p[j]-mean_v[j]);
+	for (unsigned i=0; i < n_parameters; ++i)
+		for (unsigned k=0; k < probs.size(); ++k)
+			quantiles[i*probs.size()+k].add(p[i]);
+}
+
+double ChainSummary::covariance(unsigned i, unsigned j) const {
+	if (n_draws < 2)
+		return 0.0;
+	if (i > j)
+		std::swap(i, j);
+	return comoment[i*n_parameters+j]/(n_draws-1);
+}
+
+double ChainSummary::quantile(unsigned parameter, unsigned k) const {
+	return quantiles[parameter*probs.size()+k].value();
+}
+
+void ChainSummary::print(std::ostream& out,
+						 const std::vector<std::string>& names) const {
+	out << "draws        : " << n_draws << std::endl;
+	out << "parameter, mean, sd";
+	for (unsigned k=0; k < probs.size(); ++k)
+		out << ", q" << probs[k];
+	out << std::endl;
+	for (unsigned i=0; i < n_parameters; ++i) {
+		out << (i < names.size() ? names[i] : "") << ", " << mean_v[i]
+			<< ", " << std::sqrt(covariance(i,i));
+		for (unsigned k=0; k < probs.size(); ++k)
+			out << ", " << quantile(i,k);
+		out << std::endl;
+	}
+	out << "covariance   :" << std::endl;
+	for (unsigned i=0; i < n_parameters; ++i) {
+		for (unsigned j=0; j < n_parameters; ++j)
+			out << covariance(i,j) << (j+1 < n_parameters ? ", " : "");
+		out << std::endl;
+	}
+}
+
+
+/*************************************************
+ * ChainSink
+ ************************************************/
+
+ChainSink::ChainSink(unsigned n_params, bool summarize)
+	: n_parameters(n_params)
+{
+	if (summarize)
+		p_Summary.reset(new ChainSummary(n_parameters));
+}
+
+void ChainSink::put(const ParamType& p) {
+	if (p_Summary)
+		p_Summary->add(p);
+	write(p);
+}
+
+
+/*************************************************
+ * TextChainWriter
+ ************************************************/
+
+TextChainWriter::TextChainWriter(const std::string& filename,
+								 unsigned n_parameters,
+								 bool summarize,
+								 unsigned batch_sz)
+	: ChainSink(n_parameters, summarize),
+	  ofile(filename.c_str()),
+	  batch_size(std::max(batch_sz, 1u)),
+	  n_buffered(0)
+{
+	if (not ofile)
+		throw std::runtime_error("Can't open file for writing: " + filename);
+}
+
+void TextChainWriter::write(const ParamType& p) {
+	std::copy(p.begin(), p.end(), std::ostream_iterator<double>(batch,","));
+	batch << '\n';
+	if (++n_buffered == batch_size)
+		flush();
+}
+
+void TextChainWriter::flush() {
+	ofile << batch.str();
+	batch.str("");
+	n_buffered = 0;
+}
+
+void TextChainWriter::close() {
+	flush();
+	ofile.close();
+}
+
+
+/*************************************************
+ * ColumnarChainWriter
+ ************************************************/
+
+ColumnarChainWriter::ColumnarChainWriter(const std::string& filename,
+										 const std::vector<std::string>& names,
+										 unsigned n_draws,
+										 unsigned block_rows,
+										 bool summarize)
+	: ChainSink(names.size(), summarize),
+	  writer(filename, names, n_draws, block_rows)
+{}
+
+void ColumnarChainWriter::write(const ParamType& p) {
+	writer.append(p);
+}
+
+void ColumnarChainWriter::close() {
+	writer.close();
+}
+
+}
@@ -0,0 +1,141 @@
+#ifndef ql_extensions__mcmc__chain_sink_hpp
+#define ql_extensions__mcmc__chain_sink_hpp
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+
+#include <boost/shared_ptr.hpp>
+
+#include <utils/columnar.hpp>
+
+namespace QuantLibExt {
+
+typedef std::vector<double> ParamType;
+
+// Quantile estimate in constant memory, the P^2 algorithm of Jain and
+// Chlamtac (1985): five markers at the minimum, p/2, p, (1+p)/2 and the
+// maximum are moved towards their ideal positions with piecewise
+// parabolic steps.
+class P2Quantile
+{
+public:
+	P2Quantile(double p);
+
+	void add(double x);
+	// exact for fewer than five values
+	double value() const;
+
+private:
+	double parabolic(int i, int d) const;
+	double linear(int i, int d) const;
+
+	double p;
+	unsigned long n_seen;
+	double q[5];
+	double n[5];
+	double desired[5];
+	double increment[5];
+};
+
+
+// Running summaries of a chain: mean and covariance (Welford), P^2 quantile
+// estimates of every parameter
+class ChainSummary
+{
+public:
+	ChainSummary(unsigned n_parameters,
+				 const std::vector<double>& probabilities = default_probabilities());
+
+	void add(const ParamType& p);
+
+	unsigned long count() const { return n_draws; }
+	const ParamType& mean() const { return mean_v; }
+	double covariance(unsigned i, unsigned j) const;
+	const std::vector<double>& probabilities() const { return probs; }
+	double quantile(unsigned parameter, unsigned k) const;
+
+	// one line per parameter: mean, standard deviation and the quantiles,
+	// then the covariance matrix
+	void print(std::ostream& out, const std::vector<std::string>& names) const;
+
+	static std::vector<double> default_probabilities();
+
+private:
+	unsigned n_parameters;
+	unsigned long n_draws;
+	ParamType mean_v, delta;
+	// sums of the products of the deviations, row-major
+	std::vector<double> comoment;
+	std::vector<double> probs;
+	std::vector<P2Quantile> quantiles;
+};
+
+
+// Takes the draws of a chain as they are produced and writes them in
+// batches, so memory does not grow with the length of the chain. Keeps a
+// ChainSummary of the draws if asked to.
+class ChainSink
+{
+public:
+	ChainSink(unsigned n_parameters, bool summarize);
+	virtual ~ChainSink() {}
+
+	void put(const ParamType& p);
+	// writes the last batch
+	virtual void close() = 0;
+
+	bool has_summary() const { return p_Summary.get() != 0; }
+	const ChainSummary& summary() const { return *p_Summary; }
+
+protected:
+	virtual void write(const ParamType& p) = 0;
+
+	unsigned n_parameters;
+	boost::shared_ptr<ChainSummary> p_Summary;
+};
+
+
+// Comma separated text, one draw per line, with trailing comma
+class TextChainWriter : public ChainSink
+{
+public:
+	TextChainWriter(const std::string& filename,
+					unsigned n_parameters,
+					bool summarize = false,
+					unsigned batch_size = 4096);
+	virtual void close();
+
+protected:
+	virtual void write(const ParamType& p);
+
+	void flush();
+
+	std::ofstream ofile;
+	std::ostringstream batch;
+	unsigned batch_size;
+	unsigned n_buffered;
+};
+
+
+// Binary columns (see utils/columnar.hpp), one per parameter
+class ColumnarChainWriter : public ChainSink
+{
+public:
+	ColumnarChainWriter(const std::string& filename,
+						const std::vector<std::string>& names,
+						unsigned n_draws,
+						unsigned block_rows = 0,
+						bool summarize = false);
+	virtual void close();
+
+protected:
+	virtual void write(const ParamType& p);
+
+	ColumnarWriter writer;
+};
+
+}
+
+#endif
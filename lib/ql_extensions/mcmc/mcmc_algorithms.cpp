@@ -1,5 +1,7 @@
 #include "mcmc_algorithms.hpp"
 
+#include <cmath>
+
 namespace QuantLibExt {
 
 /*************************************************
@@ -20,7 +22,8 @@ McmcAlgo::McmcAlgo(boost::shared_ptr<McmcModel> p_model,
 	  thin(thining),
 	  n_generated(0),
 	  n_accepted(0),
-	  n_parameters(start_values.size())
+	  n_parameters(start_values.size()),
+	  inverse_temperature(1.0)
 {}
 
 bool McmcAlgo::fulfills_constraints(const ParamType& p) const {
@@ -121,20 +124,31 @@ void MetropolisHastings::setup_matricies(const SYMatrix &Hessian, double tp,
 
 ParamType MetropolisHastings::next_scenario() 
 {
-    for ( unsigned l=0 ; l < thin; ++l ) {
-		draw_random_vector();
-		generate_candidate();
-		++n_generated;
-
-		if (accept_candidate()) {
-			++n_accepted;
-            last_accepted_v = candidate_v;
-            last_accepted = candidate;
-		}
-    }
+    for ( unsigned l=0 ; l < thin; ++l )
+		step();
 	return last_accepted;
 }
 
+bool MetropolisHastings::step()
+{
+	draw_random_vector();
+	generate_candidate();
+	++n_generated;
+
+	if (accept_candidate()) {
+		++n_accepted;
+		last_accepted_v = candidate_v;
+		last_accepted = candidate;
+		return true;
+	}
+	return false;
+}
+
+void MetropolisHastings::set_state(const ParamType& p) {
+	McmcAlgo::set_state(p);
+	copy_to_devector(last_accepted.begin(), last_accepted_v);
+}
+
 void MetropolisHastings::draw_random_vector() {
 	for (unsigned k=1; k<= n_parameters; ++k) 
             random_v(k) = nd();
@@ -152,7 +166,8 @@ bool MetropolisHastings::accept_candidate() const
         log_q_old = log_proposal_density(last_accepted);
         log_q_new = log_proposal_density(candidate);
 
-        alpha = exp(log_f_new - log_f_old + log_q_old - log_q_new);
+        alpha = exp(inverse_temperature*(log_f_new - log_f_old)
+                    + log_q_old - log_q_new);
 
         return ( alpha > ud() );
     } else { 
@@ -186,6 +201,88 @@ void RandomWalkMH::generate_candidate() {
 	copy_from_devector(candidate_v, candidate.begin());
 }
 
+/*************************************************
+ * AdaptiveMH
+ ************************************************/
+AdaptiveMH::AdaptiveMH(boost::shared_ptr<McmcModel> p_Model,
+                       const ParamType& start_values,
+                       const ParamType& lb,
+                       const ParamType& ub,
+                       boost::mt19937 generator,
+                       double tuning,
+                       unsigned adapt_steps,
+                       double target,
+                       unsigned thin,
+                       const SYMatrix& Hessian)
+	: RandomWalkMH(p_Model, start_values, lb, ub,
+				   generator, tuning, thin, Hessian),
+	  n_adapt(adapt_steps), n_adapted(0),
+	  target_acceptance(target), log_scale(0.0),
+	  n_draws(10.0*n_parameters),
+	  mean_v(n_parameters), delta_v(n_parameters)
+{
+	mean_v = last_accepted_v;
+}
+
+ParamType AdaptiveMH::next_scenario()
+{
+	for ( unsigned l=0 ; l < thin; ++l ) {
+		bool accepted = step();
+		if (n_adapted < n_adapt)
+			adapt(accepted);
+	}
+	return last_accepted;
+}
+
+double AdaptiveMH::proposal_scale() const {
+	return std::exp(log_scale);
+}
+
+void AdaptiveMH::generate_candidate() {
+	double scale = proposal_scale();
+	for (unsigned k=1; k <= n_parameters; ++k)
+		random_v(k) *= scale;
+	RandomWalkMH::generate_candidate();
+}
+
+void AdaptiveMH::adapt(bool accepted)
+{
+	++n_adapted;
+	log_scale += ((accepted ? 1.0 : 0.0) - target_acceptance)
+		/ std::pow(double(n_adapted), 0.6);
+
+	// Welford with the current state as draw n:
+	//   C_n = (n-1)/n (C_{n-1} + d d^T / n),  d = x_n - mean_{n-1}
+	// so L_n = sqrt((n-1)/n) * update(L_{n-1}, d/sqrt(n))
+	n_draws += 1.0;
+	for (unsigned k=1; k <= n_parameters; ++k) {
+		double d = last_accepted_v(k) - mean_v(k);
+		mean_v(k) += d/n_draws;
+		delta_v(k) = d/std::sqrt(n_draws);
+	}
+	cholesky_update(cholesky_ll, delta_v);
+
+	double shrink = std::sqrt((n_draws-1.0)/n_draws);
+	for (unsigned row=1; row <= n_parameters; ++row)
+		for (unsigned col=1; col <= row; ++col)
+			cholesky_ll(row,col) *= shrink;
+}
+
+void AdaptiveMH::cholesky_update(GEMatrix &L, DEVector &x)
+{
+	unsigned N = x.length();
+	for (unsigned k=1; k <= N; ++k) {
+		double r = std::sqrt(L(k,k)*L(k,k) + x(k)*x(k));
+		double c = r / L(k,k);
+		double s = x(k) / L(k,k);
+		L(k,k) = r;
+		for (unsigned i=k+1; i <= N; ++i) {
+			L(i,k) = (L(i,k) + s*x(i)) / c;
+			x(i) = c*x(i) - s*L(i,k);
+		}
+	}
+}
+
 /*************************************************
  * IndependentMH
  ************************************************/
@@ -39,6 +39,16 @@ public:
 	virtual ParamType next_scenario() = 0;
 	virtual double acceptance_ratio() const;
 
+	// The chain targets likelihood^inverse_temperature (tempering), 1 by
+	// default
+	void set_inverse_temperature(double beta) { inverse_temperature = beta; }
+	double get_inverse_temperature() const { return inverse_temperature; }
+
+	// current state, and replacing it (replica exchange)
+	const ParamType& state() const { return last_accepted; }
+	virtual void set_state(const ParamType& p) { last_accepted = p; }
+	double log_likelihood() const { return p_Model->log_likelihood(last_accepted); }
+
 protected:
 	bool fulfills_constraints(const ParamType &p) const;
 
@@ -51,6 +61,7 @@ protected:
 	unsigned n_generated;
 	unsigned n_accepted;
 	unsigned n_parameters;
+	double inverse_temperature;
 };
 
 
@@ -70,6 +81,8 @@ public:
 					   unsigned thin=1u,
 					   const SYMatrix& Hessian = SYMatrix());
 
+	virtual void set_state(const ParamType& p);
+
 protected:
 
     double tuning_parameter;
@@ -87,6 +100,8 @@ protected:
     static void setup_matricies(const SYMatrix &Hessian, double tp, 
 								GEMatrix &cholesky_ll, GEMatrix &inverse_covar);
 	virtual ParamType next_scenario();
+	// one candidate, true if it was accepted
+	bool step();
 	void draw_random_vector();
     bool accept_candidate() const; 
 };
@@ -109,6 +124,45 @@ protected:
     virtual double log_proposal_density(const ParamType& p) const;
 };
 
+// Adaptive Metropolis (Haario, Saksman, Tamminen 2001): during the first
+// n_adapt steps the proposal covariance follows the empirical covariance of
+// the chain, whose Cholesky factor is kept up to date with rank-one updates,
+// and its scale follows a Robbins-Monro recursion towards the target
+// acceptance rate. The initial proposal (tuning and Hessian as for
+// RandomWalkMH) counts as 10 draws per parameter. After n_adapt steps the
+// proposal is fixed, so only the burn-in should adapt.
+class AdaptiveMH : public RandomWalkMH
+{
+public:
+    AdaptiveMH(boost::shared_ptr<McmcModel> p_Model,
+			   const ParamType& start_vals,
+			   const ParamType& lb,
+			   const ParamType& ub,
+			   boost::mt19937 generator,
+			   double tuning,
+			   unsigned n_adapt,
+			   double target_acceptance = 0.234,
+			   unsigned thin=1u,
+			   const SYMatrix& Hessian = SYMatrix());
+
+	virtual ParamType next_scenario();
+	double proposal_scale() const;
+
+protected:
+	virtual void generate_candidate();
+	void adapt(bool accepted);
+
+	// L L^T + x x^T for lower triangular L, x is overwritten
+	static void cholesky_update(GEMatrix &L, DEVector &x);
+
+	unsigned n_adapt;
+	unsigned n_adapted;
+	double target_acceptance;
+	double log_scale;
+	double n_draws;
+	DEVector mean_v, delta_v;
+};
+
 class IndependentMH : public MetropolisHastings
 {
 public:
@@ -0,0 +1,122 @@
+#include "multi_chain.hpp"
+
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include <algorithm/parallel_transform.hpp>
+
+namespace QuantLibExt {
+
+namespace {
+
+	// n draws of one chain
+	class RunSegment {
+	public:
+		RunSegment(unsigned n) : n(n) {}
+		std::vector<ParamType> operator()(const boost::shared_ptr<McmcAlgo>& chain) const {
+			std::vector<ParamType> draws(n);
+			for (unsigned i=0; i < n; ++i)
+				draws[i] = chain->next_scenario();
+			return draws;
+		}
+	private:
+		unsigned n;
+	};
+
+}
+
+MultiChainMcmc::MultiChainMcmc(const std::vector<boost::shared_ptr<McmcAlgo> >& chain_vector,
+							   const ParamType& temperatures,
+							   unsigned threads,
+							   unsigned swap_seed)
+	: chains(chain_vector), temps(temperatures),
+	  n_replicas(temperatures.empty() ? 0 : chain_vector.size()/temperatures.size()),
+	  n_threads(std::max(threads, 1u)), n_rounds(0),
+	  ud(boost::mt19937(swap_seed), boost::uniform_real<>(0,1)),
+	  swaps_tried(temperatures.size(), 0), swaps_accepted(temperatures.size(), 0)
+{
+	if (temps.empty() || temps[0] != 1.0)
+		throw std::invalid_argument("MultiChainMcmc: the first temperature must be 1");
+	for (unsigned t=1; t < temps.size(); ++t)
+		if (temps[t] <= temps[t-1])
+			throw std::invalid_argument("MultiChainMcmc: temperatures must increase");
+	if (n_replicas == 0 || chains.size() != n_replicas*temps.size())
+		throw std::invalid_argument("MultiChainMcmc: need one chain per replica and temperature");
+
+	for (unsigned k=0; k < chains.size(); ++k)
+		chains[k]->set_inverse_temperature(1.0/temps[k % temps.size()]);
+	cold_draws.resize(n_replicas);
+	reset_statistics();
+}
+
+const std::vector<std::vector<ParamType> >& MultiChainMcmc::next_segment(unsigned n) {
+	std::vector<std::vector<ParamType> > draws(chains.size());
+	parallel_transform(chains.begin(), chains.end(), draws.begin(),
+					   RunSegment(n), n_threads);
+
+	for (unsigned r=0; r < n_replicas; ++r) {
+		cold_draws[r].swap(draws[r*temps.size()]);
+		for (unsigned i=0; i < cold_draws[r].size(); ++i)
+			summaries[r].add(cold_draws[r][i]);
+	}
+	swap_states(n_rounds++);
+	return cold_draws;
+}
+
+void MultiChainMcmc::swap_states(unsigned round) {
+	unsigned L = temps.size();
+	for (unsigned r=0; r < n_replicas; ++r) {
+		for (unsigned t = round % 2; t+1 < L; t += 2) {
+			McmcAlgo& colder = *chains[r*L + t];
+			McmcAlgo& hotter = *chains[r*L + t + 1];
+			double log_alpha = (colder.get_inverse_temperature()
+								- hotter.get_inverse_temperature())
+				* (hotter.log_likelihood() - colder.log_likelihood());
+			++swaps_tried[t];
+			if (std::log(ud()) < log_alpha) {
+				++swaps_accepted[t];
+				ParamType state = colder.state();
+				colder.set_state(hotter.state());
+				hotter.set_state(state);
+			}
+		}
+	}
+}
+
+void MultiChainMcmc::reset_statistics() {
+	unsigned n_parameters = chains[0]->state().size();
+	summaries.assign(n_replicas, ChainSummary(n_parameters, std::vector<double>()));
+}
+
+double MultiChainMcmc::r_hat(unsigned parameter) const {
+	double n = summaries[0].count();
+	if (n_replicas < 2 || n < 2)
+		return 0.0;
+
+	// W: mean of the within-chain variances, B/n: variance of the chain means
+	double W = 0.0, mean = 0.0;
+	for (unsigned r=0; r < n_replicas; ++r) {
+		W += summaries[r].covariance(parameter, parameter);
+		mean += summaries[r].mean()[parameter];
+	}
+	W /= n_replicas;
+	mean /= n_replicas;
+	double B_n = 0.0;
+	for (unsigned r=0; r < n_replicas; ++r) {
+		double d = summaries[r].mean()[parameter] - mean;
+		B_n += d*d;
+	}
+	B_n /= n_replicas - 1;
+
+	if (W <= 0.0)
+		return 0.0;
+	double var_plus = (n-1)/n * W + B_n;
+	return std::sqrt(var_plus/W);
+}
+
+double MultiChainMcmc::swap_acceptance_ratio(unsigned t) const {
+	return swaps_tried[t] > 0 ? double(swaps_accepted[t])/double(swaps_tried[t]) : 0.0;
+}
+
+}
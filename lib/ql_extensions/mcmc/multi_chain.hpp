@@ -0,0 +1,66 @@
+#ifndef ql_extensions__mcmc__multi_chain_hpp
+#define ql_extensions__mcmc__multi_chain_hpp
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real.hpp>
+#include <boost/random/variate_generator.hpp>
+
+#include "mcmc_algorithms.hpp"
+#include "chain_sink.hpp"
+
+namespace QuantLibExt {
+
+// Several chains on separate threads: n_replicas independent replicas of a
+// ladder of temperatures T_0 = 1 < T_1 < ... (parallel tempering, Geyer
+// 1991). Chain t of replica r is chains[r*n_temperatures + t] and targets
+// likelihood^(1/T_t). Every segment of draws the chains run in parallel,
+// then neighbouring temperatures of each replica try to swap their states,
+// the even pairs after one segment, the odd pairs after the next. The draws
+// of the cold chains (T = 1) are the output, the Gelman-Rubin R-hat over
+// the replicas is kept up to date with them. swap_seed seeds the swap
+// decisions and should differ from the seeds of the chains.
+class MultiChainMcmc
+{
+public:
+	MultiChainMcmc(const std::vector<boost::shared_ptr<McmcAlgo> >& chains,
+				   const ParamType& temperatures,
+				   unsigned n_threads = 1,
+				   unsigned swap_seed = 0u);
+
+	// n draws of every chain, then the swaps. Returns the draws of the
+	// cold chain of every replica.
+	const std::vector<std::vector<ParamType> >& next_segment(unsigned n);
+
+	unsigned replicas() const { return n_replicas; }
+	unsigned temperatures() const { return temps.size(); }
+
+	// Gelman-Rubin potential scale reduction of a parameter over the cold
+	// chains of the replicas since the last reset, 0 for fewer than two
+	// replicas or draws
+	double r_hat(unsigned parameter) const;
+	// of the swaps between temperatures t and t+1
+	double swap_acceptance_ratio(unsigned t) const;
+	// forget the draws so far (burn-in)
+	void reset_statistics();
+
+private:
+	void swap_states(unsigned round);
+
+	std::vector<boost::shared_ptr<McmcAlgo> > chains;
+	ParamType temps;
+	unsigned n_replicas;
+	unsigned n_threads;
+	unsigned n_rounds;
+	boost::variate_generator<boost::mt19937, boost::uniform_real<> > ud;
+
+	std::vector<std::vector<ParamType> > cold_draws;
+	std::vector<ChainSummary> summaries;
+	std::vector<unsigned long> swaps_tried, swaps_accepted;
+};
+
+}
+
+#endif
@@ -1,5 +1,8 @@
 #include "assets.hpp"
+#include "batch_dynamics.hpp"
+#include "batch_pricing.hpp"
 #include "deltas.hpp"
+#include "discount_factors.hpp"
 #include "discountbond.hpp"
 #include "dynamics.hpp"
 #include "function_types.hpp"
@@ -8,6 +11,12 @@
 #include "mcmodel.hpp"
 #include "path.hpp"
 #include "pathdebug.hpp"
+#include "model_points.hpp"
+#include "pathwise_deltas.hpp"
+#include "philox.hpp"
+#include "portfolio.hpp"
 #include "pricingmodel.hpp"
+#include "regression_pricing.hpp"
 #include "replication.hpp"
+#include "sobol_variates.hpp"
 #include "variates.hpp"
@@ -28,6 +28,26 @@ struct Assets {
     }
 };
 
+// Assets together with their derivatives with respect to the stock price
+// and the short rate at some earlier point of the path
+struct AssetTangents {
+    AssetTangents() {}
+    AssetTangents(const Assets& v, const Assets& ddS, const Assets& ddr) 
+        : value(v), dS(ddS), dr(ddr) {}
+    Assets value, dS, dr;
+};
+
+// Partial derivatives of the new S, r and intR of one step of the
+// dynamics w.r.t. the S and r the step starts from (no step depends on the
+// previous intR). apply() carries a tangent over the step.
+struct StepJacobian {
+    double dS_dS, dS_dr, dr_dr, dIntR_dr;
+
+    Assets apply(const Assets& d) const {
+        return Assets(dS_dS*d.S + dS_dr*d.r, dr_dr*d.r, dIntR_dr*d.r);
+    }
+};
+
 struct AssetPathTraits {
     rational dt, T, t0;
     Assets initialAssetValues;
@@ -37,19 +57,21 @@ struct AssetPathTraits {
 typedef Path<Assets>::iterator AssetPathIter;
 typedef Path<Assets>::const_iterator ConstAssetPathIter;
 
+// Dynamics is any functor Assets (const Variates&, const Assets&, double),
+// e.g. a ModelDynamics or, to have the steps inlined, a StaticDynamics.
+template <class Dynamics>
 Path<Assets> makePathFromVariates(
        const Path<Variates> &vari, 
        const Assets &startVals,
-       const boost::function<Assets (const Variates&,
-                               const Assets&,double) > &dynamics) {
+       const Dynamics &dynamics) {
 
     Path<Assets> path(vari.dt(),vari.T(),vari.t0());
     *(path.begin()) = startVals;
     Path<Assets>::iterator ia=path.begin()+1; 
+    double dt = boost::rational_cast<double>(vari.dt());
     for (Path<Variates>::const_iterator iv=vari.begin()+1; 
                 iv != vari.end(); ++iv, ++ia) {
-        *ia = dynamics(*iv, *(ia-1) 
-                      ,boost::rational_cast<double>(vari.dt()));
+        *ia = dynamics(*iv, *(ia-1), dt);
     }
 
     return path;
@@ -65,16 +87,14 @@ double stockFromPathWithOffset(const rational& t
     return assetPath[t].S;
 }
 
-template <class PathIterator, class VariateIterator
-         ,class PathValue, class VariateValue>
+template <class PathIterator, class VariateIterator, class Dynamics>
 void updatePathFromVariates(PathIterator start, PathIterator end
         ,VariateIterator variateStart 
-        ,const boost::function<PathValue 
-                (const VariateValue&, const PathValue& , double)> &f) 
+        ,const Dynamics &f) 
 {
+    double dt = boost::rational_cast<double>(variateStart.dt());
     for ( ++start, ++variateStart ; start != end; ++start, ++variateStart) {
-        *start = f(*variateStart,*(start-1)
-                    ,boost::rational_cast<double>(variateStart.dt()));
+        *start = f(*variateStart,*(start-1),dt);
     }
 }
 
@@ -90,7 +110,7 @@ T discountValue(rational t
 
     for (typename Path<T>::const_iterator ip = payoffPath.firstIteratorAfterTime(t)
             ; ip != payoffPath.end(); ++ip) {
-        while (ia.t() < ip.t()) {
+        while (isEarlier(ia,ip)) {
             ++ia;
             sumIntR += ia->intR;
         }
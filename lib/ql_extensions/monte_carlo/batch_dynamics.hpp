@@ -0,0 +1,193 @@
+#ifndef ql_extensions__monte_carlo__batch_dynamics_hpp__
+#define ql_extensions__monte_carlo__batch_dynamics_hpp__
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "path.hpp"
+#include "assets.hpp"
+#include "variates.hpp"
+
+namespace QuantLibExt {
+
+/*
+ * Batched dynamics: advance n scenarios by one time step at once. The
+ * assets are stored as structure of arrays (all S, all r, all intR) and
+ * the kernels are concrete classes with plain loops over these arrays,
+ * which the compiler can inline. The arithmetic is the same as in
+ * RnBSVasicekDynamics and RnCevCklsDynamics, so a batch gives the same
+ * numbers as the scalar dynamics. For that reason only the loops without
+ * calls are vectorized (the r and intR loop of BS-Vasicek): the loops
+ * with std::exp and std::pow stay scalar, gcc vectorizes them only
+ * through libmvec with -ffast-math, whose rounding differs from libm.
+ */
+
+class RnBSVasicekBatchKernel {
+  public:
+    RnBSVasicekBatchKernel(const std::vector<double>& p)
+      : s_(p[1]), k_(p[2]), t_(p[3]), sr_(p[4]), rho_(p[5]),
+        rhoComplement_(std::sqrt(1.0-rho_*rho_)), dt_(0.0/0.0)
+    {}
+
+    void step(unsigned n, double dt
+             ,const double* W1, const double* W2
+             ,const double* S, const double* r
+             ,double* newS, double* newR, double* newIntR) {
+        updateCache(dt);
+        for (unsigned i=0; i<n; ++i) {
+            newR[i]    = std::min(std::max(r[i]*ekt_ + rLevel_
+                                           + stdR_*W1[i],1E-6),0.5);
+            newIntR[i] = std::min(std::max(r[i]*Psi_ + intRLevel_
+                                           + stdIntR_*W1[i],1E-6),0.5);
+        }
+        for (unsigned i=0; i<n; ++i) {
+            newS[i]    = S[i]*std::exp(newIntR[i] - driftCorrection_
+                             + sSqrtDt_*(rho_*W1[i] + rhoComplement_*W2[i]));
+        }
+    }
+
+  protected:
+    void updateCache(double dt) {
+        if (dt != dt_) {
+            dt_              = dt;
+            double ekt       = std::exp(-k_*dt_);
+            double e2kt      = ekt*ekt;
+            ekt_             = ekt;
+            Psi_             = (1.0-ekt)/k_;
+            rLevel_          = t_*(1.0-ekt);
+            intRLevel_       = t_*(dt-Psi_);
+            stdR_            = sr_*std::sqrt((1.0-e2kt)/(2.0*k_));
+            stdIntR_         = sr_/k_*std::sqrt(dt_-2.0*(1.0-ekt)/k_
+                               + (1.0-e2kt)/(2.0*k_));
+            driftCorrection_ = 0.5*s_*s_*dt;
+            sSqrtDt_         = s_*std::sqrt(dt);
+        }
+    }
+    double s_, k_, t_, sr_, rho_, rhoComplement_;
+    double dt_, ekt_, Psi_, rLevel_, intRLevel_, stdR_, stdIntR_,
+           driftCorrection_, sSqrtDt_;
+};
+
+class RnCevCklsBatchKernel {
+  public:
+    RnCevCklsBatchKernel(const std::vector<double>& p)
+      : s_(p[1]), a_(p[2]), k_(p[3]), t_(p[4]), sr_(p[5]),
+        xi_(p[6]), rho_(p[7]),
+        rhoComplement_(std::sqrt(1.0 - rho_*rho_))
+    {}
+
+    void step(unsigned n, double dt
+             ,const double* W1, const double* W2
+             ,const double* S, const double* r
+             ,double* newS, double* newR, double* newIntR) {
+        double sqrtDt = std::sqrt(dt);
+        for (unsigned i=0; i<n; ++i) {
+            newR[i]    = std::min(std::max(r[i] + k_*(t_-r[i])*dt
+                           + sr_*std::pow(r[i],xi_)*sqrtDt*W1[i],0.0),0.5);
+            newIntR[i] = 0.5*(r[i] + newR[i])*dt;
+        }
+        for (unsigned i=0; i<n; ++i) {
+            newS[i]    = S[i] + r[i]*S[i]*dt
+                         + s_*std::pow(S[i],a_)
+                            *sqrtDt*(rho_*W1[i] + rhoComplement_*W2[i]);
+        }
+    }
+
+  protected:
+    double s_, a_, k_, t_, sr_, xi_, rho_, rhoComplement_;
+};
+
+// The variates of n scenarios after t. Time step j of scenario i is at
+// j*n+i.
+class VariateBatch {
+  public:
+    VariateBatch() : n_(0), nSteps_(0) {}
+
+    unsigned size() const { return n_; }
+    unsigned nSteps() const { return nSteps_; }
+    double dt() const { return dt_; }
+    const double* W1(unsigned j) const { return &W1_[j*n_]; }
+    const double* W2(unsigned j) const { return &W2_[j*n_]; }
+
+    void assign(const std::vector<Path<Variates> >& variates) {
+        n_ = variates.size();
+        nSteps_ = n_ > 0 ? variates[0].size()-1 : 0;
+        dt_ = n_ > 0 ? boost::rational_cast<double>(variates[0].dt()) : 0.0;
+        W1_.resize(nSteps_*n_);
+        W2_.resize(nSteps_*n_);
+        for (unsigned i=0; i<n_; ++i) {
+            Path<Variates>::const_iterator iv = variates[i].begin()+1;
+            for (unsigned j=0; j<nSteps_; ++j, ++iv) {
+                W1_[j*n_+i] = iv->W1;
+                W2_[j*n_+i] = iv->W2;
+            }
+        }
+    }
+
+  protected:
+    unsigned n_, nSteps_;
+    double dt_;
+    std::vector<double> W1_, W2_;
+};
+
+// The asset paths of n scenarios from t to T. Time step j of scenario i
+// is at j*n+i. The storage is kept from one simulation to the next.
+class AssetPathBatch {
+  public:
+    AssetPathBatch() : n_(0), nSteps_(0) {}
+
+    unsigned size() const { return n_; }
+    unsigned nSteps() const { return nSteps_; }
+    const double* S(unsigned j) const { return &S_[j*n_]; }
+    const double* r(unsigned j) const { return &r_[j*n_]; }
+    const double* intR(unsigned j) const { return &intR_[j*n_]; }
+
+    // Simulates the scenarios after t from the variates, all of which
+    // start at startValues.
+    template <class Kernel>
+    void simulate(Kernel& kernel
+                 ,const VariateBatch& variates
+                 ,const Assets& startValues) {
+        n_ = variates.size();
+        nSteps_ = variates.nSteps();
+        resize();
+        for (unsigned i=0; i<n_; ++i) {
+            S_[i] = startValues.S;
+            r_[i] = startValues.r;
+            intR_[i] = startValues.intR;
+        }
+        for (unsigned j=0; j<nSteps_; ++j) {
+            unsigned now = j*n_, next = (j+1)*n_;
+            kernel.step(n_,variates.dt(),variates.W1(j),variates.W2(j)
+                       ,&S_[now],&r_[now],&S_[next],&r_[next],&intR_[next]);
+        }
+    }
+
+    // Price at t of the zero coupon bond maturing at T for every scenario,
+    // same as discountBond
+    void discountBonds(std::vector<double>& zcb) const {
+        zcb.assign(n_,0.0);
+        for (unsigned j=1; j<=nSteps_; ++j) {
+            const double* intR = &intR_[j*n_];
+            for (unsigned i=0; i<n_; ++i)
+                zcb[i] += intR[i];
+        }
+        for (unsigned i=0; i<n_; ++i)
+            zcb[i] = std::exp(-zcb[i]);
+    }
+
+  protected:
+    void resize() {
+        S_.resize((nSteps_+1)*n_);
+        r_.resize((nSteps_+1)*n_);
+        intR_.resize((nSteps_+1)*n_);
+    }
+
+    unsigned n_, nSteps_;
+    std::vector<double> S_, r_, intR_;
+};
+
+}
+
+#endif
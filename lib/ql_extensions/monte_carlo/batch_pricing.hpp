@@ -0,0 +1,343 @@
+#ifndef ql_extensions__monte_carlo__batch_pricing_hpp__
+#define ql_extensions__monte_carlo__batch_pricing_hpp__
+
+#include <cmath>
+#include <vector>
+#include <utility>
+
+#include <boost/function.hpp>
+
+#include "../instruments/termfixinsurance/valuevector.hpp"
+
+#include "path.hpp"
+#include "assets.hpp"
+#include "variates.hpp"
+#include "pricingmodel.hpp"
+#include "insurance_contract.hpp"
+#include "batch_dynamics.hpp"
+
+namespace QuantLibExt {
+
+// Value at t of the contract on the asset paths of a batch, the same
+// numbers as valueContractFromPath on every scenario. Everything that is
+// the same for all scenarios (the contract states up to t, the anniversary
+// points, the discounting up to t) is set up once. The states are then
+// rolled one anniversary at a time for all scenarios.
+class BatchContractValuation {
+  public:
+    BatchContractValuation(const rational& t
+                          ,const Path<Assets>& hedgePath
+                          ,const Path<ContractStates>& contractStatePath
+                          ,const ContractTraits& contractTraits)
+        : contractTraits_(contractTraits) {
+        ConstContrStatePathIter iCS 
+            = contractStatePath.lastIteratorOnOrBeforeTime(t);
+        ConstContrStatePathIter iCSlast = contractStatePath.end()-1;
+        if (iCS.t() == t) {
+            if (iCS == contractStatePath.begin()) {
+                payoffAtT_.Res = (-1)*(iCS->Ap-iCS->L);
+            } else {
+                payoffAtT_.C = iCS->c;
+                payoffAtT_.D = iCS->d;
+            }
+            if (iCS == iCSlast) {
+                payoffAtT_.V   = iCS->L;
+                payoffAtT_.Res = iCS->Ap-iCS->L;
+            }
+        }
+        anniversaryL_ = iCS->L;
+        anniversaryAp_ = iCS->Ap;
+        anniversaryS_ = hedgePath[iCS.t()].S;
+
+        ConstAssetPathIter iterAP = hedgePath.iteratorAtTime(iCS.t());
+        unsigned i_t = hedgePath.iteratorAtTime(t).index();
+        for (++iCS; iCS != contractStatePath.end(); ++iCS) {
+            while ( isEarlier(iterAP,iCS) ) { 
+                ++iterAP; 
+            }
+            anniversarySteps_.push_back(iterAP.index()-i_t);
+        }
+        // as DiscountFactors sums up intR
+        sumIntRToT_ = 0.0;
+        ConstAssetPathIter ia = hedgePath.begin();
+        for (unsigned i=1; i<=i_t; ++i)
+            sumIntRToT_ += (++ia)->intR;
+    }
+
+    // values[i] is the value of scenario i of paths
+    void value(const AssetPathBatch& paths
+              ,std::vector<ValueVector>& values) const {
+        unsigned n = paths.size();
+        values.assign(n,ValueVector());
+        for (unsigned i=0; i<n; ++i)
+            values[i] += payoffAtT_;
+        L_.assign(n,anniversaryL_);
+        Ap_.assign(n,anniversaryAp_);
+        resQuot_.assign(n,(anniversaryAp_ - anniversaryL_)/anniversaryL_);
+        S0_.assign(n,anniversaryS_);
+        sumIntR_.assign(n,sumIntRToT_);
+
+        unsigned j = 0;
+        for (unsigned a=0; a<anniversarySteps_.size(); ++a) {
+            while (j < anniversarySteps_[a]) {
+                const double* intR = paths.intR(++j);
+                for (unsigned i=0; i<n; ++i)
+                    sumIntR_[i] += intR[i];
+            }
+            const double* S1 = paths.S(j);
+            bool last = a+1 == anniversarySteps_.size();
+            for (unsigned i=0; i<n; ++i) {
+                ValueVector payoff;
+                rollContractStates(S1[i] / S0_[i] - 1.0,contractTraits_
+                                  ,L_[i],Ap_[i],resQuot_[i]
+                                  ,payoff.C,payoff.D);
+                if (last) {
+                    payoff.V   = L_[i];
+                    payoff.Res = Ap_[i]-L_[i];
+                }
+                values[i] += payoff * std::exp(-(sumIntR_[i]-sumIntRToT_));
+                S0_[i] = S1[i];
+            }
+        }
+    }
+
+  protected:
+    ContractTraits contractTraits_;
+    ValueVector payoffAtT_;
+    // contract states and stock at the last anniversary on or before t
+    double anniversaryL_, anniversaryAp_, anniversaryS_;
+    // batch steps of the later anniversaries
+    std::vector<unsigned> anniversarySteps_;
+    double sumIntRToT_;
+    // per scenario states, kept from one call to the next
+    mutable std::vector<double> L_, Ap_, resQuot_, S0_, sumIntR_;
+};
+
+// Pricing model for the insurance contract that simulates the asset paths
+// of batchSize scenarios at a time with a batch kernel. Value, underlyings
+// and finite difference deltas are the same numbers as those of
+// MCPricingModel with the scalar pricers (same scenarios, same order, one
+// block): every batch of variates is simulated from the start at t and
+// from the four offset starts, all of them valued over the batch.
+// The buffers are allocated once and reused for all batches, so a model
+// must not be evaluated by several threads at once.
+template <class Kernel>
+class BatchedInsContrMCPricingModel
+    : public PricingModel<ValT,UnderlT,DeltaT> {
+  public:
+    BatchedInsContrMCPricingModel(
+            unsigned nScenarios
+           ,unsigned batchSize
+           ,const Kernel& kernel
+           ,const rational& t
+           ,const Path<Assets>& hedgePath
+           ,const Path<ContractStates>& contractStatePath
+           ,const ContractTraits& contractTraits
+           ,const boost::function<void (ScenT&)> scenarioGenerator
+           ,const std::pair<Assets,Assets>& offsets)
+        : nScenarios_(nScenarios), batchSize_(std::max(batchSize,1u))
+         ,kernel_(kernel), start_(hedgePath[t]), offsets_(offsets)
+         ,valuation_(t,hedgePath,contractStatePath,contractTraits)
+         ,scenarioGenerator_(scenarioGenerator), analyticBondDelta_(false)
+    {}
+
+    // The bond deltas are taken w.r.t. the closed form zero bond, bondUp
+    // and bondDown are its prices at the offset short rates
+    void setAnalyticBondDelta(double bondUp, double bondDown) {
+        analyticBondDelta_ = true;
+        bondUp_ = bondUp;
+        bondDown_ = bondDown;
+    }
+
+    virtual ValT value() const {
+        return simulate(true,false,false).value;
+    }
+    virtual UnderlT underlyings() const {
+        return simulate(false,true,false).underlyings;
+    }
+    virtual DeltaT deltas() const {
+        return simulate(false,false,true).deltas;
+    }
+    virtual ResultT evaluate() const {
+        return simulate(true,true,true);
+    }
+
+  protected:
+    ResultT simulate(bool withValue, bool withUnderlyings
+                    ,bool withDeltas) const {
+        boost::function<void (ScenT&)> scenarioGenerator = scenarioGenerator_;
+        Assets startUpS = start_, startDownS = start_;
+        startUpS += offsets_.first;
+        startDownS += -offsets_.first;
+        Assets startUpR = start_, startDownR = start_;
+        startUpR += offsets_.second;
+        startDownR += -offsets_.second;
+        // summed up in the same order as computeMCExpectations does
+        ValT valueSum, deltaSumS, deltaSumR;
+        double sSum = 0.0, zcbSum = 0.0;
+
+        for (unsigned first=0; first<nScenarios_; first+=batchSize_) {
+            unsigned n = std::min(batchSize_,nScenarios_-first);
+            variates_.resize(n);
+            for (unsigned i=0; i<n; ++i)
+                scenarioGenerator(variates_[i]);
+            variateBatch_.assign(variates_);
+
+            if (withValue || withUnderlyings)
+                paths_.simulate(kernel_,variateBatch_,start_);
+            if (withUnderlyings) {
+                paths_.discountBonds(zcb_);
+                for (unsigned i=0; i<n; ++i) {
+                    sSum += start_.S;
+                    zcbSum += zcb_[i];
+                }
+            }
+            if (withValue) {
+                valuation_.value(paths_,values_);
+                accumulate(first,values_,valueSum);
+            }
+            if (withDeltas) {
+                paths_.simulate(kernel_,variateBatch_,startUpS);
+                valuation_.value(paths_,values_);
+                paths_.simulate(kernel_,variateBatch_,startDownS);
+                valuation_.value(paths_,valuesDown_);
+                double dS = startUpS.S - startDownS.S;
+                for (unsigned i=0; i<n; ++i)
+                    values_[i] = (values_[i]-valuesDown_[i]) / dS;
+                accumulate(first,values_,deltaSumS);
+
+                paths_.simulate(kernel_,variateBatch_,startUpR);
+                valuation_.value(paths_,values_);
+                if (not analyticBondDelta_)
+                    paths_.discountBonds(zcb_);
+                paths_.simulate(kernel_,variateBatch_,startDownR);
+                valuation_.value(paths_,valuesDown_);
+                if (not analyticBondDelta_) {
+                    paths_.discountBonds(zcbDown_);
+                    // as computeFDDeltaFromVariates if the offsets did not
+                    // change the scenario
+                    for (unsigned i=0; i<n; ++i)
+                        values_[i] = zcb_[i] == zcbDown_[i] ? ValueVector()
+                                   : (values_[i]-valuesDown_[i]) 
+                                     / (zcb_[i]-zcbDown_[i]);
+                } else {
+                    for (unsigned i=0; i<n; ++i)
+                        values_[i] = (values_[i]-valuesDown_[i]) 
+                                   / (bondUp_-bondDown_);
+                }
+                accumulate(first,values_,deltaSumR);
+            }
+        }
+
+        ResultT result;
+        result.value = valueSum / (double)nScenarios_;
+        result.underlyings = Array<>(2);
+        result.underlyings[0] = sSum / (double)nScenarios_;
+        result.underlyings[1] = zcbSum / (double)nScenarios_;
+        result.deltas = Array<ValueVector>(2);
+        result.deltas[0] = deltaSumS / (double)nScenarios_;
+        result.deltas[1] = deltaSumR / (double)nScenarios_;
+        return result;
+    }
+
+    // adds the values of the batch starting at scenario first to sum
+    static void accumulate(unsigned first
+                          ,const std::vector<ValueVector>& values
+                          ,ValueVector& sum) {
+        for (unsigned i=0; i<values.size(); ++i) {
+            if (first+i == 0)
+                sum = values[i];
+            else
+                sum += values[i];
+        }
+    }
+
+    unsigned nScenarios_, batchSize_;
+    mutable Kernel kernel_;
+    Assets start_;
+    std::pair<Assets,Assets> offsets_;
+    BatchContractValuation valuation_;
+    boost::function<void (ScenT&)> scenarioGenerator_;
+    bool analyticBondDelta_;
+    double bondUp_, bondDown_;
+    // scratch space of simulate
+    mutable std::vector<ScenT> variates_;
+    mutable VariateBatch variateBatch_;
+    mutable AssetPathBatch paths_;
+    mutable std::vector<ValueVector> values_, valuesDown_;
+    mutable std::vector<double> zcb_, zcbDown_;
+};
+
+// Same as InsContrMCPricingModelFactory (finite difference deltas), but
+// value, underlyings and deltas are computed with the batch kernel. Of the
+// variance reduction only the antithetic scenarios are used, the inner MC
+// runs in one block without adaptive stopping.
+template <class Kernel>
+class BatchedInsContrMCPricingModelFactory : public InsContrMCPricingModelFactory {
+public:
+  BatchedInsContrMCPricingModelFactory(unsigned nScenarios,
+                                       rational hedgePathDt,
+                                       ModelDynamics dynamics,
+                                       const Kernel& kernel,
+                                       ContractTraits contractTraits,
+                                       double offset_S=0.0,
+                                       double offset_r=0.0,
+                                       const InnerMCTraits& innerMC
+                                         =InnerMCTraits(),
+                                       unsigned batchSize=256)
+    : InsContrMCPricingModelFactory(nScenarios, hedgePathDt, dynamics,
+                                    contractTraits, offset_S, offset_r,
+                                    innerMC),
+      kernel_(kernel), batchSize_(batchSize) {}
+
+  virtual PricingModel<ValT,UnderlT,DeltaT>* make(const rational&,
+                                                  const Path<Assets>&,
+                                                  const Path<ContractStates>&,
+                                                  unsigned outerPath=0) const;
+
+protected:
+  Kernel kernel_;
+  unsigned batchSize_;
+};
+
+template <class Kernel>
+PricingModel<ValT,UnderlT,DeltaT>* BatchedInsContrMCPricingModelFactory<Kernel>::make(
+    const rational& t, const Path<Assets>& assetPath,
+    const Path<ContractStates>& contractStatePath, unsigned outerPath) const
+{
+  if (t == contractStatePath.T())
+    return new InsContrEndPointPricingModel(assetPath[t],contractStatePath[t]);
+
+  Path<Assets> hedgePath = makeHedgePath(t, assetPath);
+
+  std::pair<Assets,Assets> offsets;
+  offsets.first  = offset_S(hedgePath[t]);
+  offsets.second = offset_r(hedgePath[t]);
+
+  BatchedInsContrMCPricingModel<Kernel>* model
+    = new BatchedInsContrMCPricingModel<Kernel>(nScenarios_, batchSize_,
+                                                kernel_, t, hedgePath,
+                                                contractStatePath,
+                                                contractTraits_,
+                                                makeScenarioGenerator(
+                                                  t, hedgePath, outerPath),
+                                                offsets);
+  double bondPrice = 0.0, bondDr = 0.0;
+  if (not analyticBond(dynamics_, t, hedgePath, bondPrice, bondDr))
+    return model;
+
+  // the closed form bonds at the offset short rates, as bondForDelta
+  Assets up = hedgePath[t], down = hedgePath[t];
+  up += offsets.second;
+  down += -offsets.second;
+  double tau = boost::rational_cast<double>(hedgePath.T() - t);
+  double bondUp = 0.0, bondDown = 0.0;
+  analyticDiscountBond(dynamics_, up.r, tau, bondUp);
+  analyticDiscountBond(dynamics_, down.r, tau, bondDown);
+  model->setAnalyticBondDelta(bondUp, bondDown);
+  return withAnalyticUnderlyings(model, t, hedgePath, bondPrice);
+}
+
+}
+
+#endif
@@ -12,10 +12,11 @@
 
 namespace QuantLibExt {
 
+template <class Dynamics>
 void updatePathFromVariatesWithOffset(const rational& t
                                      ,Path<Assets>&  assetPath
                                      ,const Path<Variates>& variates
-                                     ,const ModelDynamics& dynamics
+                                     ,const Dynamics& dynamics
                                      ,const Assets& offset) {
     assetPath[t] += offset;
     updatePathFromVariates(assetPath.iteratorAtTime(t),assetPath.end()
@@ -27,12 +28,13 @@ typedef boost::function<ValueVector
 typedef boost::function<double 
             (const rational&, Path<Assets>& ,const Assets&)> DoubleFromPathFunc;
 
+template <class Dynamics>
 ValueVector
 computeFDDeltaFromVariates(const rational& t
                           ,Path<Assets>& assetPath
                           ,const Path<Variates>& variates
                           ,const Assets &offset
-                          ,const ModelDynamics& dynamics
+                          ,const Dynamics& dynamics
                           ,const ValueVecFromPathFunc& numeratorEval
                           ,const DoubleFromPathFunc& denominatorEval) {
     Assets origPathValue = assetPath[t];
@@ -46,15 +48,20 @@ computeFDDeltaFromVariates(const rational& t
     double denom2 = denominatorEval(t,assetPath,origPathValue);
 
     assetPath[t] = origPathValue;
+    // the offsets did not change the scenario (the bounds of the short 
+    // rate clipped both): its derivative is zero, as the pathwise one
+    if (denom1 == denom2)
+        return ValueVector();
     return (num1-num2) / (denom1-denom2);
 }
 
+template <class Dynamics>
 Array<ValueVector>
 computeStockBondFDDeltaFromVariates
                        (const rational& t 
                        ,Path<Assets>& assetPath
                        ,const Path<Variates>& variates 
-                       ,const ModelDynamics& dynamics
+                       ,const Dynamics& dynamics
                        ,const ValueVecFromPathFunc& contractEval
                        ,const DoubleFromPathFunc& stock
                        ,const DoubleFromPathFunc& discountBond
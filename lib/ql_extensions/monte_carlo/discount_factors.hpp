@@ -0,0 +1,86 @@
+#ifndef ql_extensions__monte_carlo__discount_factors_hpp__
+#define ql_extensions__monte_carlo__discount_factors_hpp__
+
+#include <cmath>
+#include <vector>
+
+#include "path.hpp"
+#include "assets.hpp"
+
+namespace QuantLibExt {
+
+// Cumulative sums of intR along an asset path: sumIntR(i) is the sum of
+// intR over the points 1..i. The discount factor between any two points
+// of the path is then one subtraction and one exp.
+// When the path has been rewritten from some point on (e.g. by
+// updatePathFromVariates) only the sums from there on are recomputed.
+// Differences of sums after that point are right even if the path has
+// changed before it, so a valuation at t only needs update from t.
+class DiscountFactors {
+  public:
+    DiscountFactors() {}
+    DiscountFactors(const Path<Assets>& assetPath) {
+        update(assetPath);
+    }
+
+    // Recomputes the sums of the points from first on
+    void update(const Path<Assets>& assetPath, unsigned first=0) {
+        if (sumIntR_.size() != assetPath.size()) {
+            sumIntR_.resize(assetPath.size());
+            first = 0;
+        }
+        if (first == 0) {
+            sumIntR_[0] = 0.0;
+            first = 1;
+        }
+        Path<Assets>::const_iterator ia = assetPath.begin()+first;
+        for (unsigned i=first; i<sumIntR_.size(); ++i, ++ia)
+            sumIntR_[i] = sumIntR_[i-1] + ia->intR;
+    }
+
+    void update(const Path<Assets>& assetPath, const rational& t) {
+        update(assetPath,assetPath.iteratorAtTime(t).index());
+    }
+
+    // sum of intR over the points in (i, j]
+    double sumIntR(unsigned i, unsigned j) const {
+        return sumIntR_[j] - sumIntR_[i];
+    }
+    // value at point i of 1 paid at point j
+    double discountFactor(unsigned i, unsigned j) const {
+        return std::exp(-sumIntR(i,j));
+    }
+    // value at point j of 1 invested at point i
+    double compoundingFactor(unsigned i, unsigned j) const {
+        return std::exp(sumIntR(i,j));
+    }
+
+  protected:
+    std::vector<double> sumIntR_;
+};
+
+// Same as discountValue, with the discount factors taken from factors,
+// which must be up to date after t
+template <class T>
+T discountValue(rational t
+               ,const Path<Assets>& assetPath
+               ,const DiscountFactors& factors
+               ,const Path<T>& payoffPath) {
+    T value_at_t;
+    Path<Assets>::const_iterator ia = assetPath.iteratorAtTime(t);
+    unsigned i_t = ia.index();
+    if (payoffPath.hasTimepointAt(t))
+        value_at_t = payoffPath[t];
+
+    for (typename Path<T>::const_iterator ip = payoffPath.firstIteratorAfterTime(t)
+            ; ip != payoffPath.end(); ++ip) {
+        while (isEarlier(ia,ip))
+            ++ia;
+        value_at_t += (*ip) * factors.discountFactor(i_t,ia.index());
+    }
+    return value_at_t;
+}
+
+}
+
+#endif
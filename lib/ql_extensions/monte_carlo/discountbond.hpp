@@ -4,6 +4,8 @@
 #include "path.hpp"
 #include "assets.hpp"
 #include "variates.hpp"
+#include "discount_factors.hpp"
+#include "dynamics.hpp"
 
 namespace QuantLibExt {
 
@@ -19,17 +21,40 @@ double discountBond(const rational& t, const Path<Assets> &path) {
     return discountBond1(path.iteratorAtTime(t),path.end());
 }
 
+double discountBond(const rational& t, const Path<Assets> &path
+                   ,const DiscountFactors& factors) {
+    return factors.discountFactor(path.iteratorAtTime(t).index()
+                                 ,path.size()-1);
+}
+
 double discountBondFromPathWithOffset(
         const rational& t, const Path<Assets> &path, const Assets&) 
 {
     return discountBond1(path.iteratorAtTime(t),path.end());
 }
 
+// Zero bond P(t,T) from the closed form of the dynamics at the (offseted)
+// short rate of path at t, T is the end of the path
+template <class Dynamics>
+double analyticDiscountBondFromPathWithOffset(
+        const rational& t, const Path<Assets> &path, const Assets&
+       ,const Dynamics& dynamics)
+{
+    double price;
+    QL_REQUIRE(analyticDiscountBond(dynamics,path[t].r
+                                   ,boost::rational_cast<double>(path.T()-t)
+                                   ,price),
+               "analyticDiscountBondFromPathWithOffset: the dynamics have "
+               "no closed form zero bond price");
+    return price;
+}
+
+template <class Dynamics>
 Array<>
 underlyingsFromVariates(const rational& t
                        ,Path<Assets>& assetPath
                        ,const Path<Variates>& variates 
-                       ,const ModelDynamics& dynamics) {
+                       ,const Dynamics& dynamics) {
     updatePathFromVariates(assetPath.iteratorAtTime(t),assetPath.end()
                           ,variates.iteratorAtTime(t),dynamics);
     Array<> underlyings(2);
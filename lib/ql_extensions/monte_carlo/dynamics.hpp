@@ -2,6 +2,7 @@
 #define ql_extensions__monte_carlo__dynamics__hpp__
 
 #include <boost/function.hpp>
+#include <boost/bind.hpp>
 
 #include "function_types.hpp"
 #include "path.hpp"
@@ -27,22 +28,63 @@ class RnBSVasicekDynamics : public Dynamics {
     
     virtual Assets operator()(
             const Variates &v, const Assets &a, double dt) const {
+        return step(v,a,dt,0);
+    }
+
+    // Vasicek price of the zero bond with time to maturity tau at short 
+    // rate r (without the bounds the step puts on r and intR)
+    double discountBond(double r, double tau) const {
+        double B = (1.0-std::exp(-k_*tau))/k_;
+        return std::exp((t_ - sr_*sr_/(2.0*k_*k_))*(B - tau)
+                        - sr_*sr_*B*B/(4.0*k_) - B*r);
+    }
+    // d discountBond(r,tau) / dr
+    double discountBondDr(double r, double tau) const {
+        return -(1.0-std::exp(-k_*tau))/k_*discountBond(r,tau);
+    }
+
+    // Same step as operator(), also propagates the tangents of a
+    AssetTangents withTangents(
+            const Variates &v, const AssetTangents &a, double dt) const {
+        StepJacobian jac;
+        AssetTangents new_a;
+        new_a.value = step(v,a.value,dt,&jac);
+        new_a.dS = jac.apply(a.dS);
+        new_a.dr = jac.apply(a.dr);
+        return new_a;
+    }
+
+  protected:
+    // The step of operator(), if jac is given also its partial derivatives
+    Assets step(const Variates &v, const Assets &a, double dt
+               ,StepJacobian* jac) const {
 
         updateCache(dt);
         Assets new_a;
-        new_a.r    = std::min(std::max(a.r*ekt_ + t_*(1.0-ekt_) 
-                                       + stdR_*v.W1,1E-6),0.5);
-        new_a.intR = std::min(std::max(a.r*Psi_ + t_*(dt-Psi_) 
-                                       + stdIntR_*v.W1,1E-6),0.5);
-        new_a.S    = a.S*std::exp(drift(new_a.intR,dt) 
+        double r    = a.r*ekt_ + t_*(1.0-ekt_) + stdR_*v.W1;
+        double intR = a.r*Psi_ + t_*(dt-Psi_) + stdIntR_*v.W1;
+        new_a.r     = std::min(std::max(r,1E-6),0.5);
+        new_a.intR  = std::min(std::max(intR,1E-6),0.5);
+        double growth = std::exp(drift(new_a.intR,dt) 
                           + s_*sqrtDt_*(rho_*v.W1 + rhoComplement_*v.W2));
+        new_a.S     = a.S*growth;
+
+        if (jac) {
+            // the bounds cut the derivatives w.r.t. the old short rate
+            jac->dr_dr    = (r > 1E-6 && r < 0.5) ? ekt_ : 0.0;
+            jac->dIntR_dr = (intR > 1E-6 && intR < 0.5) ? Psi_ : 0.0;
+            jac->dS_dS    = growth;
+            jac->dS_dr    = new_a.S*driftDerivative()*jac->dIntR_dr;
+        }
         return new_a;
     }
-
-  protected:
     virtual double drift(double intR, double dt) const {
         return intR - driftCorrection_; // risk-neutral drift
     }
+    // d drift / d intR
+    virtual double driftDerivative() const {
+        return 1.0;
+    }
     void updateCache(double dt) const {
         if (dt != dt_) {
             dt_              = dt;
@@ -69,6 +111,9 @@ class RwBSVasicekDynamics : public RnBSVasicekDynamics {
     virtual double drift(double intR, double dt) const {
         return mu_*dt;
     }
+    virtual double driftDerivative() const {
+        return 0.0;
+    }
 };
 
 class RnCevCklsDynamics : public Dynamics {
@@ -81,22 +126,54 @@ class RnCevCklsDynamics : public Dynamics {
     
     virtual Assets operator()(
             const Variates &v, const Assets &a, double dt) const {
+        return step(v,a,dt,0);
+    }
+
+    // Same step as operator(), also propagates the tangents of a
+    AssetTangents withTangents(
+            const Variates &v, const AssetTangents &a, double dt) const {
+        StepJacobian jac;
+        AssetTangents new_a;
+        new_a.value = step(v,a.value,dt,&jac);
+        new_a.dS = jac.apply(a.dS);
+        new_a.dr = jac.apply(a.dr);
+        return new_a;
+    }
+
+  protected:
+    // The step of operator(), if jac is given also its partial derivatives
+    Assets step(const Variates &v, const Assets &a, double dt
+               ,StepJacobian* jac) const {
 
         Assets new_a;
         double sqrtDt = std::sqrt(dt);
-        new_a.r    = std::min(std::max(a.r + k_*(t_-a.r)*dt 
-		     + sr_*std::pow(a.r,xi_)*sqrtDt*v.W1,0.0),0.5);
+        double rPowXi = std::pow(a.r,xi_);
+        double r      = a.r + k_*(t_-a.r)*dt + sr_*rPowXi*sqrtDt*v.W1;
+        double z      = rho_*v.W1 + rhoComplement_*v.W2;
+        double SPowA  = std::pow(a.S,a_);
+        new_a.r    = std::min(std::max(r,0.0),0.5);
         new_a.intR = 0.5*(a.r + new_a.r)*dt;
-        new_a.S    = a.S + drift(a.r)*a.S*dt 
-                     + s_*std::pow(a.S,a_)
-                        *sqrtDt*(rho_*v.W1 + rhoComplement_*v.W2);
+        new_a.S    = a.S + drift(a.r)*a.S*dt + s_*SPowA*sqrtDt*z;
 
+        if (jac) {
+            double dRPowXi = (a.r > 0.0) ? xi_*rPowXi/a.r : 0.0;
+            double dSPowA  = (a.S > 0.0) ? a_*SPowA/a.S : 0.0;
+            jac->dr_dr    = (r > 0.0 && r < 0.5) 
+                ? 1.0 - k_*dt + sr_*dRPowXi*sqrtDt*v.W1 : 0.0;
+            jac->dIntR_dr = 0.5*(1.0 + jac->dr_dr)*dt;
+            jac->dS_dS    = 1.0 + drift(a.r)*dt + s_*dSPowA*sqrtDt*z;
+            jac->dS_dr    = driftDerivative()*a.S*dt;
+        }
         return new_a;
     }
-  protected:
+
     virtual double drift(double r) const {
         return r; // risk-neutral drift
     }
+    // d drift / d r
+    virtual double driftDerivative() const {
+        return 1.0;
+    }
     double  mu_, s_, a_, k_, t_, sr_, xi_, rho_, rhoComplement_;
 };
 
@@ -108,8 +185,95 @@ class RwCevCklsDynamics : public RnCevCklsDynamics {
     virtual double drift(double r) const {
         return mu_; // objective drift
     }
+    virtual double driftDerivative() const {
+        return 0.0;
+    }
 };
 
+// Step of the concrete dynamics D without the virtual call: D is held by
+// value and its operator() is called qualified, so templated path code
+// instantiated with StaticDynamics<D> can inline the whole step (including
+// drift()). D can also be a real world dynamics.
+template <class D>
+class StaticDynamics {
+  public:
+    StaticDynamics(const D& dynamics) : dynamics_(dynamics) {}
+
+    Assets operator()(const Variates &v, const Assets &a, double dt) const {
+        return dynamics_.D::operator()(v,a,dt);
+    }
+    // the step of D that also propagates tangents
+    AssetTangents withTangents(
+            const Variates &v, const AssetTangents &a, double dt) const {
+        return dynamics_.D::withTangents(v,a,dt);
+    }
+    const D& dynamics() const {
+        return dynamics_;
+    }
+
+  private:
+    D dynamics_;
+};
+
+// Analytic zero bond price of the dynamics and its derivative w.r.t. the
+// short rate, if there is one. A ModelDynamics has one if it holds a
+// dynamics that has one.
+template <class Dynamics>
+bool analyticDiscountBond(const Dynamics&, double, double, double&, double&) {
+    return false;
+}
+
+inline bool analyticDiscountBond(const RnBSVasicekDynamics& d
+                                ,double r, double tau
+                                ,double& price, double& dPrice_dr) {
+    price = d.discountBond(r,tau);
+    dPrice_dr = d.discountBondDr(r,tau);
+    return true;
+}
+
+inline bool analyticDiscountBond(const StaticDynamics<RnBSVasicekDynamics>& d
+                                ,double r, double tau
+                                ,double& price, double& dPrice_dr) {
+    return analyticDiscountBond(d.dynamics(),r,tau,price,dPrice_dr);
+}
+
+inline bool analyticDiscountBond(const ModelDynamics& d
+                                ,double r, double tau
+                                ,double& price, double& dPrice_dr) {
+    if (const RnBSVasicekDynamics* p = d.target<RnBSVasicekDynamics>())
+        return analyticDiscountBond(*p,r,tau,price,dPrice_dr);
+    return false;
+}
+
+template <class Dynamics>
+bool analyticDiscountBond(const Dynamics& d
+                         ,double r, double tau, double& price) {
+    double dPrice_dr;
+    return analyticDiscountBond(d,r,tau,price,dPrice_dr);
+}
+
+// Whether the discounted stock S(T)D(t,T) of the discretised dynamics is
+// a martingale, so its expectation is exactly S(t) (as control variate).
+// The risk-neutral BS-Vasicek step discounts with the same intR it grows
+// the stock with; the CEV-CKLS step only up to the discretisation error.
+template <class Dynamics>
+bool martingaleDiscountedStock(const Dynamics&) {
+    return false;
+}
+
+inline bool martingaleDiscountedStock(const RnBSVasicekDynamics&) {
+    return true;
+}
+
+inline bool martingaleDiscountedStock(
+        const StaticDynamics<RnBSVasicekDynamics>&) {
+    return true;
+}
+
+inline bool martingaleDiscountedStock(const ModelDynamics& d) {
+    return d.target<RnBSVasicekDynamics>() != 0;
+}
+
 //
 // Factories
 //
@@ -138,6 +302,7 @@ ModelDynamics makeRiskNeutralDynamics(const std::vector<double>& p,
 	}
 }
 
+
 };
 
 
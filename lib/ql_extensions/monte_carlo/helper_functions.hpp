@@ -13,6 +13,8 @@
 
 #include "path.hpp"
 #include "dynamics.hpp"
+#include "philox.hpp"
+#include "portfolio.hpp"
 #include "insurance_contract.hpp"
 #include "replication.hpp"
 
@@ -24,13 +26,10 @@ ValueVector simpleMC(unsigned nSamples
                         ,const AssetPathTraits& assetPathTraits
                         ,const ContractTraits& contractTraits) 
 {
-    boost::function<double ()> scenarioGenerator = 
-        NormalRandomNumberGenerator(seed);
-
     boost::shared_ptr<InsContrMCPricingModelFactory> p_PricingFactory
       (new InsContrMCPricingModelFactory
-       (nSamples,assetPathTraits.dt, scenarioGenerator,
-        riskNeutralDynamics, contractTraits));
+       (nSamples,assetPathTraits.dt,riskNeutralDynamics,contractTraits
+       ,0.0,0.0,InnerMCTraits(seed)));
 
     Path<Assets> assetPath(assetPathTraits.dt,assetPathTraits.T);
     assetPath[0] = assetPathTraits.initialAssetValues;
@@ -45,6 +44,31 @@ ValueVector simpleMC(unsigned nSamples
     return p_Pricer->value();
 }
 
+// simpleMC for all contracts of a portfolio on the same nSamples
+// scenarios, element j is the value of contract j
+Array<ValueVector> portfolioMC(unsigned nSamples
+                              ,unsigned seed
+                              ,const ModelDynamics& riskNeutralDynamics
+                              ,const AssetPathTraits& assetPathTraits
+                              ,const ContractPortfolio& portfolio)
+{
+    Path<Assets> assetPath(assetPathTraits.dt,assetPathTraits.T);
+    assetPath[0] = assetPathTraits.initialAssetValues;
+
+    Path<PortfolioStates> portfolioStatePath(portfolio.dt,portfolio.T);
+    portfolioStatePath[0] = initialPortfolioStates(portfolio);
+
+    boost::function<void (ScenT&)> scenarioGenerator
+        = BulkScenarioGenerator(assetPath.dt(),assetPath.T(),assetPath.t0()
+                               ,seed);
+    boost::function<Array<ValueVector> (const ScenT&)> evaluator
+        = boost::bind(portfolioValuesFromVariates<ModelDynamics>
+                     ,rational(0,1),assetPath,_1
+                     ,PortfolioValuationWorkspace(portfolioStatePath)
+                     ,portfolio,riskNeutralDynamics);
+    return computeMCExpectations(scenarioGenerator,evaluator,nSamples);
+}
+
 Path<Assets> generateRealWorldAssetPath(
          boost::function<double ()>& rndNumberGenerator,
 		 AssetPathTraits assetPathTraits,
@@ -64,21 +88,21 @@ Path<Assets> generateRealWorldAssetPath(
 }
 
 
+// The last argument is the address of the outer path (for the counter
+// based inner scenarios)
 typedef boost::function<ValueVector (const Path<Assets>&
-        ,const Path<ContractStates>&, const Path<ValueVector>&)>
+        ,const Path<ContractStates>&, const Path<ValueVector>&, unsigned)>
         ProfitAndLossComputer;
 
-ValueVector singleProfitAndLossSimulation(
+ValueVector profitAndLossSimulation(
 		const std::vector<double>& p,
 		const std::string& model_name,
-		unsigned seed,
+		boost::function<double ()> rndNumberGenerator,
+		unsigned outerPath,
 		const AssetPathTraits& assetPathTraits,
 		const ContractTraits& contractTraits,
         const ProfitAndLossComputer& computeProfitAndLoss)
 {
-    boost::function<double ()> rndNumberGenerator 
-        = NormalRandomNumberGenerator(seed);
-
     Path<Assets> assetPath 
         = generateRealWorldAssetPath(rndNumberGenerator, assetPathTraits,
 									 p, model_name);
@@ -88,7 +112,40 @@ ValueVector singleProfitAndLossSimulation(
     Path<ValueVector> contractPayoffs
         = payoffPathFromContractStates(contractStatePath);
 
-    return computeProfitAndLoss(assetPath, contractStatePath, contractPayoffs);
+    return computeProfitAndLoss(assetPath, contractStatePath, contractPayoffs,
+                                outerPath);
+}
+
+// Outer path drawn from its own mt19937 seeded with seed, seed is also its
+// address
+ValueVector singleProfitAndLossSimulation(
+		const std::vector<double>& p,
+		const std::string& model_name,
+		unsigned seed,
+		const AssetPathTraits& assetPathTraits,
+		const ContractTraits& contractTraits,
+        const ProfitAndLossComputer& computeProfitAndLoss)
+{
+    return profitAndLossSimulation(p, model_name,
+                                   NormalRandomNumberGenerator(seed), seed,
+                                   assetPathTraits, contractTraits,
+                                   computeProfitAndLoss);
+}
+
+// Outer path number outerPath of the Philox streams keyed by seed
+ValueVector counterBasedProfitAndLossSimulation(
+		const std::vector<double>& p,
+		const std::string& model_name,
+		unsigned outerPath,
+		unsigned seed,
+		const AssetPathTraits& assetPathTraits,
+		const ContractTraits& contractTraits,
+        const ProfitAndLossComputer& computeProfitAndLoss)
+{
+    return profitAndLossSimulation(p, model_name,
+                                   PhiloxNormalSequence(seed, outerPath),
+                                   outerPath, assetPathTraits, contractTraits,
+                                   computeProfitAndLoss);
 }
 
 }
@@ -1,6 +1,8 @@
 #ifndef ql_extensions__monte_carlo__insurance_contract_hpp__
 #define ql_extensions__monte_carlo__insurance_contract_hpp__
 
+#include <boost/shared_ptr.hpp>
+
 #include "../instruments/termfixinsurance/valuevector.hpp"
 
 #include "pricingmodel.hpp"
@@ -10,6 +12,10 @@
 #include "variates.hpp"
 #include "dynamics.hpp"
 #include "discountbond.hpp"
+#include "discount_factors.hpp"
+#include "deltas.hpp"
+#include "sobol_variates.hpp"
+#include "philox.hpp"
 
 namespace QuantLibExt {
 
@@ -38,6 +44,50 @@ struct ContractTraits {
 };
 
 
+// Which sides of its conditions and maxima one period of
+// rollContractStates took, for differentiating the period
+struct ContractRollBranches {
+    bool cond1, cond3, apIsAm, cPositive;
+};
+
+// One period of the contract with guarantee (g, y, delta): rolls L1, Ap
+// and res_quot = (Ap-L1)/L1 forward over the stock return x and gives the
+// period's c and d. If branches is given the branches taken are written
+// to it.
+inline void rollContractStates(double x, double g, double y, double delta
+                              ,double &L1, double &Ap, double &res_quot
+                              ,double &c, double &d
+                              ,ContractRollBranches* branches=0) {
+    double Am = Ap * (1.0+x);
+    double L0 = L1;
+
+    double cond1 = (delta*y*x*(1+res_quot) > g) ? 1.0 : 0.0;;
+    double cond2 = 1-cond1;
+    double cond3 = (g <= y*x*(1+res_quot)) ? 1.0 : 0.0;
+       
+    L1        = (1 + std::max(delta*y*x*(1.0+res_quot),g))*L0;
+    d         = (1-delta)*y*Ap*x*cond1 
+               + (y*x*(1+res_quot)-g)*L0*cond2*cond3;
+
+    if (branches) {
+        branches->cond1     = cond1 > 0.0;
+        branches->cond3     = cond3 > 0.0;
+        branches->apIsAm    = Am-d >= L1;
+        branches->cPositive = L1-Am > 0.0;
+    }
+    Ap = std::max(Am-d,L1);
+
+    c = std::max(0.0,L1-Am);
+    res_quot = (Ap - L1)/L1;
+}
+
+inline void rollContractStates(double x, const ContractTraits &ct
+                              ,double &L1, double &Ap, double &res_quot
+                              ,double &c, double &d
+                              ,ContractRollBranches* branches=0) {
+    rollContractStates(x,ct.g,ct.y,ct.delta,L1,Ap,res_quot,c,d,branches);
+}
+
 void computeContractStatePath(
                      ConstAssetPathIter   iAPLastAnniversary
                     ,ConstAssetPathIter   iAPend
@@ -53,27 +103,13 @@ void computeContractStatePath(
     for (++iCSnow; iCSnow != iCSend; ++iCSnow) {
 
         double S0 = S1; 
-        while ( iterAP.t() < iCSnow.t() ) { 
+        while ( isEarlier(iterAP,iCSnow) ) { 
             ++iterAP; 
         }
         S1 = iterAP->S;
         
-        double x = S1 / S0 - 1.0;
-        double Am = Ap * (1.0+x);
-        double L0 = L1;
-
-        double cond1 = (ct.delta*ct.y*x*(1+res_quot) > ct.g) ? 1.0 : 0.0;;
-        double cond2 = 1-cond1;
-        double cond3 = (ct.g <= ct.y*x*(1+res_quot)) ? 1.0 : 0.0;
-       
-        L1        = (1 + std::max(ct.delta*ct.y*x*(1.0+res_quot),ct.g))*L0;
-        double d  = (1-ct.delta)*ct.y*Ap*x*cond1 
-                   + (ct.y*x*(1+res_quot)-ct.g)*L0*cond2*cond3;
-
-        Ap = std::max(Am-d,L1);
-
-        double c = std::max(0.0,L1-Am);
-        res_quot = (Ap - L1)/L1;
+        double c, d;
+        rollContractStates(S1 / S0 - 1.0,ct,L1,Ap,res_quot,c,d);
 
         iCSnow->L  = L1;
         iCSnow->Ap = Ap;
@@ -95,11 +131,15 @@ Path<ContractStates> makeContractStatePath(
     return contractStatePath;
 }
  
-Path<ValueVector> payoffPathFromContractStates(
-        const Path<ContractStates>& contrStatePath) {
-    Path<ValueVector> payoff(contrStatePath.dt()
-                                ,contrStatePath.T()
-                                ,contrStatePath.t0());
+// Writes the payoffs into payoff, reusing its storage
+void payoffPathFromContractStates(
+        const Path<ContractStates>& contrStatePath
+       ,Path<ValueVector>& payoff) {
+    payoff.reset(contrStatePath.dt()
+                ,contrStatePath.T()
+                ,contrStatePath.t0());
+    for (unsigned i=0; i<payoff.size(); ++i)
+        payoff[i] = ValueVector();
     payoff[0].Res = (-1)*(contrStatePath[0].Ap-contrStatePath[0].L);
     for (unsigned i=1; i<contrStatePath.size(); ++i) {
         payoff[i].C = contrStatePath[i].c;
@@ -108,7 +148,12 @@ Path<ValueVector> payoffPathFromContractStates(
     unsigned end    = contrStatePath.size()-1;
     payoff[end].V   = contrStatePath[end].L;
     payoff[end].Res = contrStatePath[end].Ap-contrStatePath[end].L;
+}
 
+Path<ValueVector> payoffPathFromContractStates(
+        const Path<ContractStates>& contrStatePath) {
+    Path<ValueVector> payoff;
+    payoffPathFromContractStates(contrStatePath,payoff);
     return payoff;
 }
 
@@ -120,48 +165,122 @@ ValueVector valueContract(rational t
             payoffPathFromContractStates(contrStatePath));
 }
 
+// Adds the value at t of the contract on assetPath to value, in one pass
+// without intermediate paths: the contract states are rolled forward from
+// the last anniversary on or before t (the later states of
+// contractStatePath are not read) and every payoff is discounted with
+// factors, which must be up to date after t, as it occurs. Same numbers
+// as discountValue of the payoffPathFromContractStates of the recomputed
+// contract state path.
+void accumulateContractValue(const rational& t
+                            ,const Path<Assets> &assetPath
+                            ,const Path<ContractStates> &contractStatePath
+                            ,const DiscountFactors &factors
+                            ,const ContractTraits &ct
+                            ,ValueVector &value) {
+    ConstContrStatePathIter iCS = contractStatePath.lastIteratorOnOrBeforeTime(t);
+    ConstContrStatePathIter iCSlast = contractStatePath.end()-1;
+    if (iCS.t() == t) {
+        ValueVector payoff;
+        if (iCS == contractStatePath.begin()) {
+            payoff.Res = (-1)*(iCS->Ap-iCS->L);
+        } else {
+            payoff.C = iCS->c;
+            payoff.D = iCS->d;
+        }
+        if (iCS == iCSlast) {
+            payoff.V   = iCS->L;
+            payoff.Res = iCS->Ap-iCS->L;
+        }
+        value += payoff;
+    }
+
+    ConstAssetPathIter iterAP = assetPath.iteratorAtTime(iCS.t());
+    unsigned i_t = assetPath.iteratorAtTime(t).index();
+    double L1 = iCS->L;
+    double Ap = iCS->Ap;
+    double res_quot = (Ap - L1)/L1;
+    double S1 = iterAP->S;
+
+    for (++iCS; iCS != contractStatePath.end(); ++iCS) {
+
+        double S0 = S1; 
+        while ( isEarlier(iterAP,iCS) ) { 
+            ++iterAP; 
+        }
+        S1 = iterAP->S;
+
+        ValueVector payoff;
+        rollContractStates(S1 / S0 - 1.0,ct,L1,Ap,res_quot,payoff.C,payoff.D);
+        if (iCS == iCSlast) {
+            payoff.V   = L1;
+            payoff.Res = Ap-L1;
+        }
+        value += payoff * factors.discountFactor(i_t,iterAP.index());
+    }
+}
+
+// Scratch space for valuing the contract at t on many asset paths. 
+// valueContractFromPath only reads the contract states up to the last
+// anniversary on or before t, so the workspace is set up once for a given
+// t and then reused for every scenario without copying or allocating. The
+// discount factors are those of the last asset path valued in the
+// workspace.
+struct ContractValuationWorkspace {
+    ContractValuationWorkspace() {}
+    ContractValuationWorkspace(const Path<ContractStates>& csPath)
+        : contractStatePath(csPath) {}
+    Path<ContractStates> contractStatePath;
+    DiscountFactors discountFactors;
+};
+
 ValueVector valueContractFromPath(rational t
                                      ,const Path<Assets>   &assetPath
-                                     ,Path<ContractStates>    contractStatePath
+                                     ,ContractValuationWorkspace &workspace
                                      ,const ContractTraits &contractTraits) {
+    workspace.discountFactors.update(assetPath,t);
+    ValueVector value;
+    accumulateContractValue(t,assetPath,workspace.contractStatePath
+                           ,workspace.discountFactors,contractTraits,value);
+    return value;
+}
 
-    Path<ContractStates>::iterator iCSLastAnniversary 
-        = contractStatePath.lastIteratorOnOrBeforeTime(t);
-    rational t_lastAnniversary = iCSLastAnniversary.t();
-    Path<Assets>::const_iterator iAPLastAnniversary
-        = assetPath.iteratorAtTime(t_lastAnniversary);
-    computeContractStatePath(iAPLastAnniversary,assetPath.end()
-                    ,iCSLastAnniversary, contractStatePath.end()
-                    ,contractTraits);
-    return valueContract(t,assetPath,contractStatePath);
+ValueVector valueContractFromPath(rational t
+                                     ,const Path<Assets>   &assetPath
+                                     ,const Path<ContractStates> &contractStatePath
+                                     ,const ContractTraits &contractTraits) {
+    ContractValuationWorkspace workspace(contractStatePath);
+    return valueContractFromPath(t,assetPath,workspace,contractTraits);
 }
 
 ValueVector valueContractFromPathWithOffset(
          rational t
         ,Path<Assets> &assetPath                        // is logically const
         ,const Assets& originalAssetValue
-        ,const Path<ContractStates>& contractStatePath
+        ,ContractValuationWorkspace& workspace
         ,const ContractTraits &contractTraits)
 {
     Assets offsetedValue = assetPath[t];
     assetPath[t] = originalAssetValue;
     ValueVector contractValue 
-        = valueContractFromPath(t,assetPath,contractStatePath,contractTraits);
+        = valueContractFromPath(t,assetPath,workspace,contractTraits);
     assetPath[t] = offsetedValue;
     return contractValue;
 }
         
 
+// assetPath is a scratch path, only the points after t are overwritten
+template <class Dynamics>
 ValueVector valueContractFromVariates
                         (rational t
-                        ,Path<Assets> assetPath
+                        ,Path<Assets>& assetPath
                         ,const Path<Variates>& variates
-                        ,const Path<ContractStates>& contractStatePath
+                        ,ContractValuationWorkspace& workspace
                         ,const ContractTraits& contractTraits
-                        ,const ModelDynamics& dynamics) {
+                        ,const Dynamics& dynamics) {
     updatePathFromVariates(assetPath.iteratorAtTime(t),assetPath.end()
                           ,variates.iteratorAtTime(t),dynamics);
-    return valueContractFromPath(t,assetPath,contractStatePath,contractTraits);
+    return valueContractFromPath(t,assetPath,workspace,contractTraits);
 }
 
 
@@ -170,6 +289,90 @@ typedef Assets PathV;
 typedef ValueVector ValT;
 typedef Array<> UnderlT;
 typedef Array<ValueVector> DeltaT;
+typedef PricingResult<ValT,UnderlT,DeltaT> ResultT;
+
+// What computeStockBondFDDeltaFromVariates is called with: the contract
+// value of the numerators, the zero bond of the bond denominators (e.g.
+// discountBondFromPathWithOffset) and the offsets of S(t) and r(t)
+struct StockBondFDDelta {
+    StockBondFDDelta(const ValueVecFromPathFunc& ccontractEval
+                    ,const DoubleFromPathFunc& bbondEval
+                    ,const std::pair<Assets,Assets>& ooffsets)
+        : contractEval(ccontractEval), bondEval(bbondEval), offsets(ooffsets) {}
+    ValueVecFromPathFunc contractEval;
+    DoubleFromPathFunc bondEval;
+    std::pair<Assets,Assets> offsets;
+};
+
+// Value, underlyings and deltas from one simulation of the asset path.
+// Value and deltas are the same numbers as valueContractFromVariates and
+// computeStockBondFDDeltaFromVariates called on the same variates. The
+// zero bond is equal to that of underlyingsFromVariates only up to
+// rounding: it is taken from the prefix sums of the discount factors, not
+// summed up directly.
+template <class Dynamics>
+ResultT priceContractFromVariates
+                        (const rational& t
+                        ,Path<Assets>& assetPath
+                        ,const Path<Variates>& variates
+                        ,ContractValuationWorkspace& workspace
+                        ,const ContractTraits& contractTraits
+                        ,const Dynamics& dynamics
+                        ,const StockBondFDDelta& fd) {
+    ResultT result;
+    updatePathFromVariates(assetPath.iteratorAtTime(t),assetPath.end()
+                          ,variates.iteratorAtTime(t),dynamics);
+    result.value = valueContractFromPath(t,assetPath,workspace
+                                        ,contractTraits);
+    result.underlyings = Array<>(2);
+    result.underlyings[0] = assetPath[t].S;
+    result.underlyings[1] = discountBond(t,assetPath,workspace.discountFactors);
+    result.deltas = computeStockBondFDDeltaFromVariates(t,assetPath,variates
+                        ,dynamics,fd.contractEval
+                        ,&stockFromPathWithOffset,fd.bondEval
+                        ,fd.offsets);
+    return result;
+}
+
+// priceContractFromVariates together with the controls of the scenario:
+// if withStock the discounted stock S(T)D(t,T), whose expectation is S(t)
+// if it is a martingale (see martingaleDiscountedStock), and if withBond
+// the zero bond D(t,T), whose expectation is taken to be the analytic bond
+// price
+template <class Dynamics>
+ControlVariateSample<ResultT> priceContractWithControlsFromVariates
+                        (const rational& t
+                        ,Path<Assets>& assetPath
+                        ,const Path<Variates>& variates
+                        ,ContractValuationWorkspace& workspace
+                        ,const ContractTraits& contractTraits
+                        ,const Dynamics& dynamics
+                        ,const StockBondFDDelta& fd
+                        ,bool withStock
+                        ,bool withBond) {
+    ResultT result;
+    updatePathFromVariates(assetPath.iteratorAtTime(t),assetPath.end()
+                          ,variates.iteratorAtTime(t),dynamics);
+    result.value = valueContractFromPath(t,assetPath,workspace
+                                        ,contractTraits);
+    result.underlyings = Array<>(2);
+    result.underlyings[0] = assetPath[t].S;
+    result.underlyings[1] = discountBond(t,assetPath,workspace.discountFactors);
+
+    // before the deltas, which leave the path bumped
+    std::vector<double> controls;
+    if (withStock)
+        controls.push_back(
+            assetPath[assetPath.size()-1].S * result.underlyings[1]);
+    if (withBond)
+        controls.push_back(result.underlyings[1]);
+
+    result.deltas = computeStockBondFDDeltaFromVariates(t,assetPath,variates
+                        ,dynamics,fd.contractEval
+                        ,&stockFromPathWithOffset,fd.bondEval
+                        ,fd.offsets);
+    return ControlVariateSample<ResultT>(result,controls);
+}
 
 
 ValueVector divide(const ValueVector& vv, double d) {
@@ -186,6 +389,19 @@ const ql::Disposable<Array<ValueVector> > operator/(
     return result;
 }
 
+ValueVector multiply(const ValueVector& vv, double d) {
+    return vv*d;
+}
+
+// Same for the control variate estimates
+const ql::Disposable<Array<ValueVector> > operator*(
+        const Array<ValueVector> &v, double d) {
+
+    Array<ValueVector> result(v.size());
+    std::transform(v.begin(),v.end(),result.begin(), boost::bind(multiply,_1,d));
+    return result;
+}
+
 
 class InsContrEndPointPricingModel 
             : public PricingModel<ValT,UnderlT, DeltaT> {
@@ -219,33 +435,144 @@ class InsContrEndPointPricingModel
     ContractStates finalContractStates_;
 };
 
+// Variance reduction of the inner MC. antithetic: every second scenario is
+// the mirror image of the one before (AntitheticScenarioGenerator).
+// controlVariates: the results used for hedging (evaluate()) are control
+// variate estimates, with the discounted stock as control if it is a
+// martingale of the discretised dynamics (BS-Vasicek, not CEV-CKLS, see
+// martingaleDiscountedStock) and, with InnerMCTraits::analyticBond, the
+// zero bond. Without any control it has no effect. The analytic bond
+// price is that of the continuous Vasicek model; the simulated bonds
+// differ from it a little (the joint draw of r and intR, the bounds on
+// both), so with the bond control the estimates move towards the
+// continuous model (about 0.1% for a 4 year bond).
+struct VarianceReduction {
+    VarianceReduction(bool aantithetic=false, bool ccontrolVariates=false)
+        : antithetic(aantithetic), controlVariates(ccontrolVariates) {}
+    bool antithetic;
+    bool controlVariates;
+};
+
+// How the inner MC of the pricing model factories draws and evaluates its
+// scenarios. By default from one mt19937 stream seeded with seed.
+struct InnerMCTraits {
+    InnerMCTraits(unsigned sseed=42u)
+        : nBlocks(1), nThreads(1), seed(sseed)
+         ,quasiMonteCarlo(false), counterBasedRng(false)
+         ,analyticBond(false) {}
+
+    // nBlocks > 1: the scenarios come from nBlocks independent streams
+    // derived from seed and are evaluated on nThreads threads
+    unsigned nBlocks, nThreads;
+    unsigned seed;
+    // Sobol scenarios, randomly shifted per block if nBlocks > 1
+    bool quasiMonteCarlo;
+    VarianceReduction varianceReduction;
+    // nScenarios is then the maximal number of scenarios (only with
+    // nBlocks == 1, the factories refuse it otherwise)
+    AdaptiveMCTraits adaptive;
+    // Philox scenarios addressed by (outer path, hedge date, scenario), the
+    // same for any nBlocks and nThreads (not with quasiMonteCarlo, the
+    // factories refuse both)
+    bool counterBasedRng;
+    // The zero bond is priced with the closed form of the dynamics (only
+    // BS-Vasicek has one) instead of by MC: the underlyings are the stock
+    // and the analytic bond, the bond deltas are taken w.r.t. the analytic
+    // bond and it can be used as control variate. Then the hedge is that of
+    // the continuous Vasicek bond.
+    bool analyticBond;
+};
+
+// Pricing model with closed form underlyings (the stock and the analytic
+// zero bond), value and deltas come from model, which it owns
+class AnalyticUnderlyingsPricingModel 
+            : public PricingModel<ValT,UnderlT,DeltaT> {
+  public:
+    AnalyticUnderlyingsPricingModel(PricingModel<ValT,UnderlT,DeltaT>* model
+                                   ,const UnderlT& underlyings)
+        : model_(model), underlyings_(underlyings) {}
+
+    virtual ValT    value() const {
+        return model_->value();
+    }
+    virtual UnderlT underlyings() const {
+        return underlyings_;
+    }
+    virtual DeltaT  deltas() const {
+        return model_->deltas();
+    }
+    virtual ResultT evaluate() const {
+        ResultT result = model_->evaluate();
+        result.underlyings = underlyings_;
+        return result;
+    }
+
+  protected:
+    boost::shared_ptr<PricingModel<ValT,UnderlT,DeltaT> > model_;
+    UnderlT underlyings_;
+};
+
 class InsContrMCPricingModelFactory {
 public:
   InsContrMCPricingModelFactory(unsigned nScenarios,
                                 rational hedgePathDt,
-                                boost::function<double ()> n,
                                 ModelDynamics dynamics,
                                 ContractTraits contractTraits,
                                 double offset_S=0.0,
-                                double offset_r=0.0) 
+                                double offset_r=0.0,
+                                const InnerMCTraits& innerMC=InnerMCTraits()) 
     : nScenarios_(nScenarios), hedgePathDt_(hedgePathDt),
-      n_(n), dynamics_(dynamics), contractTraits_(contractTraits),
-      offset_S_(offset_S), offset_r_(offset_r) {}
-
+      dynamics_(dynamics), contractTraits_(contractTraits),
+      offset_S_(offset_S), offset_r_(offset_r), innerMC_(innerMC) {
+    QL_REQUIRE(not innerMC_.quasiMonteCarlo || not innerMC_.counterBasedRng,
+               "InsContrMCPricingModelFactory: the scenarios are either "
+               "Sobol points or Philox variates, not both");
+  }
+
+  // outerPath is the address of the outer path the model is made for,
+  // only used by the counter based scenarios
   virtual PricingModel<ValT,UnderlT,DeltaT>* make(const rational&,
                                                   const Path<Assets>&,
-                                                  const Path<ContractStates>&) const;
+                                                  const Path<ContractStates>&,
+                                                  unsigned outerPath=0) const;
 
 protected:
   Assets offset_S(Assets) const;
   Assets offset_r(Assets) const;    
 
+  Path<Assets> makeHedgePath(const rational&, const Path<Assets>&) const;
+  unsigned hedgeDate(const rational&) const;
+  boost::function<void (ScenT&)> makeScenarioGenerator(
+          const rational&, const Path<Assets>&, unsigned outerPath) const;
+  PricingModel<ValT,UnderlT,DeltaT>* makeMCPricingModel(
+          const rational&, const Path<Assets>&, unsigned outerPath,
+          const boost::function<ValT (const ScenT&)>&,
+          const boost::function<UnderlT (const ScenT&)>&,
+          const boost::function<DeltaT (const ScenT&)>&,
+          const boost::function<ResultT (const ScenT&)>&,
+          const boost::function<ControlVariateSample<ResultT> (const ScenT&)>&
+            =boost::function<ControlVariateSample<ResultT> (const ScenT&)>(),
+          const std::vector<double>& =std::vector<double>()) const;
+  template <class Dynamics>
+  PricingModel<ValT,UnderlT,DeltaT>* makeWithDynamics(
+          const rational&, const Path<Assets>&,
+          const Path<ContractStates>&, const Dynamics&,
+          unsigned outerPath) const;
+  template <class Dynamics>
+  bool analyticBond(const Dynamics&, const rational&, const Path<Assets>&,
+                    double& price, double& dPrice_dr) const;
+  template <class Dynamics>
+  DoubleFromPathFunc bondForDelta(const Dynamics&) const;
+  PricingModel<ValT,UnderlT,DeltaT>* withAnalyticUnderlyings(
+          PricingModel<ValT,UnderlT,DeltaT>*, const rational&,
+          const Path<Assets>&, double bondPrice) const;
+
   unsigned nScenarios_;
   rational hedgePathDt_;
-  boost::function<double ()> n_;
   ModelDynamics dynamics_;
   ContractTraits contractTraits_;
   double offset_S_, offset_r_;
+  InnerMCTraits innerMC_;
 };
 
 Assets InsContrMCPricingModelFactory::offset_S(Assets a) const {
@@ -262,27 +589,169 @@ Assets InsContrMCPricingModelFactory::offset_r(Assets a) const {
     return a;
 }
 
+Path<Assets> InsContrMCPricingModelFactory::makeHedgePath(
+    const rational& t, const Path<Assets>& assetPath) const
+{
+  Path<Assets> hedgePath(hedgePathDt_, assetPath.T(), assetPath.t0());
+  for (rational tt=hedgePath.t0(); tt <= t; tt += hedgePath.dt()) 
+    hedgePath[tt] = assetPath[tt];
+  return hedgePath;
+}
+
+// index of the hedge date t on the hedge grid
+unsigned InsContrMCPricingModelFactory::hedgeDate(const rational& t) const
+{
+  return boost::rational_cast<unsigned>(t/hedgePathDt_);
+}
+
+boost::function<void (ScenT&)> InsContrMCPricingModelFactory::makeScenarioGenerator(
+    const rational& t, const Path<Assets>& hedgePath, unsigned outerPath) const
+{
+  boost::function<void (ScenT&)> scenarioGenerator;
+  if (innerMC_.quasiMonteCarlo)
+    scenarioGenerator = SobolScenarioGenerator(hedgePath.dt(), hedgePath.T(), t);
+  else if (innerMC_.counterBasedRng)
+    scenarioGenerator = PhiloxScenarioGenerator(hedgePath.dt(), hedgePath.T(),
+                                                t, innerMC_.seed, outerPath,
+                                                hedgeDate(t));
+  else
+    scenarioGenerator = BulkScenarioGenerator(hedgePath.dt(), hedgePath.T(),
+                                              t, innerMC_.seed);
+  if (innerMC_.varianceReduction.antithetic)
+    return AntitheticScenarioGenerator(scenarioGenerator);
+  return scenarioGenerator;
+}
+
+PricingModel<ValT,UnderlT,DeltaT>* InsContrMCPricingModelFactory::makeMCPricingModel(
+    const rational& t, const Path<Assets>& hedgePath, unsigned outerPath,
+    const boost::function<ValT (const ScenT&)>& contractPricer,
+    const boost::function<UnderlT (const ScenT&)>& underlyingsPricer,
+    const boost::function<DeltaT (const ScenT&)>& deltaPricer,
+    const boost::function<ResultT (const ScenT&)>& resultPricer,
+    const boost::function<ControlVariateSample<ResultT> (const ScenT&)>& 
+      cvResultPricer,
+    const std::vector<double>& controlMeans) const
+{
+  QL_REQUIRE(innerMC_.nBlocks < 2 || not innerMC_.adaptive.enabled(),
+             "InsContrMCPricingModelFactory: adaptive stopping needs "
+             "nBlocks == 1, the blocked model runs all nScenarios");
+  MCPricingModel<ValT,UnderlT,DeltaT,ScenT>* model;
+  if (innerMC_.nBlocks > 1) {
+    boost::function<boost::function<void (ScenT&)> (unsigned)> blockGenerator;
+    if (innerMC_.quasiMonteCarlo)
+      blockGenerator = SobolBlockScenarioGenerator(hedgePath.dt(), hedgePath.T(),
+                                                   t, innerMC_.seed);
+    else if (innerMC_.counterBasedRng)
+      blockGenerator = PhiloxBlockScenarioGenerator(hedgePath.dt(), hedgePath.T(),
+                                                    t, innerMC_.seed, outerPath,
+                                                    hedgeDate(t), nScenarios_,
+                                                    innerMC_.nBlocks);
+    else
+      blockGenerator = BlockScenarioGenerator(hedgePath.dt(), hedgePath.T(),
+                                              t, innerMC_.seed);
+    if (innerMC_.varianceReduction.antithetic)
+      blockGenerator = AntitheticBlockScenarioGenerator(blockGenerator);
+    model = new BlockedMCPricingModel<ValT,UnderlT,DeltaT,ScenT>(nScenarios_,
+                                                                 innerMC_.nBlocks,
+                                                                 innerMC_.nThreads,
+                                                                 blockGenerator,
+                                                                 contractPricer,
+                                                                 underlyingsPricer,
+                                                                 deltaPricer,
+                                                                 resultPricer);
+  } else {
+    boost::function<void (ScenT&)> scenarioGenerator
+      = makeScenarioGenerator(t, hedgePath, outerPath);
+    model = new MCPricingModel<ValT,UnderlT,DeltaT,ScenT> (nScenarios_,
+                                                           scenarioGenerator,
+                                                           contractPricer,
+                                                           underlyingsPricer,
+                                                           deltaPricer,
+                                                           resultPricer);
+  }
+  if (not cvResultPricer.empty())
+    model->setControlVariates(cvResultPricer, controlMeans);
+  if (innerMC_.adaptive.enabled()) {
+    AdaptiveMCTraits adaptive = innerMC_.adaptive;
+    // stop only after complete antithetic pairs
+    if (innerMC_.varianceReduction.antithetic && adaptive.checkInterval % 2 == 1)
+      ++adaptive.checkInterval;
+    model->setAdaptiveStopping(adaptive);
+  }
+  return model;
+}
+
+// The closed form zero bond P(t,T) and dP/dr(t) at hedgePath[t] if the
+// analytic bond is asked for, then the dynamics must have one
+template <class Dynamics>
+bool InsContrMCPricingModelFactory::analyticBond(
+    const Dynamics& dynamics, const rational& t, const Path<Assets>& hedgePath,
+    double& price, double& dPrice_dr) const
+{
+  if (not innerMC_.analyticBond)
+    return false;
+  QL_REQUIRE(analyticDiscountBond(dynamics, hedgePath[t].r,
+                                  boost::rational_cast<double>(
+                                    hedgePath.T() - t),
+                                  price, dPrice_dr),
+             "InsContrMCPricingModelFactory: analytic bond asked for, but "
+             "the dynamics have no closed form zero bond price");
+  return true;
+}
+
+// The zero bond of the finite difference delta denominators
+template <class Dynamics>
+DoubleFromPathFunc InsContrMCPricingModelFactory::bondForDelta(
+    const Dynamics& dynamics) const
+{
+  if (innerMC_.analyticBond)
+    return boost::bind(analyticDiscountBondFromPathWithOffset<Dynamics>,
+                       _1, _2, _3, dynamics);
+  return &discountBondFromPathWithOffset;
+}
+
+// no MC estimate of the underlyings if the bond has a closed form
+PricingModel<ValT,UnderlT,DeltaT>* 
+InsContrMCPricingModelFactory::withAnalyticUnderlyings(
+    PricingModel<ValT,UnderlT,DeltaT>* model, const rational& t,
+    const Path<Assets>& hedgePath, double bondPrice) const
+{
+  Array<> underlyings(2);
+  underlyings[0] = hedgePath[t].S;
+  underlyings[1] = bondPrice;
+  return new AnalyticUnderlyingsPricingModel(model, underlyings);
+}
+
 PricingModel<ValT,UnderlT,DeltaT>* InsContrMCPricingModelFactory::make(
     const rational& t, const Path<Assets>& assetPath,
-    const Path<ContractStates>& contractStatePath) const
+    const Path<ContractStates>& contractStatePath, unsigned outerPath) const
+{
+  return makeWithDynamics(t, assetPath, contractStatePath, dynamics_,
+                          outerPath);
+}
+
+template <class Dynamics>
+PricingModel<ValT,UnderlT,DeltaT>* InsContrMCPricingModelFactory::makeWithDynamics(
+    const rational& t, const Path<Assets>& assetPath,
+    const Path<ContractStates>& contractStatePath,
+    const Dynamics& dynamics, unsigned outerPath) const
 {
   if (t == contractStatePath.T()) {
     return new InsContrEndPointPricingModel(assetPath[t],contractStatePath[t]);
   } else {
-    Path<Assets> hedgePath(hedgePathDt_, assetPath.T(), assetPath.t0());
-    for (rational tt=hedgePath.t0(); tt <= t; tt += hedgePath.dt()) 
-      hedgePath[tt] = assetPath[tt];
-
-    boost::function<ScenT ()> scenarioGenerator
-      = ScenarioGenerator(hedgePath.dt(), hedgePath.T(), t, n_);
-
+    Path<Assets> hedgePath = makeHedgePath(t, assetPath);
 
+    // The pricers bind their own copies of hedgePath and of the workspaces
+    // and use them as scratch space for all their scenarios (each copy of a
+    // pricer, e.g. one per thread, has its own).
     boost::function<ValT (const ScenT&)> contractPricer
-      = boost::bind(valueContractFromVariates, t, hedgePath,
-                    _1, contractStatePath, contractTraits_, dynamics_);
+      = boost::bind(valueContractFromVariates<Dynamics>, t, hedgePath,
+                    _1, ContractValuationWorkspace(contractStatePath),
+                    contractTraits_, dynamics);
 
     boost::function<UnderlT (const ScenT&)> underlyingsPricer
-      = boost::bind(underlyingsFromVariates, t, hedgePath, _1, dynamics_);
+      = boost::bind(underlyingsFromVariates<Dynamics>, t, hedgePath, _1,
+                    dynamics);
 
     std::pair<Assets,Assets> offsets;
     offsets.first  = offset_S(hedgePath[t]);
@@ -291,22 +760,85 @@ PricingModel<ValT,UnderlT,DeltaT>* InsContrMCPricingModelFactory::make(
     boost::function<ValT (const rational&, Path<Assets>&, const Assets&)>
       contractEvaluatorForDelta
       = boost::bind(valueContractFromPathWithOffset,_1,_2,_3,
-                    contractStatePath,contractTraits_);
+                    ContractValuationWorkspace(contractStatePath),
+                    contractTraits_);
+
+    StockBondFDDelta fd(contractEvaluatorForDelta, bondForDelta(dynamics),
+                        offsets);
 
     boost::function<DeltaT (const ScenT&)> deltaPricer
-      = boost::bind(computeStockBondFDDeltaFromVariates, t, hedgePath,
-                    _1, dynamics_, contractEvaluatorForDelta,
-                    &stockFromPathWithOffset, &discountBondFromPathWithOffset,
-                    offsets);
-       
-    return new MCPricingModel<ValT,UnderlT,DeltaT,ScenT> (nScenarios_,
-                                                          scenarioGenerator,
-                                                          contractPricer,
-                                                          underlyingsPricer,
-                                                          deltaPricer);
+      = boost::bind(computeStockBondFDDeltaFromVariates<Dynamics>, t, hedgePath,
+                    _1, dynamics, fd.contractEval,
+                    &stockFromPathWithOffset, fd.bondEval, fd.offsets);
+
+    boost::function<ResultT (const ScenT&)> resultPricer
+      = boost::bind(priceContractFromVariates<Dynamics>, t, hedgePath, _1,
+                    ContractValuationWorkspace(contractStatePath),
+                    contractTraits_, dynamics, fd);
+
+    double bondPrice = 0.0, bondDr = 0.0;
+    bool withBond = analyticBond(dynamics, t, hedgePath, bondPrice, bondDr);
+    PricingModel<ValT,UnderlT,DeltaT>* model;
+
+    // only controls with known expectations
+    bool withStock = martingaleDiscountedStock(dynamics);
+    if (innerMC_.varianceReduction.controlVariates && (withStock || withBond)) {
+      std::vector<double> controlMeans;
+      if (withStock)
+        controlMeans.push_back(hedgePath[t].S);
+      if (withBond)
+        controlMeans.push_back(bondPrice);
+
+      boost::function<ControlVariateSample<ResultT> (const ScenT&)> cvResultPricer
+        = boost::bind(priceContractWithControlsFromVariates<Dynamics>, t,
+                      hedgePath, _1, ContractValuationWorkspace(contractStatePath),
+                      contractTraits_, dynamics, fd, withStock, withBond);
+      model = makeMCPricingModel(t, hedgePath, outerPath, contractPricer,
+                                 underlyingsPricer, deltaPricer, resultPricer,
+                                 cvResultPricer, controlMeans);
+    } else {
+      model = makeMCPricingModel(t, hedgePath, outerPath, contractPricer,
+                                 underlyingsPricer, deltaPricer, resultPricer);
+    }
+
+    if (withBond)
+      return withAnalyticUnderlyings(model, t, hedgePath, bondPrice);
+    return model;
     }
 }
 
+// Same as InsContrMCPricingModelFactory, but the inner paths are simulated
+// with the concrete dynamics D (e.g. RnCevCklsDynamics) instead of going
+// through ModelDynamics, so the steps of the path loops are inlined.
+// The model is chosen once when the factory is created.
+template <class D>
+class StaticInsContrMCPricingModelFactory : public InsContrMCPricingModelFactory {
+public:
+  StaticInsContrMCPricingModelFactory(unsigned nScenarios,
+                                      rational hedgePathDt,
+                                      const D& dynamics,
+                                      ContractTraits contractTraits,
+                                      double offset_S=0.0,
+                                      double offset_r=0.0,
+                                      const InnerMCTraits& innerMC
+                                        =InnerMCTraits())
+    : InsContrMCPricingModelFactory(nScenarios, hedgePathDt,
+                                    ModelDynamics(dynamics), contractTraits,
+                                    offset_S, offset_r, innerMC),
+      staticDynamics_(dynamics) {}
+
+  virtual PricingModel<ValT,UnderlT,DeltaT>* make(
+      const rational& t, const Path<Assets>& assetPath,
+      const Path<ContractStates>& contractStatePath,
+      unsigned outerPath=0) const {
+    return makeWithDynamics(t, assetPath, contractStatePath, staticDynamics_,
+                            outerPath);
+  }
+
+protected:
+  StaticDynamics<D> staticDynamics_;
+};
+
 }
 
 #endif
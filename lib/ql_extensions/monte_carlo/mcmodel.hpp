@@ -1,57 +1,453 @@
 #ifndef ql_extensions__monte_carlo__mcmodel_hpp__
 #define ql_extensions__monte_carlo__mcmodel_hpp__ 
 
+#include <vector>
+#include <algorithm>
+
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
 
+#include "../algorithm/parallel_transform.hpp"
 #include "pricingmodel.hpp"
 
 namespace QuantLibExt {
 
+// One scenario's contribution to a control variate estimate: the value y,
+// the controls x and the products needed for the regression of y on x.
+// Sums and means of samples are again samples, so they go through
+// computeMCExpectations (or the blocked version) like any value, and 
+// estimate() turns the means into the control variate estimate.
+// ValT needs +=, * double and / double.
+template <class ValT>
+struct ControlVariateSample {
+    ControlVariateSample() {}
+    ControlVariateSample(const ValT& yy, const std::vector<double>& controls)
+        : y(yy), x(controls), xx(controls.size()*controls.size())
+         ,xy(controls.size()) {
+        unsigned K = x.size();
+        for (unsigned k=0; k<K; ++k) {
+            for (unsigned l=0; l<K; ++l)
+                xx[k*K+l] = x[k]*x[l];
+            xy[k] = y*x[k];
+        }
+    }
+
+    ControlVariateSample& operator+=(const ControlVariateSample& other) {
+        y += other.y;
+        for (unsigned k=0; k<x.size(); ++k) {
+            x[k]  += other.x[k];
+            xy[k] += other.xy[k];
+        }
+        for (unsigned k=0; k<xx.size(); ++k) 
+            xx[k] += other.xx[k];
+        return *this;
+    }
+    ControlVariateSample operator/(double d) const {
+        ControlVariateSample temp;
+        temp.y = y / d;
+        for (unsigned k=0; k<x.size(); ++k) {
+            temp.x.push_back(x[k] / d);
+            temp.xy.push_back(xy[k] / d);
+        }
+        for (unsigned k=0; k<xx.size(); ++k) 
+            temp.xx.push_back(xx[k] / d);
+        return temp;
+    }
+
+    // For a sample holding means: E[y] - beta (E[x] - controlMeans) with
+    // the regression coefficients beta = Cov(x)^-1 Cov(x,y) estimated from
+    // the same scenarios. A control without variance of its own (constant,
+    // or a combination of the controls before it) is left out, the others
+    // are still used.
+    ValT estimate(const std::vector<double>& controlMeans) const {
+        unsigned K = x.size();
+        std::vector<double> inv;
+        std::vector<bool> used;
+        invertCovariance(inv,used);
+        ValT result = y;
+        for (unsigned k=0; k<K; ++k) {
+            if (not used[k]) continue;
+            double deviation = x[k] - controlMeans[k];
+            for (unsigned l=0; l<K; ++l) {
+                if (not used[l]) continue;
+                // beta_k = sum_l inv_kl (E[x_l y] - E[x_l] E[y])
+                double w = -inv[k*K+l]*deviation;
+                result += xy[l]*w;
+                result += y*(-x[l]*w);
+            }
+        }
+        return result;
+    }
+
+    // For a sample holding means, with varianceY the variance of y: the
+    // variance of the residuals y - beta x of the regression of estimate(),
+    // Var(y) - Cov(y,x) Cov(x)^-1 Cov(x,y). ValT also needs * ValT.
+    ValT residualVariance(const ValT& varianceY) const {
+        unsigned K = x.size();
+        std::vector<double> inv;
+        std::vector<bool> used;
+        invertCovariance(inv,used);
+        ValT result = varianceY;
+        for (unsigned k=0; k<K; ++k) {
+            if (not used[k]) continue;
+            ValT covK = xy[k] - y*x[k];
+            for (unsigned l=0; l<K; ++l) {
+                if (not used[l]) continue;
+                ValT covL = xy[l] - y*x[l];
+                result -= (covK*covL)*inv[k*K+l];
+            }
+        }
+        return result;
+    }
+
+    ValT y;
+    std::vector<double> x, xx;
+    std::vector<ValT> xy;
+
+  private:
+    // Cov(x)^-1 restricted to the used controls, by Gauss-Jordan. Cov(x) 
+    // is positive semidefinite, the pivot is the variance left in control
+    // p after the regression on the used controls before it.
+    void invertCovariance(std::vector<double>& inv
+                         ,std::vector<bool>& used) const {
+        unsigned K = x.size();
+        std::vector<double> cov(K*K);
+        inv.assign(K*K,0.0);
+        used.assign(K,true);
+        for (unsigned k=0; k<K; ++k) {
+            for (unsigned l=0; l<K; ++l)
+                cov[k*K+l] = xx[k*K+l] - x[k]*x[l];
+            inv[k*K+k] = 1.0;
+        }
+        for (unsigned p=0; p<K; ++p) {
+            double pivot = cov[p*K+p];
+            if (!(pivot > 1E-12*xx[p*K+p])) {
+                used[p] = false;
+                continue;
+            }
+            for (unsigned l=0; l<K; ++l) {
+                cov[p*K+l] /= pivot;
+                inv[p*K+l] /= pivot;
+            }
+            for (unsigned k=0; k<K; ++k) {
+                if (k == p) continue;
+                double f = cov[k*K+p];
+                for (unsigned l=0; l<K; ++l) {
+                    cov[k*K+l] -= f*cov[p*K+l];
+                    inv[k*K+l] -= f*inv[p*K+l];
+                }
+            }
+        }
+    }
+};
+
+// Running mean and variance of MC evaluations (Welford's algorithm), 
+// componentwise for T = ValueVector. T needs -, +=, / double, * T 
+// (componentwise) and the free functions sqrt, abs and maxComponent.
+template <class T>
+class MCStatistics {
+  public:
+    MCStatistics() : n_(0) {}
+
+    void add(const T& x) {
+        ++n_;
+        if (n_ == 1) {
+            mean_ = x;
+            m2_ = (x - x)*(x - x);
+        } else {
+            T delta = x - mean_;
+            mean_ += delta / (double)n_;
+            m2_ += delta*(x - mean_);
+        }
+    }
+
+    unsigned samples() const { return n_; }
+    const T& mean() const { return mean_; }
+    // sample variance, zero for a single sample
+    T variance() const {
+        return n_ > 1 ? m2_ / (double)(n_-1) : m2_;
+    }
+    T standardError() const {
+        return sqrt(variance() / (double)n_);
+    }
+    // standard error <= relative*|mean| + absolute in every component
+    bool errorBelow(double relative, double absolute) const {
+        return maxComponent(standardError() - abs(mean_)*relative) 
+                   <= absolute;
+    }
+
+  private:
+    unsigned n_;
+    T mean_, m2_;
+};
+
+// Standard error of the control variate estimate of the mean of T (see
+// ControlVariateSample::estimate): that of the mean of the residuals
+// y - beta (x - controlMeans), with beta estimated from the samples so
+// far. errorBelow is relative to the plain mean of y. T needs what 
+// MCStatistics and ControlVariateSample need, and * T.
+template <class T>
+class ControlVariateStatistics {
+  public:
+    ControlVariateStatistics() {}
+
+    void add(const ControlVariateSample<T>& sample) {
+        if (y_.samples() == 0)
+            sum_ = sample;
+        else
+            sum_ += sample;
+        y_.add(sample.y);
+    }
+
+    unsigned samples() const { return y_.samples(); }
+    T standardError() const {
+        unsigned n = samples();
+        unsigned K = sum_.x.size();
+        // the regression uses the biased (1/n) covariances, so does the
+        // variance of y here; the residuals have n-K-1 degrees of freedom
+        T variance = (sum_ / (double)n).residualVariance(
+                         y_.variance()*((n-1.0)/n));
+        unsigned dof = n > K+1 ? n-K-1 : 1;
+        // abs: the residual variance can come out just below zero
+        return sqrt(abs(variance) / (double)dof);
+    }
+    // standard error <= relative*|mean| + absolute in every component
+    bool errorBelow(double relative, double absolute) const {
+        return maxComponent(standardError() - abs(y_.mean())*relative) 
+                   <= absolute;
+    }
+
+  private:
+    MCStatistics<T> y_;
+    ControlVariateSample<T> sum_;
+};
+
+// Adaptive stopping of an MC run: it stops once the standard error of the
+// monitored value is at most targetRelativeError*|mean| +
+// targetAbsoluteError in every component, checked every checkInterval
+// scenarios. The absolute part lets components with mean zero stop. Off if
+// targetRelativeError <= 0.
+struct AdaptiveMCTraits {
+    AdaptiveMCTraits(double ttargetRelativeError=0.0
+                    ,unsigned ccheckInterval=100
+                    ,double ttargetAbsoluteError=0.0)
+        : targetRelativeError(ttargetRelativeError)
+         ,targetAbsoluteError(ttargetAbsoluteError)
+         ,checkInterval(std::max(ccheckInterval,1u)) {}
+    bool enabled() const { return targetRelativeError > 0.0; }
+
+    double targetRelativeError, targetAbsoluteError;
+    unsigned checkInterval;
+};
+
+// scenarioGenerator draws the next scenario into its argument. The same
+// ScenT is used for all scenarios, so its storage is allocated only once.
 template <class ValT, class ScenT>
-ValT computeMCExpectations(boost::function<ScenT ()> scenarioGenerator
+ValT computeMCExpectations(boost::function<void (ScenT&)> scenarioGenerator
                           ,boost::function<ValT (const ScenT&)> evaluator
                           ,unsigned nScenarios) 
 {
-    ValT accumulator = evaluator(scenarioGenerator());
-    for (unsigned i=1; i<nScenarios; ++i) 
-        accumulator += evaluator(scenarioGenerator());
+    ScenT scenario;
+    scenarioGenerator(scenario);
+    ValT accumulator = evaluator(scenario);
+    for (unsigned i=1; i<nScenarios; ++i) {
+        scenarioGenerator(scenario);
+        accumulator += evaluator(scenario);
+    }
+    return accumulator / (double)nScenarios;
+}
+
+// computeMCExpectations with at most nScenarios scenarios, which stops 
+// early (see AdaptiveMCTraits) when monitor(evaluation) is known precisely
+// enough. statistics (MCStatistics<MonT>, or ControlVariateStatistics for
+// control variate samples) are those of the monitored values, their number
+// of samples is the number of scenarios used.
+template <class ValT, class MonT, class ScenT, class Statistics>
+ValT computeAdaptiveMCExpectations(
+        boost::function<void (ScenT&)> scenarioGenerator
+       ,boost::function<ValT (const ScenT&)> evaluator
+       ,boost::function<MonT (const ValT&)> monitor
+       ,unsigned nScenarios
+       ,const AdaptiveMCTraits& adaptive
+       ,Statistics& statistics)
+{
+    statistics = Statistics();
+    ScenT scenario;
+    scenarioGenerator(scenario);
+    ValT evaluation = evaluator(scenario);
+    statistics.add(monitor(evaluation));
+    ValT accumulator = evaluation;
+    unsigned i = 1;
+    for (; i<nScenarios; ++i) {
+        if (adaptive.enabled() && i % adaptive.checkInterval == 0
+                && statistics.errorBelow(adaptive.targetRelativeError
+                                        ,adaptive.targetAbsoluteError))
+            break;
+        scenarioGenerator(scenario);
+        evaluation = evaluator(scenario);
+        statistics.add(monitor(evaluation));
+        accumulator += evaluation;
+    }
+    return accumulator / (double)i;
+}
+
+// Monitors for computeAdaptiveMCExpectations
+template <class ValT>
+ValT monitorValue(const ValT& value) {
+    return value;
+}
+
+template <class ValT, class UnderlT, class DeltaT>
+ValT monitorResultValue(const PricingResult<ValT,UnderlT,DeltaT>& result) {
+    return result.value;
+}
+
+// the value with the controls, for ControlVariateStatistics
+template <class ValT, class UnderlT, class DeltaT>
+ControlVariateSample<ValT> monitorSampleValue(
+        const ControlVariateSample<PricingResult<ValT,UnderlT,DeltaT> >& sample) {
+    return ControlVariateSample<ValT>(sample.y.value,sample.x);
+}
+
+// Sums the evaluations of the scenarios in one block of a blocked MC run.
+// Block b covers the scenarios [b*n/nBlocks, (b+1)*n/nBlocks) and draws 
+// them from its own generator, so blocks can be computed on any thread.
+template <class ValT, class ScenT>
+class MCBlockSum {
+  public:
+    MCBlockSum(boost::function<boost::function<void (ScenT&)> (unsigned)> blockGenerator
+              ,boost::function<ValT (const ScenT&)> evaluator
+              ,unsigned nScenarios, unsigned nBlocks)
+        : blockGenerator_(blockGenerator), evaluator_(evaluator)
+         ,nScenarios_(nScenarios), nBlocks_(nBlocks) {}
+
+    ValT operator()(unsigned block) {
+        boost::function<void (ScenT&)> scenarioGenerator = blockGenerator_(block);
+        unsigned first = (unsigned)(((unsigned long long)block*nScenarios_)/nBlocks_);
+        unsigned last  = (unsigned)(((unsigned long long)(block+1)*nScenarios_)/nBlocks_);
+        ScenT scenario;
+        scenarioGenerator(scenario);
+        ValT accumulator = evaluator_(scenario);
+        for (unsigned i=first+1; i<last; ++i) {
+            scenarioGenerator(scenario);
+            accumulator += evaluator_(scenario);
+        }
+        return accumulator;
+    }
+
+  private:
+    boost::function<boost::function<void (ScenT&)> (unsigned)> blockGenerator_;
+    boost::function<ValT (const ScenT&)> evaluator_;
+    unsigned nScenarios_, nBlocks_;
+};
+
+// Parallel version of computeMCExpectations. The block sums are added up
+// in block order, so the result depends on nBlocks but not on nThreads.
+// Every worker thread evaluates with its own copy of the evaluator. The
+// nThreads threads are started for each call, so calls from several
+// threads at once run up to their number times nThreads threads
+// (mc_simulation does not take --threads with --inner-threads).
+template <class ValT, class ScenT>
+ValT computeBlockedMCExpectations(
+        boost::function<boost::function<void (ScenT&)> (unsigned)> blockGenerator
+       ,boost::function<ValT (const ScenT&)> evaluator
+       ,unsigned nScenarios, unsigned nBlocks, unsigned nThreads)
+{
+    nBlocks = std::max(std::min(nBlocks,nScenarios),1u);
+    std::vector<unsigned> blocks(nBlocks);
+    for (unsigned b=0; b<nBlocks; ++b)
+        blocks[b] = b;
+
+    std::vector<ValT> blockSums(nBlocks);
+    parallel_transform(blocks.begin(), blocks.end(), blockSums.begin()
+            ,MCBlockSum<ValT,ScenT>(blockGenerator,evaluator,nScenarios,nBlocks)
+            ,nThreads);
+
+    ValT accumulator = blockSums[0];
+    for (unsigned b=1; b<nBlocks; ++b) 
+        accumulator += blockSums[b];
     return accumulator / (double)nScenarios;
 }
 
 template <class ValT, class UnderlT, class DeltaT, class ScenT>
 class MCPricingModel : public PricingModel<ValT,UnderlT,DeltaT> {
   public:
+    typedef PricingResult<ValT,UnderlT,DeltaT> ResultT;
+
+    // resultPricer is optional, if given evaluate() prices all three 
+    // quantities with one simulation per scenario
     MCPricingModel(
             unsigned nScenarios
-           ,const boost::function<ScenT ()> scenarioGenerator
+           ,const boost::function<void (ScenT&)> scenarioGenerator
            ,const boost::function<ValT (const ScenT&)> contractPricer
            ,const boost::function<UnderlT (const ScenT&)> underlyingsPricer
-           ,const boost::function<DeltaT (const ScenT&)> deltaPricer) 
+           ,const boost::function<DeltaT (const ScenT&)> deltaPricer
+           ,const boost::function<ResultT (const ScenT&)> resultPricer
+                = boost::function<ResultT (const ScenT&)>()) 
         : nScenarios_(nScenarios)
          ,scenarioGenerator_(scenarioGenerator)
          ,contractPricer_(contractPricer)
          ,underlyingsPricer_(underlyingsPricer)
          ,deltaPricer_(deltaPricer)
+         ,resultPricer_(resultPricer)
     {}
     virtual ValT    value() const; 
     virtual UnderlT underlyings() const;
     virtual DeltaT  deltas() const;
+    virtual ResultT evaluate() const;
+
+    // evaluate() then uses control variates: cvResultPricer gives the
+    // result of a scenario together with its controls, whose expectations
+    // are controlMeans
+    void setControlVariates(
+            const boost::function<ControlVariateSample<ResultT> (const ScenT&)>&
+                cvResultPricer
+           ,const std::vector<double>& controlMeans) {
+        cvResultPricer_ = cvResultPricer;
+        controlMeans_ = controlMeans;
+    }
+
+    // value() and evaluate() then use at most nScenarios scenarios and 
+    // stop as soon as the value is precise enough. The blocked model runs
+    // all nScenarios, InsContrMCPricingModelFactory does not give it one.
+    void setAdaptiveStopping(const AdaptiveMCTraits& adaptive) {
+        adaptive_ = adaptive;
+    }
+
+    // value() together with its standard errors and the number of
+    // scenarios used
+    MCStatistics<ValT> valueStatistics() const;
 
   protected:
     unsigned nScenarios_;
-    boost::function<ScenT   ()>             scenarioGenerator_;
+    boost::function<void    (ScenT&)>       scenarioGenerator_;
     boost::function<ValT    (const ScenT&)> contractPricer_;
     boost::function<UnderlT (const ScenT&)> underlyingsPricer_;
     boost::function<DeltaT  (const ScenT&)> deltaPricer_;
+    boost::function<ResultT (const ScenT&)> resultPricer_;
+    boost::function<ControlVariateSample<ResultT> (const ScenT&)> cvResultPricer_;
+    std::vector<double> controlMeans_;
+    AdaptiveMCTraits adaptive_;
 };
 
 template <class ValT, class UnderlT, class DeltaT, class ScenT>
 ValT MCPricingModel<ValT,UnderlT,DeltaT,ScenT>::value() const {
+    if (adaptive_.enabled())
+        return valueStatistics().mean();
     return computeMCExpectations(scenarioGenerator_ 
             ,contractPricer_, nScenarios_);
 }
 
+template <class ValT, class UnderlT, class DeltaT, class ScenT>
+MCStatistics<ValT> 
+MCPricingModel<ValT,UnderlT,DeltaT,ScenT>::valueStatistics() const {
+    MCStatistics<ValT> statistics;
+    computeAdaptiveMCExpectations(scenarioGenerator_, contractPricer_
+            ,boost::function<ValT (const ValT&)>(&monitorValue<ValT>)
+            ,nScenarios_, adaptive_, statistics);
+    return statistics;
+}
+
 template <class ValT, class UnderlT, class DeltaT, class ScenT>
 UnderlT MCPricingModel<ValT,UnderlT,DeltaT,ScenT>::underlyings() const {
     return computeMCExpectations(scenarioGenerator_ 
@@ -64,6 +460,86 @@ DeltaT MCPricingModel<ValT,UnderlT,DeltaT,ScenT>::deltas() const {
             ,deltaPricer_, nScenarios_);
 }
 
+template <class ValT, class UnderlT, class DeltaT, class ScenT>
+PricingResult<ValT,UnderlT,DeltaT> 
+MCPricingModel<ValT,UnderlT,DeltaT,ScenT>::evaluate() const {
+    if (adaptive_.enabled() && not cvResultPricer_.empty()) {
+        // stops on the error of the control variate estimate
+        ControlVariateStatistics<ValT> statistics;
+        return computeAdaptiveMCExpectations(scenarioGenerator_, cvResultPricer_
+                ,boost::function<ControlVariateSample<ValT> (
+                    const ControlVariateSample<ResultT>&)>(
+                    &monitorSampleValue<ValT,UnderlT,DeltaT>)
+                ,nScenarios_, adaptive_, statistics).estimate(controlMeans_);
+    }
+    if (adaptive_.enabled() && not resultPricer_.empty()) {
+        MCStatistics<ValT> statistics;
+        return computeAdaptiveMCExpectations(scenarioGenerator_, resultPricer_
+                ,boost::function<ValT (const ResultT&)>(
+                    &monitorResultValue<ValT,UnderlT,DeltaT>)
+                ,nScenarios_, adaptive_, statistics);
+    }
+    if (not cvResultPricer_.empty())
+        return computeMCExpectations(scenarioGenerator_ 
+                ,cvResultPricer_, nScenarios_).estimate(controlMeans_);
+    if (resultPricer_.empty())
+        return PricingModel<ValT,UnderlT,DeltaT>::evaluate();
+    return computeMCExpectations(scenarioGenerator_ 
+            ,resultPricer_, nScenarios_);
+}
+
+// MCPricingModel that splits the scenarios into nBlocks blocks with
+// independent generators and evaluates them on nThreads threads
+template <class ValT, class UnderlT, class DeltaT, class ScenT>
+class BlockedMCPricingModel : public MCPricingModel<ValT,UnderlT,DeltaT,ScenT> {
+  public:
+    typedef PricingResult<ValT,UnderlT,DeltaT> ResultT;
+
+    BlockedMCPricingModel(
+            unsigned nScenarios
+           ,unsigned nBlocks
+           ,unsigned nThreads
+           ,const boost::function<boost::function<void (ScenT&)> (unsigned)> blockGenerator
+           ,const boost::function<ValT (const ScenT&)> contractPricer
+           ,const boost::function<UnderlT (const ScenT&)> underlyingsPricer
+           ,const boost::function<DeltaT (const ScenT&)> deltaPricer
+           ,const boost::function<ResultT (const ScenT&)> resultPricer
+                = boost::function<ResultT (const ScenT&)>()) 
+        : MCPricingModel<ValT,UnderlT,DeltaT,ScenT>(nScenarios
+                  ,blockGenerator(0),contractPricer,underlyingsPricer,deltaPricer
+                  ,resultPricer)
+         ,nBlocks_(nBlocks)
+         ,nThreads_(nThreads)
+         ,blockGenerator_(blockGenerator)
+    {}
+    virtual ValT    value() const {
+        return computeBlockedMCExpectations(blockGenerator_ 
+                ,this->contractPricer_, this->nScenarios_, nBlocks_, nThreads_);
+    }
+    virtual UnderlT underlyings() const {
+        return computeBlockedMCExpectations(blockGenerator_ 
+                ,this->underlyingsPricer_, this->nScenarios_, nBlocks_, nThreads_);
+    }
+    virtual DeltaT  deltas() const {
+        return computeBlockedMCExpectations(blockGenerator_ 
+                ,this->deltaPricer_, this->nScenarios_, nBlocks_, nThreads_);
+    }
+    virtual ResultT evaluate() const {
+        if (not this->cvResultPricer_.empty())
+            return computeBlockedMCExpectations(blockGenerator_ 
+                    ,this->cvResultPricer_, this->nScenarios_, nBlocks_
+                    ,nThreads_).estimate(this->controlMeans_);
+        if (this->resultPricer_.empty())
+            return PricingModel<ValT,UnderlT,DeltaT>::evaluate();
+        return computeBlockedMCExpectations(blockGenerator_ 
+                ,this->resultPricer_, this->nScenarios_, nBlocks_, nThreads_);
+    }
+
+  protected:
+    unsigned nBlocks_, nThreads_;
+    boost::function<boost::function<void (ScenT&)> (unsigned)> blockGenerator_;
+};
+
 }
 
 #endif
@@ -0,0 +1,252 @@
+#ifndef ql_extensions__monte_carlo__model_points_hpp__
+#define ql_extensions__monte_carlo__model_points_hpp__
+
+#include <cmath>
+#include <vector>
+#include <map>
+
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+
+#include "../instruments/termfixinsurance/valuevector.hpp"
+#include "../math/array.hpp"
+
+#include "assets.hpp"
+#include "dynamics.hpp"
+#include "insurance_contract.hpp"
+#include "portfolio.hpp"
+#include "helper_functions.hpp"
+
+namespace QuantLibExt {
+
+/*
+ * Model points: a large book of policies is compressed into few
+ * representative contracts. The contract value is homogeneous of degree
+ * one in (L, Ap) for a given reserve quotient Ap/L-1, so policies that
+ * agree in guarantee rate g, participation y, delta, reserve quotient and
+ * term are one contract with the summed L and Ap. Policies are grouped on
+ * a grid of these, the model point of a cell has the L-weighted g, y,
+ * delta and the summed L and Ap, and its value is shared out to the
+ * policies in proportion to L.
+ */
+
+// A book of policies as structure of arrays. Unlike in a ContractPortfolio
+// the terms (in years, the contract dates are yearly) may differ.
+struct PolicyBook {
+    void add(const ContractTraits& ct) {
+        QL_REQUIRE(ct.dt == rational(1) && ct.T.denominator() == 1,
+            "PolicyBook: policies need yearly contract dates and a term in years");
+        g.push_back(ct.g);
+        y.push_back(ct.y);
+        delta.push_back(ct.delta);
+        L.push_back(ct.initialContractStates.L);
+        Ap.push_back(ct.initialContractStates.Ap);
+        term.push_back(ct.T.numerator());
+    }
+
+    unsigned size() const { return g.size(); }
+
+    ContractTraits policy(unsigned i) const {
+        return ContractTraits(g[i],y[i],delta[i],L[i],Ap[i]
+                             ,rational(1),rational(term[i]));
+    }
+
+    std::vector<double> g, y, delta, L, Ap;
+    std::vector<unsigned> term;
+};
+
+// Grid widths of the compression, a width <= 0 groups only equal values
+struct CompressionTraits {
+    CompressionTraits(double gg=0.0025, double yy=0.05, double ddelta=0.05
+                     ,double reserveQuotient=0.02)
+        : gStep(gg), yStep(yy), deltaStep(ddelta)
+         ,reserveQuotientStep(reserveQuotient) {}
+    double gStep, yStep, deltaStep, reserveQuotientStep;
+};
+
+// Per term a ContractPortfolio of model points. Policy i is represented by
+// model point point[i] of portfolios[term[i]] and gets the share weight[i]
+// (its part of the model point's L) of its value.
+struct ModelPoints {
+    std::map<unsigned, ContractPortfolio> portfolios;
+    std::vector<unsigned> point;
+    std::vector<double> weight;
+
+    unsigned size() const {
+        unsigned n = 0;
+        for (std::map<unsigned, ContractPortfolio>::const_iterator
+                it = portfolios.begin(); it != portfolios.end(); ++it)
+            n += it->second.size();
+        return n;
+    }
+};
+
+typedef std::map<unsigned, Array<ValueVector> > ModelPointValues;
+
+namespace detail {
+
+    inline long long gridCell(double x, double step) {
+        if (step <= 0.0)
+            return (long long)std::floor(x*1E12 + 0.5);
+        return (long long)std::floor(x/step + 0.5);
+    }
+
+}
+
+ModelPoints compressPolicyBook(const PolicyBook& book
+                              ,const CompressionTraits& ct) {
+    typedef boost::tuple<unsigned, long long, long long, long long, long long>
+        Cell;
+    std::map<Cell, unsigned> cells;
+    // sums over the cells of L, L*g, L*y, L*delta and Ap, by term
+    std::map<unsigned, std::vector<std::vector<double> > > sums;
+
+    ModelPoints mp;
+    mp.point.resize(book.size());
+    mp.weight.resize(book.size());
+    for (unsigned i=0; i<book.size(); ++i) {
+        Cell cell(book.term[i]
+                 ,detail::gridCell(book.g[i],ct.gStep)
+                 ,detail::gridCell(book.y[i],ct.yStep)
+                 ,detail::gridCell(book.delta[i],ct.deltaStep)
+                 ,detail::gridCell(book.Ap[i]/book.L[i]-1.0
+                                  ,ct.reserveQuotientStep));
+        std::vector<std::vector<double> >& termSums = sums[book.term[i]];
+        std::map<Cell, unsigned>::iterator it = cells.find(cell);
+        if (it == cells.end()) {
+            it = cells.insert(std::make_pair(cell,(unsigned)termSums.size())).first;
+            termSums.push_back(std::vector<double>(5,0.0));
+        }
+        std::vector<double>& s = termSums[it->second];
+        s[0] += book.L[i];
+        s[1] += book.L[i]*book.g[i];
+        s[2] += book.L[i]*book.y[i];
+        s[3] += book.L[i]*book.delta[i];
+        s[4] += book.Ap[i];
+        mp.point[i] = it->second;
+    }
+
+    for (std::map<unsigned, std::vector<std::vector<double> > >::const_iterator
+            it = sums.begin(); it != sums.end(); ++it) {
+        ContractPortfolio& portfolio = mp.portfolios[it->first];
+        portfolio = ContractPortfolio(rational(1),rational(it->first));
+        for (unsigned k=0; k<it->second.size(); ++k) {
+            const std::vector<double>& s = it->second[k];
+            portfolio.add(ContractTraits(s[1]/s[0],s[2]/s[0],s[3]/s[0]
+                                        ,s[0],s[4]
+                                        ,rational(1),rational(it->first)));
+        }
+    }
+    for (unsigned i=0; i<book.size(); ++i)
+        mp.weight[i] = book.L[i]
+                     / mp.portfolios[book.term[i]].L[mp.point[i]];
+    return mp;
+}
+
+// Values at 0 of the model points, portfolioMC per term on the asset
+// grid of assetPathTraits cut at the term
+ModelPointValues valueModelPoints(const ModelPoints& mp
+                                 ,unsigned nSamples
+                                 ,unsigned seed
+                                 ,const ModelDynamics& riskNeutralDynamics
+                                 ,AssetPathTraits assetPathTraits) {
+    ModelPointValues values;
+    for (std::map<unsigned, ContractPortfolio>::const_iterator
+            it = mp.portfolios.begin(); it != mp.portfolios.end(); ++it) {
+        assetPathTraits.T = rational(it->first);
+        values[it->first] = portfolioMC(nSamples,seed,riskNeutralDynamics
+                                       ,assetPathTraits,it->second);
+    }
+    return values;
+}
+
+ValueVector modelPointTotal(const ModelPointValues& values) {
+    ValueVector total;
+    for (ModelPointValues::const_iterator it = values.begin();
+            it != values.end(); ++it)
+        total += portfolioTotal(it->second);
+    return total;
+}
+
+// The value of policy i of the book the model points were made from
+ValueVector policyValue(const ModelPoints& mp, const ModelPointValues& values
+                       ,const PolicyBook& book, unsigned i) {
+    return values.find(book.term[i])->second[mp.point[i]] * mp.weight[i];
+}
+
+// Compression error on a sample of the book (every k-th policy), valued
+// exactly on the same scenarios as the model points, so the errors are
+// those of the compression, not of the MC
+struct CompressionDiagnostics {
+    unsigned nPolicies, nModelPoints, nSampled;
+    // totals over the sample
+    ValueVector sampleExact, sampleCompressed;
+    // of the sample totals, componentwise
+    ValueVector relativeError;
+    // over the sampled policies of max |compressed - exact| / max |exact|
+    // of the components
+    double meanPolicyError, maxPolicyError;
+};
+
+CompressionDiagnostics diagnoseCompression(
+        const PolicyBook& book
+       ,const ModelPoints& mp
+       ,const ModelPointValues& values
+       ,unsigned sampleSize
+       ,unsigned nSamples
+       ,unsigned seed
+       ,const ModelDynamics& riskNeutralDynamics
+       ,const AssetPathTraits& assetPathTraits) {
+    CompressionDiagnostics diag;
+    diag.nPolicies = book.size();
+    diag.nModelPoints = mp.size();
+
+    unsigned step = std::max(book.size() / std::max(sampleSize,1u), 1u);
+    PolicyBook sample;
+    std::vector<unsigned> sampled;
+    for (unsigned i=0; i<book.size(); i+=step) {
+        sample.add(book.policy(i));
+        sampled.push_back(i);
+    }
+    diag.nSampled = sampled.size();
+
+    // the sample is valued as model points of its own, one per policy
+    ModelPoints exact = compressPolicyBook(sample
+                                          ,CompressionTraits(0.0,0.0,0.0,0.0));
+    ModelPointValues exactValues = valueModelPoints(exact,nSamples,seed
+                                                   ,riskNeutralDynamics
+                                                   ,assetPathTraits);
+    double sumError = 0.0;
+    diag.maxPolicyError = 0.0;
+    for (unsigned k=0; k<sampled.size(); ++k) {
+        ValueVector e = exactValues[sample.term[k]][exact.point[k]]
+                      * exact.weight[k];
+        ValueVector c = policyValue(mp,values,book,sampled[k]);
+        diag.sampleExact += e;
+        diag.sampleCompressed += c;
+        double scale = maxComponent(abs(e));
+        double error = scale > 0.0 ? maxComponent(abs(c-e)) / scale : 0.0;
+        sumError += error;
+        diag.maxPolicyError = std::max(diag.maxPolicyError,error);
+    }
+    diag.meanPolicyError = sampled.empty() ? 0.0 : sumError / sampled.size();
+
+    double* pExact[] = { &diag.sampleExact.V, &diag.sampleExact.C
+                       , &diag.sampleExact.D, &diag.sampleExact.Res
+                       , &diag.sampleExact.Surr };
+    double* pCompressed[] = { &diag.sampleCompressed.V, &diag.sampleCompressed.C
+                            , &diag.sampleCompressed.D, &diag.sampleCompressed.Res
+                            , &diag.sampleCompressed.Surr };
+    double* pError[] = { &diag.relativeError.V, &diag.relativeError.C
+                       , &diag.relativeError.D, &diag.relativeError.Res
+                       , &diag.relativeError.Surr };
+    for (unsigned k=0; k<5; ++k)
+        *pError[k] = (*pExact[k] != 0.0)
+                   ? (*pCompressed[k] - *pExact[k]) / std::fabs(*pExact[k])
+                   : 0.0;
+    return diag;
+}
+
+}
+
+#endif
@@ -13,6 +13,11 @@ namespace QuantLibExt {
 
 typedef boost::rational<int> rational;
 
+// Times on a path are kept as integer ticks: the time of point i is
+// (t0Ticks + i*dtTicks) / timeDenominator. Time lookups and comparisons
+// work on these integers, rationals are only used at the interface.
+typedef long long PathTicks;
+
 
 template<class Type>
 class Path {
@@ -33,11 +38,21 @@ class Path {
               p_parent_(p_parent) {}
 
         rational t() const { 
-            return (p_node_-&(*(p_parent_->begin())))*(p_parent_->dt()); 
+            return rational(int(ticks()),int(timeDenominator()));
         }
         rational dt() const {
             return p_parent_->dt(); 
         }
+        // Position on the path and time in ticks of the path
+        int index() const {
+            return p_node_ - &(p_parent_->pathPoints_[0]);
+        }
+        PathTicks ticks() const {
+            return p_parent_->t0Ticks_ + index()*p_parent_->dtTicks_;
+        }
+        PathTicks timeDenominator() const {
+            return p_parent_->timeDenominator_;
+        }
 
       private: 
         // Everything Boost's iterator facade needs
@@ -78,6 +93,14 @@ class Path {
         return iterator(&pathPoints_[firstIndexAfterTime_(t)],this); }
 
     Path(rational dt, rational T, rational t0=rational(0,1));
+    // Path with the single point t0 = T = 0, to be given its grid by reset()
+    Path() : dt_(1,1), t0_(0,1), T_(0,1)
+            ,timeDenominator_(1), t0Ticks_(0), dtTicks_(1), pathPoints_(1) {}
+
+    // Puts the path on a new time grid. The storage is kept (the values
+    // are not reset), so a scratch path that is reset to grids of at most
+    // its largest size so far does not allocate.
+    void reset(rational dt, rational T, rational t0=rational(0,1));
 
     unsigned size() const { return pathPoints_.size(); }
     rational t0() const { return t0_; }
@@ -85,8 +108,9 @@ class Path {
     rational T() const { return T_; }
 
     bool hasTimepointAt(const rational& t) const {
-        return (t <= T_) && (t >= t0_) 
-            && (((t - t0_)/dt_).denominator() == 1);
+        PathTicks steps = stepsSinceT0_(t), div = stepDivisor_(t);
+        return (steps >= 0) && (steps % div == 0)
+            && (steps / div < PathTicks(pathPoints_.size()));
     }
 
     Type operator[](unsigned i) const {
@@ -106,44 +130,82 @@ class Path {
     unsigned lastIndexOnOrBeforeTime_(const rational& t) const;
     unsigned firstIndexAfterTime_(const rational& t) const;
 
+    // (t - t0)/dt == stepsSinceT0_(t) / stepDivisor_(t)
+    PathTicks stepsSinceT0_(const rational& t) const {
+        return PathTicks(t.numerator())*timeDenominator_ 
+             - t0Ticks_*t.denominator();
+    }
+    PathTicks stepDivisor_(const rational& t) const {
+        return dtTicks_*t.denominator();
+    }
+    void setGrid_(rational dt, rational T, rational t0);
+
     rational dt_, t0_, T_;
+    PathTicks timeDenominator_, t0Ticks_, dtTicks_;
     std::vector<Type> pathPoints_;
 };
 
+// t(a) < t(b) for iterators on any two paths
+template <class Iterator1, class Iterator2>
+inline bool isEarlier(const Iterator1& a, const Iterator2& b) {
+    return a.ticks()*b.timeDenominator() < b.ticks()*a.timeDenominator();
+}
+
 template <class Type>
 Path<Type>::Path(rational dt, rational T, rational t0)
-: dt_(dt), t0_(t0), T_(T)
 {
-    QL_REQUIRE( ((T_ - t0_)/dt_).denominator() == 1 
-            ,"Path: T - t0 not divisible by dt");
+    setGrid_(dt,T,t0);
     pathPoints_ = std::vector<Type>( ((T_ - t0_) / dt_).numerator() + 1);
 }
 
+template <class Type>
+void Path<Type>::reset(rational dt, rational T, rational t0)
+{
+    setGrid_(dt,T,t0);
+    pathPoints_.resize(((T_ - t0_) / dt_).numerator() + 1);
+}
+
+template <class Type>
+void Path<Type>::setGrid_(rational dt, rational T, rational t0)
+{
+    QL_REQUIRE( ((T - t0)/dt).denominator() == 1 
+            ,"Path: T - t0 not divisible by dt");
+    dt_ = dt;
+    t0_ = t0;
+    T_  = T;
+    timeDenominator_ = PathTicks(dt_.denominator())*t0_.denominator();
+    t0Ticks_         = PathTicks(t0_.numerator())*dt_.denominator();
+    dtTicks_         = PathTicks(dt_.numerator())*t0_.denominator();
+}
+
 template <class Type>
 inline unsigned Path<Type>::indexAtTime_(const rational& t) const {
-    rational index = (t - t0_) / dt_;
-    QL_REQUIRE(index.denominator() == 1
+    PathTicks steps = stepsSinceT0_(t), div = stepDivisor_(t);
+    QL_REQUIRE(steps % div == 0
             ,"Path: No point on path at time t");
-    QL_REQUIRE( (t >= t0_) && (t <= T_)
+    QL_REQUIRE( (steps >= 0) && (steps / div < PathTicks(pathPoints_.size()))
             ,"Path: Illegal t: t out of bounds");
-    return index.numerator();
+    return unsigned(steps / div);
 }
 
 template <class Type>
 inline unsigned Path<Type>::lastIndexOnOrBeforeTime_(const rational& t) const {
-    QL_REQUIRE((t >= t0_)
+    PathTicks steps = stepsSinceT0_(t);
+    QL_REQUIRE((steps >= 0)
         ,"Path: Illegal t: t < t0 when querying index / iterator before or on t");
-    rational index = (t-t0_) / dt_;
-    return std::min(boost::rational_cast<unsigned>( (t-t0_) / dt_)
-                         ,unsigned(pathPoints_.size()-1));
+    return unsigned(std::min(steps / stepDivisor_(t)
+                            ,PathTicks(pathPoints_.size()-1)));
 }
 
 template <class Type>
 inline unsigned Path<Type>::firstIndexAfterTime_(const rational& t) const {
-    QL_REQUIRE( (t < T_)
+    PathTicks steps = stepsSinceT0_(t), div = stepDivisor_(t);
+    QL_REQUIRE( (steps < PathTicks(pathPoints_.size()-1)*div)
         ,"Path: Illegal t: t >= T when querying index / iterator after t");
-    return unsigned(std::max(
-            int(std::floor(boost::rational_cast<double>((t-t0_)/dt_))+1),0));
+    PathTicks index = steps / div;
+    if (steps % div != 0 && steps < 0)
+        --index;
+    return unsigned(std::max(index+1,PathTicks(0)));
 }
 
 }
@@ -0,0 +1,314 @@
+#ifndef ql_extensions__monte_carlo__pathwise_deltas_hpp__
+#define ql_extensions__monte_carlo__pathwise_deltas_hpp__
+
+#include <cmath>
+
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+
+#include "../instruments/termfixinsurance/valuevector.hpp"
+
+#include "path.hpp"
+#include "assets.hpp"
+#include "variates.hpp"
+#include "dynamics.hpp"
+#include "insurance_contract.hpp"
+
+namespace QuantLibExt {
+
+/*
+ * Pathwise deltas: instead of resimulating the path with bumped S(t) and
+ * r(t) the derivatives w.r.t. S(t) and r(t) are carried along the path
+ * (forward mode differentiation) and through the contract states.
+ * One simulation per scenario gives value, underlyings and deltas.
+ */
+
+// Asset path after t simulated from the variates, together with the
+// derivatives w.r.t. S(t) and r(t), written into tangentPath. Up to and
+// including t the tangents are zero since the contract sees the original
+// value at t. The steps are dynamics.withTangents, the same steps as
+// those of the asset paths, e.g. of a StaticDynamics.
+template <class Dynamics>
+void makeTangentPathFromVariates(
+        const rational& t
+       ,const Path<Assets>& assetPath
+       ,const Path<Variates>& variates
+       ,const Dynamics& dynamics
+       ,Path<AssetTangents>& tangentPath)
+{
+    tangentPath.reset(assetPath.dt(),assetPath.T(),assetPath.t0());
+    Assets zero(0.0,0.0,0.0);
+    Path<AssetTangents>::iterator it = tangentPath.begin();
+    Path<Assets>::const_iterator iaEnd = assetPath.iteratorAtTime(t)+1;
+    for (Path<Assets>::const_iterator ia = assetPath.begin();
+            ia != iaEnd; ++ia, ++it)
+        *it = AssetTangents(*ia,zero,zero);
+
+    AssetTangents seed(assetPath[t],Assets(1.0,0.0,0.0),Assets(0.0,1.0,0.0));
+    Path<Variates>::const_iterator iv = variates.iteratorAtTime(t)+1;
+    double dt = boost::rational_cast<double>(variates.dt());
+    if (it != tangentPath.end()) {
+        *it = dynamics.withTangents(*iv,seed,dt);
+        for (++it, ++iv; it != tangentPath.end(); ++it, ++iv)
+            *it = dynamics.withTangents(*iv,*(it-1),dt);
+    }
+}
+
+template <class Dynamics>
+Path<AssetTangents> makeTangentPathFromVariates(
+        const rational& t
+       ,const Path<Assets>& assetPath
+       ,const Path<Variates>& variates
+       ,const Dynamics& dynamics)
+{
+    Path<AssetTangents> tangentPath;
+    makeTangentPathFromVariates(t,assetPath,variates,dynamics,tangentPath);
+    return tangentPath;
+}
+
+// Derivative of one period of rollContractStates at the branches it took.
+// x, L0, Ap0 and res_quot0 are the stock return and the states the period
+// started from, L1 and Ap1 the states it ended with. dx is the derivative
+// of x, dL1, dAp and dRes_quot go in as the derivatives of the states the
+// period started from and come out as those of the new states.
+inline void rollContractStateTangents(double x, double dx
+                                     ,const ContractTraits& ct
+                                     ,double L0, double Ap0, double res_quot0
+                                     ,double L1, double Ap1
+                                     ,const ContractRollBranches& b
+                                     ,double& dL1, double& dAp
+                                     ,double& dRes_quot
+                                     ,double& dC, double& dD) {
+    double cond1 = b.cond1 ? 1.0 : 0.0;
+    double cond2 = 1-cond1;
+    double cond3 = b.cond3 ? 1.0 : 0.0;
+
+    double dAm = dAp*(1.0+x) + Ap0*dx;
+    double dL0 = dL1;
+    double dGrowth = ct.y*(dx*(1.0+res_quot0) + x*dRes_quot);
+    dL1 = b.cond1
+        ? ct.delta*dGrowth*L0 + (1.0 + ct.delta*ct.y*x*(1.0+res_quot0))*dL0
+        : (1.0 + ct.g)*dL0;
+    dD  = (1-ct.delta)*ct.y*(dAp*x + Ap0*dx)*cond1
+        + (dGrowth*L0 + (ct.y*x*(1+res_quot0)-ct.g)*dL0)*cond2*cond3;
+    dAp = b.apIsAm ? dAm - dD : dL1;
+    dC  = b.cPositive ? dL1 - dAm : 0.0;
+    dRes_quot = dAp/L1 - Ap1*dL1/(L1*L1);
+}
+
+struct PathwiseValue {
+    ValueVector value, dS, dr;
+};
+
+// Value of the contract at t and its derivatives w.r.t. S(t) and r(t).
+// Does the same as valueContractFromPath in a single pass: the contract
+// states are rolled forward from the last anniversary with
+// rollContractStates, differentiated with rollContractStateTangents, and
+// the payoffs are discounted as they occur.
+PathwiseValue pathwiseContractValue(
+        const rational& t
+       ,const Path<AssetTangents>& tangentPath
+       ,const Path<ContractStates>& contractStatePath
+       ,const ContractTraits& ct)
+{
+    PathwiseValue result;
+    ConstContrStatePathIter iCS = contractStatePath.lastIteratorOnOrBeforeTime(t);
+    if (iCS.t() == t) {
+        if (iCS == contractStatePath.begin()) {
+            result.value.Res = (-1)*(iCS->Ap - iCS->L);
+        } else {
+            result.value.C = iCS->c;
+            result.value.D = iCS->d;
+        }
+    }
+
+    Path<AssetTangents>::const_iterator iAP = tangentPath.iteratorAtTime(iCS.t());
+    Path<AssetTangents>::const_iterator iDisc = tangentPath.iteratorAtTime(t);
+
+    // index 0: derivative w.r.t. S(t), index 1: w.r.t. r(t)
+    double L1 = iCS->L, Ap = iCS->Ap;
+    double dL1[2] = {0.0, 0.0}, dAp[2] = {0.0, 0.0};
+    double res_quot = (Ap - L1)/L1, dRes_quot[2] = {0.0, 0.0};
+    double S1 = iAP->value.S, dS1[2] = {iAP->dS.S, iAP->dr.S};
+    double sumIntR = 0.0, dSumIntR[2] = {0.0, 0.0};
+
+    for (++iCS; iCS != contractStatePath.end(); ++iCS) {
+
+        double S0 = S1, dS0[2] = {dS1[0], dS1[1]};
+        while ( isEarlier(iAP,iCS) ) {
+            ++iAP;
+        }
+        S1 = iAP->value.S;
+        dS1[0] = iAP->dS.S;
+        dS1[1] = iAP->dr.S;
+
+        double x = S1 / S0 - 1.0;
+        double L0 = L1, Ap0 = Ap, res_quot0 = res_quot;
+        double c, d;
+        ContractRollBranches branches;
+        rollContractStates(x,ct,L1,Ap,res_quot,c,d,&branches);
+
+        double dC[2], dD[2];
+        for (unsigned k=0; k<2; ++k) {
+            double dx = dS1[k]/S0 - S1*dS0[k]/(S0*S0);
+            rollContractStateTangents(x,dx,ct,L0,Ap0,res_quot0,L1,Ap
+                                     ,branches,dL1[k],dAp[k],dRes_quot[k]
+                                     ,dC[k],dD[k]);
+        }
+
+        while (isEarlier(iDisc,iCS)) {
+            ++iDisc;
+            sumIntR += iDisc->value.intR;
+            dSumIntR[0] += iDisc->dS.intR;
+            dSumIntR[1] += iDisc->dr.intR;
+        }
+        double discount = std::exp(-sumIntR);
+
+        ValueVector payoff(0.0,c,d), dPayoff[2];
+        for (unsigned k=0; k<2; ++k)
+            dPayoff[k] = ValueVector(0.0,dC[k],dD[k]);
+        if (iCS+1 == contractStatePath.end()) {
+            payoff.V   = L1;
+            payoff.Res = Ap-L1;
+            for (unsigned k=0; k<2; ++k) {
+                dPayoff[k].V   = dL1[k];
+                dPayoff[k].Res = dAp[k]-dL1[k];
+            }
+        }
+
+        result.value += payoff * discount;
+        result.dS    += dPayoff[0]*discount - payoff*(discount*dSumIntR[0]);
+        result.dr    += dPayoff[1]*discount - payoff*(discount*dSumIntR[1]);
+    }
+    return result;
+}
+
+// Pathwise counterpart of priceContractFromVariates. The deltas are
+// dV/dS(t) and (dV/dr(t)) / (dZCB/dr(t)), the limits of the finite
+// differences computed by computeStockBondFDDeltaFromVariates. If
+// analyticBondDr is not zero it is dZCB/dr(t) of the analytic bond.
+// tangentPath is scratch space.
+template <class Dynamics>
+ResultT pathwisePriceContractFromVariates
+                        (const rational& t
+                        ,const Path<Assets>& assetPath
+                        ,const Path<Variates>& variates
+                        ,const Path<ContractStates>& contractStatePath
+                        ,const ContractTraits& contractTraits
+                        ,const Dynamics& dynamics
+                        ,double analyticBondDr
+                        ,Path<AssetTangents>& tangentPath)
+{
+    makeTangentPathFromVariates(t,assetPath,variates,dynamics,tangentPath);
+    PathwiseValue pv
+        = pathwiseContractValue(t,tangentPath,contractStatePath,contractTraits);
+
+    double sumIntR = 0.0, dSumIntR = 0.0;
+    for (Path<AssetTangents>::iterator it = tangentPath.iteratorAtTime(t)+1;
+            it != tangentPath.end(); ++it) {
+        sumIntR  += it->value.intR;
+        dSumIntR += it->dr.intR;
+    }
+    double zcb = std::exp(-sumIntR);
+
+    ResultT result;
+    result.value = pv.value;
+    result.underlyings = Array<>(2);
+    result.underlyings[0] = tangentPath[t].value.S;
+    result.underlyings[1] = zcb;
+    result.deltas = Array<ValueVector>(2);
+    result.deltas[0] = pv.dS;
+    double dZcb = analyticBondDr != 0.0 ? analyticBondDr : -zcb*dSumIntR;
+    // as computeFDDeltaFromVariates if the bounds of the short rate cut
+    // the derivative of the bond
+    if (dZcb != 0.0)
+        result.deltas[1] = pv.dr / dZcb;
+    return result;
+}
+
+template <class Dynamics>
+DeltaT pathwiseDeltasFromVariates(const rational& t
+                                 ,const Path<Assets>& assetPath
+                                 ,const Path<Variates>& variates
+                                 ,const Path<ContractStates>& contractStatePath
+                                 ,const ContractTraits& contractTraits
+                                 ,const Dynamics& dynamics
+                                 ,double analyticBondDr
+                                 ,Path<AssetTangents>& tangentPath)
+{
+    return pathwisePriceContractFromVariates(t,assetPath,variates
+                    ,contractStatePath,contractTraits,dynamics
+                    ,analyticBondDr,tangentPath).deltas;
+}
+
+// Same as StaticInsContrMCPricingModelFactory, but the pricing models
+// compute the deltas pathwise, on the same steps of D (withTangents) as
+// the asset paths. Of the variance reduction only the antithetic
+// scenarios are used.
+template <class D>
+class PathwiseInsContrMCPricingModelFactory : public InsContrMCPricingModelFactory {
+public:
+  PathwiseInsContrMCPricingModelFactory(unsigned nScenarios,
+                                        rational hedgePathDt,
+                                        const D& dynamics,
+                                        ContractTraits contractTraits,
+                                        const InnerMCTraits& innerMC
+                                          =InnerMCTraits())
+    : InsContrMCPricingModelFactory(nScenarios, hedgePathDt,
+                                    ModelDynamics(dynamics), contractTraits,
+                                    0.0, 0.0, innerMC),
+      staticDynamics_(dynamics) {}
+
+  virtual PricingModel<ValT,UnderlT,DeltaT>* make(const rational&,
+                                                  const Path<Assets>&,
+                                                  const Path<ContractStates>&,
+                                                  unsigned outerPath=0) const;
+
+protected:
+  StaticDynamics<D> staticDynamics_;
+};
+
+template <class D>
+PricingModel<ValT,UnderlT,DeltaT>* PathwiseInsContrMCPricingModelFactory<D>::make(
+    const rational& t, const Path<Assets>& assetPath,
+    const Path<ContractStates>& contractStatePath, unsigned outerPath) const
+{
+  typedef StaticDynamics<D> Dynamics;
+
+  if (t == contractStatePath.T())
+    return new InsContrEndPointPricingModel(assetPath[t],contractStatePath[t]);
+
+  Path<Assets> hedgePath = makeHedgePath(t, assetPath);
+
+  boost::function<ValT (const ScenT&)> contractPricer
+    = boost::bind(valueContractFromVariates<Dynamics>, t, hedgePath,
+                  _1, ContractValuationWorkspace(contractStatePath),
+                  contractTraits_, staticDynamics_);
+
+  boost::function<UnderlT (const ScenT&)> underlyingsPricer
+    = boost::bind(underlyingsFromVariates<Dynamics>, t, hedgePath, _1,
+                  staticDynamics_);
+
+  double bondPrice = 0.0, bondDr = 0.0;
+  bool withBond = analyticBond(staticDynamics_, t, hedgePath, bondPrice, bondDr);
+
+  boost::function<DeltaT (const ScenT&)> deltaPricer
+    = boost::bind(pathwiseDeltasFromVariates<Dynamics>, t, hedgePath, _1,
+                  contractStatePath, contractTraits_, staticDynamics_,
+                  bondDr, Path<AssetTangents>());
+
+  boost::function<ResultT (const ScenT&)> resultPricer
+    = boost::bind(pathwisePriceContractFromVariates<Dynamics>, t, hedgePath,
+                  _1, contractStatePath, contractTraits_, staticDynamics_,
+                  bondDr, Path<AssetTangents>());
+
+  PricingModel<ValT,UnderlT,DeltaT>* model
+    = makeMCPricingModel(t, hedgePath, outerPath, contractPricer,
+                         underlyingsPricer, deltaPricer, resultPricer);
+  if (withBond)
+    return withAnalyticUnderlyings(model, t, hedgePath, bondPrice);
+  return model;
+}
+}
+
+#endif
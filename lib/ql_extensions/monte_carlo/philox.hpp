@@ -0,0 +1,167 @@
+#ifndef ql_extensions__monte_carlo__philox_hpp__
+#define ql_extensions__monte_carlo__philox_hpp__
+
+#include <cmath>
+#include <algorithm>
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+
+#include "path.hpp"
+#include "variates.hpp"
+
+namespace QuantLibExt {
+
+// Philox4x32-10 (Salmon, Moraes, Dror, Shaw: Parallel random numbers: as
+// easy as 1, 2, 3. SC11), a counter based generator: the output for a
+// 128 bit counter is a keyed bijection of it, so every random number can
+// be computed directly from its address, on any thread, in any order.
+class Philox4x32 {
+  public:
+    typedef boost::uint32_t Word;
+
+    Philox4x32(Word key0, Word key1) {
+        key_[0] = key0;
+        key_[1] = key1;
+    }
+
+    void operator()(const Word counter[4], Word out[4]) const {
+        Word c[4] = { counter[0], counter[1], counter[2], counter[3] };
+        Word k[2] = { key_[0], key_[1] };
+        for (unsigned round=0; round<10; ++round) {
+            if (round > 0) {
+                k[0] += 0x9E3779B9u;
+                k[1] += 0xBB67AE85u;
+            }
+            boost::uint64_t p0 = boost::uint64_t(0xD2511F53u)*c[0];
+            boost::uint64_t p1 = boost::uint64_t(0xCD9E8D57u)*c[2];
+            Word c1 = c[1], c3 = c[3];
+            c[0] = Word(p1 >> 32) ^ c1 ^ k[0];
+            c[1] = Word(p1);
+            c[2] = Word(p0 >> 32) ^ c3 ^ k[1];
+            c[3] = Word(p0);
+        }
+        std::copy(c,c+4,out);
+    }
+
+  private:
+    Word key_[2];
+};
+
+// Variates addressed by (outer path, hedge date, inner scenario, time
+// step), the four words of the Philox counter, the seed is the key.
+// Each counter gives two uniforms with 53 bits, turned into W1 and W2 by
+// Box-Muller.
+class PhiloxVariates {
+  public:
+    // hedge date address of the outer (real world) paths themselves
+    static const unsigned outerPathDate = 0xFFFFFFFFu;
+
+    PhiloxVariates(unsigned seed) : philox_(seed,0x3C6EF372u) {}
+
+    Variates operator()(unsigned outerPath, unsigned hedgeDate
+                       ,unsigned scenario, unsigned step) const {
+        Philox4x32::Word counter[4] = { step, scenario, hedgeDate, outerPath };
+        Philox4x32::Word out[4];
+        philox_(counter,out);
+        double u1 = uniform(out[0],out[1]);
+        double u2 = uniform(out[2],out[3]);
+        double radius = std::sqrt(-2.0*std::log(u1));
+        double angle = 6.283185307179586477*u2;
+        Variates v;
+        v.W1 = radius*std::cos(angle);
+        v.W2 = radius*std::sin(angle);
+        return v;
+    }
+
+  private:
+    // in (0,1)
+    static double uniform(Philox4x32::Word hi, Philox4x32::Word lo) {
+        boost::uint64_t bits = ((boost::uint64_t(hi) << 32) | lo) >> 11;
+        return (double(bits) + 0.5) / 9007199254740992.0;
+    }
+
+    Philox4x32 philox_;
+};
+
+// Inner scenarios of one (outer path, hedge date): scenario i has the
+// address (outerPath, hedgeDate, firstScenario+i), its time steps are
+// counted from time 0, so they do not depend on where the grid starts.
+class PhiloxScenarioGenerator {
+  public:
+    PhiloxScenarioGenerator(const rational& dt, const rational& T
+                           ,const rational& t, unsigned seed
+                           ,unsigned outerPath, unsigned hedgeDate
+                           ,unsigned firstScenario=0)
+        : dt_(dt), T_(T), t_(t), variates_(seed)
+         ,outerPath_(outerPath), hedgeDate_(hedgeDate)
+         ,scenario_(firstScenario), firstStep_((t/dt).numerator()) {}
+
+    Path<Variates> operator()() {
+        Path<Variates> scenario;
+        (*this)(scenario);
+        return scenario;
+    }
+    void operator()(Path<Variates>& scenario) {
+        scenario.reset(dt_,T_,t_);
+        unsigned step = firstStep_;
+        for (Path<Variates>::iterator it=scenario.begin();
+                it != scenario.end(); ++it, ++step)
+            *it = variates_(outerPath_,hedgeDate_,scenario_,step);
+        ++scenario_;
+    }
+
+  protected:
+    rational dt_, T_, t_;
+    PhiloxVariates variates_;
+    unsigned outerPath_, hedgeDate_, scenario_, firstStep_;
+};
+
+// Blocks of a blocked MC run: block b starts at the first scenario of its
+// block (as MCBlockSum splits them), so the scenarios are the same as with
+// one PhiloxScenarioGenerator, whatever nBlocks and nThreads are.
+class PhiloxBlockScenarioGenerator {
+  public:
+    PhiloxBlockScenarioGenerator(const rational& dt, const rational& T
+                                ,const rational& t, unsigned seed
+                                ,unsigned outerPath, unsigned hedgeDate
+                                ,unsigned nScenarios, unsigned nBlocks)
+        : dt_(dt), T_(T), t_(t), seed_(seed)
+         ,outerPath_(outerPath), hedgeDate_(hedgeDate)
+         ,nScenarios_(nScenarios)
+         ,nBlocks_(std::max(std::min(nBlocks,nScenarios),1u)) {}
+
+    boost::function<void (Path<Variates>&)> operator()(unsigned block) const {
+        unsigned first = (unsigned)(((unsigned long long)block*nScenarios_)/nBlocks_);
+        return PhiloxScenarioGenerator(dt_,T_,t_,seed_,outerPath_,hedgeDate_
+                                      ,first);
+    }
+
+  protected:
+    rational dt_, T_, t_;
+    unsigned seed_, outerPath_, hedgeDate_, nScenarios_, nBlocks_;
+};
+
+// Sequence of normals for an outer path (hedge date address outerPathDate),
+// a drop-in for NormalRandomNumberGenerator
+class PhiloxNormalSequence {
+  public:
+    PhiloxNormalSequence(unsigned seed, unsigned outerPath)
+        : variates_(seed), outerPath_(outerPath), index_(0) {}
+
+    double operator()() {
+        if (index_ % 2 == 0)
+            current_ = variates_(outerPath_,PhiloxVariates::outerPathDate
+                                ,0,index_/2);
+        return (index_++ % 2 == 0) ? current_.W1 : current_.W2;
+    }
+
+  private:
+    PhiloxVariates variates_;
+    unsigned outerPath_, index_;
+    Variates current_;
+};
+
+}
+
+#endif
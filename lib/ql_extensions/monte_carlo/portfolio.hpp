@@ -0,0 +1,219 @@
+#ifndef ql_extensions__monte_carlo__portfolio_hpp__
+#define ql_extensions__monte_carlo__portfolio_hpp__
+
+#include <vector>
+
+#include "../instruments/termfixinsurance/valuevector.hpp"
+#include "../math/array.hpp"
+
+#include "path.hpp"
+#include "assets.hpp"
+#include "variates.hpp"
+#include "discount_factors.hpp"
+#include "insurance_contract.hpp"
+
+namespace QuantLibExt {
+
+/*
+ * Portfolios: many contracts with different guarantees valued on the same
+ * asset paths. The asset path is walked once, at every contract date the
+ * stock return is the same for all contracts and the contract states are
+ * rolled forward in an inner loop over arrays (structure of arrays).
+ */
+
+// Contracts that differ in guarantee (g, y, delta) and initial states but
+// share the contract grid (dt, T). Contract i is element i of every array.
+struct ContractPortfolio {
+    ContractPortfolio() {}
+    ContractPortfolio(rational ddt, rational TT) : dt(ddt), T(TT) {}
+
+    // the first contract sets the grid if none was given
+    void add(const ContractTraits& ct) {
+        if (size() == 0 && dt == rational()) {
+            dt = ct.dt;
+            T  = ct.T;
+        }
+        QL_REQUIRE(ct.dt == dt && ct.T == T,
+            "ContractPortfolio: the contracts must share dt and T");
+        g.push_back(ct.g);
+        y.push_back(ct.y);
+        delta.push_back(ct.delta);
+        L.push_back(ct.initialContractStates.L);
+        Ap.push_back(ct.initialContractStates.Ap);
+    }
+
+    unsigned size() const { return g.size(); }
+
+    ContractTraits contract(unsigned i) const {
+        return ContractTraits(g[i],y[i],delta[i],L[i],Ap[i],dt,T);
+    }
+
+    std::vector<double> g, y, delta;
+    // initial contract states
+    std::vector<double> L, Ap;
+    rational dt, T;
+};
+
+// Contract states of all contracts of a portfolio at one contract date
+struct PortfolioStates {
+    PortfolioStates() {}
+    explicit PortfolioStates(unsigned n) : L(n), Ap(n), c(n,0.0), d(n,0.0) {}
+    std::vector<double> L, Ap, c, d;
+};
+
+// States at the start, as given by the contracts
+PortfolioStates initialPortfolioStates(const ContractPortfolio& portfolio) {
+    PortfolioStates states(portfolio.size());
+    states.L  = portfolio.L;
+    states.Ap = portfolio.Ap;
+    return states;
+}
+
+Path<PortfolioStates> makePortfolioStatePath(
+        const Path<Assets>& assetPath
+       ,const ContractPortfolio& portfolio)
+{
+    unsigned n = portfolio.size();
+    Path<PortfolioStates> statePath(portfolio.dt,portfolio.T);
+    statePath[0] = initialPortfolioStates(portfolio);
+
+    std::vector<double> L1 = portfolio.L, Ap = portfolio.Ap, resQuot(n);
+    for (unsigned j=0; j<n; ++j)
+        resQuot[j] = (Ap[j] - L1[j])/L1[j];
+
+    ConstAssetPathIter iterAP = assetPath.begin();
+    double S1 = iterAP->S;
+    for (Path<PortfolioStates>::iterator iPS = statePath.begin()+1;
+            iPS != statePath.end(); ++iPS) {
+        double S0 = S1;
+        while ( isEarlier(iterAP,iPS) ) {
+            ++iterAP;
+        }
+        S1 = iterAP->S;
+
+        double x = S1 / S0 - 1.0;
+        *iPS = PortfolioStates(n);
+        for (unsigned j=0; j<n; ++j)
+            rollContractStates(x,portfolio.g[j],portfolio.y[j]
+                              ,portfolio.delta[j],L1[j],Ap[j],resQuot[j]
+                              ,iPS->c[j],iPS->d[j]);
+        iPS->L  = L1;
+        iPS->Ap = Ap;
+    }
+    return statePath;
+}
+
+// Scratch space for valuing a portfolio at t on many asset paths, see
+// ContractValuationWorkspace
+struct PortfolioValuationWorkspace {
+    PortfolioValuationWorkspace() {}
+    PortfolioValuationWorkspace(const Path<PortfolioStates>& psPath)
+        : portfolioStatePath(psPath) {}
+    Path<PortfolioStates> portfolioStatePath;
+    std::vector<double> L, Ap, resQuot;
+    DiscountFactors discountFactors;
+};
+
+// accumulateContractValue for all contracts at once: adds the value at t
+// of contract j on assetPath to values[j]. The discount factors of the
+// workspace must be up to date after t.
+void accumulatePortfolioValues(const rational& t
+                              ,const Path<Assets> &assetPath
+                              ,const ContractPortfolio &portfolio
+                              ,PortfolioValuationWorkspace &workspace
+                              ,Array<ValueVector> &values) {
+    const Path<PortfolioStates>& statePath = workspace.portfolioStatePath;
+    const unsigned n = portfolio.size();
+    Path<PortfolioStates>::const_iterator iPS 
+        = statePath.lastIteratorOnOrBeforeTime(t);
+    Path<PortfolioStates>::const_iterator iPSlast = statePath.end()-1;
+    if (iPS.t() == t) {
+        for (unsigned j=0; j<n; ++j) {
+            ValueVector payoff;
+            if (iPS == statePath.begin()) {
+                payoff.Res = (-1)*(iPS->Ap[j]-iPS->L[j]);
+            } else {
+                payoff.C = iPS->c[j];
+                payoff.D = iPS->d[j];
+            }
+            if (iPS == iPSlast) {
+                payoff.V   = iPS->L[j];
+                payoff.Res = iPS->Ap[j]-iPS->L[j];
+            }
+            values[j] += payoff;
+        }
+    }
+
+    std::vector<double>& L1 = workspace.L;
+    std::vector<double>& Ap = workspace.Ap;
+    std::vector<double>& resQuot = workspace.resQuot;
+    L1 = iPS->L;
+    Ap = iPS->Ap;
+    resQuot.resize(n);
+    for (unsigned j=0; j<n; ++j)
+        resQuot[j] = (Ap[j] - L1[j])/L1[j];
+
+    ConstAssetPathIter iterAP = assetPath.iteratorAtTime(iPS.t());
+    unsigned i_t = assetPath.iteratorAtTime(t).index();
+    double S1 = iterAP->S;
+    for (++iPS; iPS != statePath.end(); ++iPS) {
+        double S0 = S1;
+        while ( isEarlier(iterAP,iPS) ) {
+            ++iterAP;
+        }
+        S1 = iterAP->S;
+
+        double x = S1 / S0 - 1.0;
+        double discount = workspace.discountFactors.discountFactor(
+                                i_t,iterAP.index());
+        bool last = (iPS == iPSlast);
+        for (unsigned j=0; j<n; ++j) {
+            ValueVector payoff;
+            rollContractStates(x,portfolio.g[j],portfolio.y[j]
+                              ,portfolio.delta[j],L1[j],Ap[j],resQuot[j]
+                              ,payoff.C,payoff.D);
+            if (last) {
+                payoff.V   = L1[j];
+                payoff.Res = Ap[j]-L1[j];
+            }
+            values[j] += payoff * discount;
+        }
+    }
+}
+
+// Values at t of all contracts on assetPath, values[j] of contract j
+Array<ValueVector> portfolioValuesFromPath(const rational& t
+                                          ,const Path<Assets> &assetPath
+                                          ,const ContractPortfolio &portfolio
+                                          ,PortfolioValuationWorkspace &workspace) {
+    workspace.discountFactors.update(assetPath,t);
+    Array<ValueVector> values(portfolio.size());
+    accumulatePortfolioValues(t,assetPath,portfolio,workspace,values);
+    return values;
+}
+
+// assetPath is a scratch path, only the points after t are overwritten
+template <class Dynamics>
+Array<ValueVector> portfolioValuesFromVariates
+                        (const rational& t
+                        ,Path<Assets>& assetPath
+                        ,const Path<Variates>& variates
+                        ,PortfolioValuationWorkspace& workspace
+                        ,const ContractPortfolio& portfolio
+                        ,const Dynamics& dynamics) {
+    updatePathFromVariates(assetPath.iteratorAtTime(t),assetPath.end()
+                          ,variates.iteratorAtTime(t),dynamics);
+    return portfolioValuesFromPath(t,assetPath,portfolio,workspace);
+}
+
+// Sum over the contracts
+ValueVector portfolioTotal(const Array<ValueVector>& values) {
+    ValueVector total;
+    for (unsigned j=0; j<values.size(); ++j)
+        total += values[j];
+    return total;
+}
+
+}
+
+#endif
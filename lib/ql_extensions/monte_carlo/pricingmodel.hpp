@@ -3,12 +3,52 @@
 
 namespace QuantLibExt {
 
+// Value, underlyings and deltas of one pricing run, can be accumulated
+// over scenarios like each of its parts
+template <class ValT, class UnderlT, class DeltaT>
+struct PricingResult {
+    PricingResult() {}
+    PricingResult(const ValT& v, const UnderlT& u, const DeltaT& d)
+        : value(v), underlyings(u), deltas(d) {}
+    ValT    value;
+    UnderlT underlyings;
+    DeltaT  deltas;
+
+    PricingResult& operator+=(const PricingResult& other) {
+        value       += other.value;
+        underlyings += other.underlyings;
+        deltas      += other.deltas;
+        return *this;
+    }
+    PricingResult operator/(double d) const {
+        PricingResult temp;
+        temp.value       = value / d;
+        temp.underlyings = underlyings / d;
+        temp.deltas      = deltas / d;
+        return temp;
+    }
+    PricingResult operator*(double d) const {
+        PricingResult temp;
+        temp.value       = value * d;
+        temp.underlyings = underlyings * d;
+        temp.deltas      = deltas * d;
+        return temp;
+    }
+};
+
 template <class ValT, class UnderlT, class DeltaT>
 class PricingModel {
   public:
+    virtual ~PricingModel() {}
     virtual ValT    value() const = 0;
     virtual UnderlT underlyings() const = 0;
     virtual DeltaT  deltas() const = 0;
+
+    // All three at once. Models that can compute them from the same
+    // scenarios override this.
+    virtual PricingResult<ValT,UnderlT,DeltaT> evaluate() const {
+        return PricingResult<ValT,UnderlT,DeltaT>(value(),underlyings(),deltas());
+    }
 };
 
 }
@@ -0,0 +1,421 @@
+#ifndef ql_extensions__monte_carlo__regression_pricing_hpp__
+#define ql_extensions__monte_carlo__regression_pricing_hpp__
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "../instruments/termfixinsurance/valuevector.hpp"
+
+#include "path.hpp"
+#include "assets.hpp"
+#include "variates.hpp"
+#include "pricingmodel.hpp"
+#include "discount_factors.hpp"
+#include "insurance_contract.hpp"
+
+namespace QuantLibExt {
+
+// Least squares fit of nTargets targets on the polynomials of degree <= 2
+// in the regressors x, which are standardised with mean and scale first.
+// Regressors with scale 0 (no spread in the sample) are left out.
+class QuadraticRegression {
+  public:
+    QuadraticRegression() : nTargets_(0), nBasis_(0), solved_(false) {}
+    QuadraticRegression(const std::vector<double>& mean
+                       ,const std::vector<double>& scale
+                       ,unsigned nTargets)
+        : mean_(mean), scale_(scale), nTargets_(nTargets), solved_(false) {
+        for (unsigned a=0; a<scale_.size(); ++a)
+            if (scale_[a] > 0.0)
+                active_.push_back(a);
+        unsigned m = active_.size();
+        nBasis_ = 1 + m + m*(m+1)/2;
+        xtx_.assign(nBasis_*nBasis_,0.0);
+        xty_.assign(nBasis_*nTargets_,0.0);
+    }
+
+    bool isActive(unsigned a) const {
+        return std::find(active_.begin(),active_.end(),a) != active_.end();
+    }
+    bool isSolved() const { return solved_; }
+
+    void add(const std::vector<double>& x, const std::vector<double>& y) {
+        std::vector<double> phi(nBasis_);
+        basis(x,phi);
+        for (unsigned i=0; i<nBasis_; ++i) {
+            for (unsigned j=i; j<nBasis_; ++j)
+                xtx_[i*nBasis_+j] += phi[i]*phi[j];
+            for (unsigned k=0; k<nTargets_; ++k)
+                xty_[i*nTargets_+k] += phi[i]*y[k];
+        }
+    }
+
+    // Solves the normal equations (Cholesky, with a tiny ridge), false if
+    // they are singular
+    bool solve() {
+        unsigned n = nBasis_;
+        std::vector<double> l(n*n,0.0);
+        double ridge = 0.0;
+        for (unsigned i=0; i<n; ++i)
+            ridge = std::max(ridge,xtx_[i*n+i]);
+        ridge *= 1E-12;
+        for (unsigned j=0; j<n; ++j) {
+            double d = xtx_[j*n+j] + ridge;
+            for (unsigned p=0; p<j; ++p)
+                d -= l[j*n+p]*l[j*n+p];
+            if (!(d > 0.0))
+                return false;
+            l[j*n+j] = std::sqrt(d);
+            for (unsigned i=j+1; i<n; ++i) {
+                double s = xtx_[j*n+i];
+                for (unsigned p=0; p<j; ++p)
+                    s -= l[i*n+p]*l[j*n+p];
+                l[i*n+j] = s / l[j*n+j];
+            }
+        }
+        coefficients_.assign(n*nTargets_,0.0);
+        std::vector<double> z(n);
+        for (unsigned k=0; k<nTargets_; ++k) {
+            for (unsigned i=0; i<n; ++i) {
+                double s = xty_[i*nTargets_+k];
+                for (unsigned p=0; p<i; ++p)
+                    s -= l[i*n+p]*z[p];
+                z[i] = s / l[i*n+i];
+            }
+            for (unsigned i=n; i-- > 0; ) {
+                double s = z[i];
+                for (unsigned p=i+1; p<n; ++p)
+                    s -= l[p*n+i]*coefficients_[p*nTargets_+k];
+                coefficients_[i*nTargets_+k] = s / l[i*n+i];
+            }
+        }
+        solved_ = true;
+        return true;
+    }
+
+    double fitted(const std::vector<double>& x, unsigned k) const {
+        std::vector<double> phi(nBasis_);
+        basis(x,phi);
+        return combine(phi,k);
+    }
+    // derivative of the fitted target k by regressor a
+    double derivative(const std::vector<double>& x, unsigned a
+                     ,unsigned k) const {
+        std::vector<double> dphi(nBasis_);
+        basisDerivative(x,a,dphi);
+        return combine(dphi,k);
+    }
+
+  private:
+    double combine(const std::vector<double>& phi, unsigned k) const {
+        double s = 0.0;
+        for (unsigned i=0; i<nBasis_; ++i)
+            s += coefficients_[i*nTargets_+k]*phi[i];
+        return s;
+    }
+    void standardise(const std::vector<double>& x
+                    ,std::vector<double>& u) const {
+        u.resize(active_.size());
+        for (unsigned i=0; i<active_.size(); ++i)
+            u[i] = (x[active_[i]] - mean_[active_[i]]) / scale_[active_[i]];
+    }
+    // 1, u_i, u_i u_j (i <= j)
+    void basis(const std::vector<double>& x, std::vector<double>& phi) const {
+        std::vector<double> u;
+        standardise(x,u);
+        unsigned m = u.size(), b = 0;
+        phi[b++] = 1.0;
+        for (unsigned i=0; i<m; ++i)
+            phi[b++] = u[i];
+        for (unsigned i=0; i<m; ++i)
+            for (unsigned j=i; j<m; ++j)
+                phi[b++] = u[i]*u[j];
+    }
+    void basisDerivative(const std::vector<double>& x, unsigned a
+                        ,std::vector<double>& dphi) const {
+        std::fill(dphi.begin(),dphi.end(),0.0);
+        std::vector<unsigned>::const_iterator it
+            = std::find(active_.begin(),active_.end(),a);
+        if (it == active_.end())
+            return;
+        unsigned q = it - active_.begin();
+        std::vector<double> u;
+        standardise(x,u);
+        unsigned m = u.size(), b = 1+m;
+        double du = 1.0 / scale_[a];
+        dphi[1+q] = du;
+        for (unsigned i=0; i<m; ++i)
+            for (unsigned j=i; j<m; ++j, ++b)
+                dphi[b] = ((i == q ? u[j] : 0.0) + (j == q ? u[i] : 0.0))*du;
+    }
+
+    std::vector<double> mean_, scale_;
+    std::vector<unsigned> active_;
+    unsigned nTargets_, nBasis_;
+    std::vector<double> xtx_, xty_, coefficients_;
+    bool solved_;
+};
+
+// Regressors of the contract value at t: the log return of the stock since
+// the last anniversary on or before t, S, r, and L and Ap at that
+// anniversary
+void regressionState(const rational& t
+                    ,const Path<Assets>& assetPath
+                    ,const Path<ContractStates>& contractStatePath
+                    ,std::vector<double>& x) {
+    ConstContrStatePathIter ic = contractStatePath.lastIteratorOnOrBeforeTime(t);
+    const Assets& a = assetPath[t];
+    x.resize(5);
+    x[0] = std::log(a.S / assetPath[ic.t()].S);
+    x[1] = a.S;
+    x[2] = a.r;
+    x[3] = ic->L;
+    x[4] = ic->Ap;
+}
+
+// Pricing model that only hands out a result computed beforehand
+class FixedResultPricingModel : public PricingModel<ValT,UnderlT,DeltaT> {
+  public:
+    FixedResultPricingModel(const ResultT& result) : result_(result) {}
+
+    virtual ValT    value() const { return result_.value; }
+    virtual UnderlT underlyings() const { return result_.underlyings; }
+    virtual DeltaT  deltas() const { return result_.deltas; }
+    virtual ResultT evaluate() const { return result_; }
+
+  protected:
+    ResultT result_;
+};
+
+// Regression (Longstaff-Schwartz style) instead of nested MC: the factory
+// simulates one bundle of nBundlePaths paths on the hedge grid once, and
+// regresses the discounted payoffs after every hedge date and the zero
+// bond on a quadratic polynomial in the regressionState. make() then
+// evaluates the fitted polynomials, the deltas are their derivatives
+// (by S, and by r relative to the bond). At hedge dates where S or r has
+// no spread in the bundle (t0) it falls back to the nested MC of the base
+// class with nScenariosFallback scenarios. The bundle is drawn like the
+// scenarios of the base class (innerMC: quasi MC, antithetic, Philox), the
+// fallback is the nested MC of innerMC. All paths start from the same
+// state at t0, so the fallback there is computed once in the fit.
+class RegressionInsContrPricingModelFactory
+    : public InsContrMCPricingModelFactory {
+public:
+  RegressionInsContrPricingModelFactory(unsigned nBundlePaths,
+                                        rational hedgePathDt,
+                                        ModelDynamics dynamics,
+                                        ContractTraits contractTraits,
+                                        const Assets& initialAssetValues,
+                                        double offset_S=0.0,
+                                        double offset_r=0.0,
+                                        unsigned nScenariosFallback=1000,
+                                        const InnerMCTraits& innerMC
+                                          =InnerMCTraits())
+    : InsContrMCPricingModelFactory(nScenariosFallback, hedgePathDt,
+                                    dynamics, contractTraits,
+                                    offset_S, offset_r, innerMC) {
+    fit(nBundlePaths, initialAssetValues);
+  }
+
+  virtual PricingModel<ValT,UnderlT,DeltaT>* make(const rational&,
+                                                  const Path<Assets>&,
+                                                  const Path<ContractStates>&,
+                                                  unsigned outerPath=0) const;
+
+protected:
+  void fit(unsigned nPaths, const Assets& initialAssetValues);
+
+  // The return since the last anniversary has no spread at the 
+  // anniversaries themselves. There the bundle paths continue from a 
+  // stock jumped by exp(jumpVolatility*Z) right after t (the perturbation
+  // of the finite difference deltas), so the fit sees the dependence on it.
+  static const double jumpVolatility_;
+
+  // the nested MC of the base class where the regression cannot be used
+  PricingModel<ValT,UnderlT,DeltaT>* fallback(
+      const rational& t, const Path<Assets>& assetPath,
+      const Path<ContractStates>& contractStatePath, unsigned outerPath) const;
+
+  // one regression per hedge date
+  std::vector<QuadraticRegression> regressions_;
+  // the fallback at t0, if the regression at t0 cannot be used
+  bool hasT0Result_;
+  ResultT t0Result_;
+};
+
+const double RegressionInsContrPricingModelFactory::jumpVolatility_ = 0.1;
+
+void RegressionInsContrPricingModelFactory::fit(
+    unsigned nPaths, const Assets& initialAssetValues)
+{
+  Path<Assets> assetPath(hedgePathDt_, contractTraits_.T);
+  assetPath[0u] = initialAssetValues;
+  Path<Assets> jumpedPath;
+  unsigned nDates = assetPath.size();
+  Path<Variates> variates;
+  Path<ContractStates> contractStatePath;
+  Path<ValueVector> payoffPath;
+  DiscountFactors factors;
+  std::vector<double> x, y(6);
+
+  // First pass for the mean and spread of the regressors, the second pass
+  // replays the same paths and jumps (copies of the generators) for the fit.
+  // The jumps get their own stream derived from the seed.
+  boost::function<void (ScenT&)> generator
+    = makeScenarioGenerator(rational(0), assetPath, 0);
+  boost::function<void (ScenT&)> replay = generator;
+  boost::function<double ()> jumps
+    = NormalRandomNumberGenerator(innerMC_.seed ^ 2654435769u);
+  boost::function<double ()> replayJumps = jumps;
+
+  std::vector<std::vector<double> > sum(nDates, std::vector<double>(5,0.0));
+  std::vector<std::vector<double> > sumSq = sum;
+  for (unsigned p=0; p<nPaths; ++p) {
+    generator(variates);
+    updatePathFromVariates(assetPath.begin(), assetPath.end(),
+                           variates.begin(), dynamics_);
+    contractStatePath = makeContractStatePath(assetPath, contractTraits_);
+    for (unsigned k=0; k+1<nDates; ++k) {
+      rational t = hedgePathDt_*int(k);
+      regressionState(t, assetPath, contractStatePath, x);
+      if (k > 0 && contractStatePath.hasTimepointAt(t)) {
+        double jump = std::exp(jumpVolatility_*jumps());
+        x[0] += std::log(jump);
+        x[1] *= jump;
+      }
+      for (unsigned a=0; a<x.size(); ++a) {
+        sum[k][a] += x[a];
+        sumSq[k][a] += x[a]*x[a];
+      }
+    }
+  }
+
+  regressions_.resize(nDates);
+  for (unsigned k=0; k+1<nDates; ++k) {
+    std::vector<double> mean(5), scale(5);
+    for (unsigned a=0; a<5; ++a) {
+      mean[a] = sum[k][a] / nPaths;
+      double variance = std::max(sumSq[k][a] / nPaths - mean[a]*mean[a], 0.0);
+      scale[a] = std::sqrt(variance);
+      if (scale[a] <= 1E-10*(1.0 + std::fabs(mean[a])))
+        scale[a] = 0.0;
+    }
+    regressions_[k] = QuadraticRegression(mean, scale, y.size());
+  }
+
+  for (unsigned p=0; p<nPaths; ++p) {
+    replay(variates);
+    updatePathFromVariates(assetPath.begin(), assetPath.end(),
+                           variates.begin(), dynamics_);
+    contractStatePath = makeContractStatePath(assetPath, contractTraits_);
+    payoffPathFromContractStates(contractStatePath, payoffPath);
+    factors.update(assetPath);
+    ContractValuationWorkspace workspace(contractStatePath);
+    for (unsigned k=0; k+1<nDates; ++k) {
+      rational t = hedgePathDt_*int(k);
+      regressionState(t, assetPath, contractStatePath, x);
+      ValueVector v;
+      if (k > 0 && contractStatePath.hasTimepointAt(t)) {
+        // the path after t continues from the jumped stock, the contract
+        // states up to t stay as they are
+        double jump = std::exp(jumpVolatility_*replayJumps());
+        x[0] += std::log(jump);
+        x[1] *= jump;
+        jumpedPath = assetPath;
+        updatePathFromVariatesWithOffset(t, jumpedPath, variates, dynamics_,
+                                         Assets(assetPath[k].S*(jump-1.0),
+                                                0.0, 0.0));
+        v = valueContractFromPathWithOffset(t, jumpedPath, assetPath[k],
+                                            workspace, contractTraits_);
+        y[5] = workspace.discountFactors.discountFactor(k, nDates-1);
+      } else {
+        v = discountValue(t, assetPath, factors, payoffPath);
+        y[5] = factors.discountFactor(k, nDates-1);
+      }
+      y[0] = v.V;
+      y[1] = v.C;
+      y[2] = v.D;
+      y[3] = v.Res;
+      y[4] = v.Surr;
+      regressions_[k].add(x, y);
+    }
+  }
+
+  for (unsigned k=0; k+1<nDates; ++k)
+    regressions_[k].solve();
+
+  const QuadraticRegression& regression = regressions_[0];
+  hasT0Result_ = not (regression.isSolved() && regression.isActive(1)
+                      && regression.isActive(2));
+  if (hasT0Result_) {
+    assetPath[0u] = initialAssetValues;
+    Path<ContractStates> initialStates(contractTraits_.dt, contractTraits_.T);
+    initialStates[0u] = contractTraits_.initialContractStates;
+    boost::shared_ptr<PricingModel<ValT,UnderlT,DeltaT> > model(
+      InsContrMCPricingModelFactory::make(rational(0), assetPath,
+                                          initialStates, 0));
+    t0Result_ = model->evaluate();
+  }
+}
+
+PricingModel<ValT,UnderlT,DeltaT>* RegressionInsContrPricingModelFactory::fallback(
+    const rational& t, const Path<Assets>& assetPath,
+    const Path<ContractStates>& contractStatePath, unsigned outerPath) const
+{
+  if (t == rational(0) && hasT0Result_)
+    return new FixedResultPricingModel(t0Result_);
+  return InsContrMCPricingModelFactory::make(t, assetPath, contractStatePath,
+                                             outerPath);
+}
+
+PricingModel<ValT,UnderlT,DeltaT>* RegressionInsContrPricingModelFactory::make(
+    const rational& t, const Path<Assets>& assetPath,
+    const Path<ContractStates>& contractStatePath, unsigned outerPath) const
+{
+  if (t == contractStatePath.T())
+    return new InsContrEndPointPricingModel(assetPath[t],contractStatePath[t]);
+
+  QL_REQUIRE((t/hedgePathDt_).denominator() == 1,
+             "RegressionInsContrPricingModelFactory: t is no hedge date");
+  const QuadraticRegression& regression
+    = regressions_[boost::rational_cast<unsigned>(t/hedgePathDt_)];
+  if (not (regression.isSolved() && regression.isActive(1)
+           && regression.isActive(2)))
+    return fallback(t, assetPath, contractStatePath, outerPath);
+
+  std::vector<double> x;
+  regressionState(t, assetPath, contractStatePath, x);
+
+  // d/dS of f(log(S/S_anniversary), S, ...)
+  ValueVector value, dS, dr;
+  double* pValue[] = { &value.V, &value.C, &value.D, &value.Res, &value.Surr };
+  double* pdS[]    = { &dS.V, &dS.C, &dS.D, &dS.Res, &dS.Surr };
+  double* pdr[]    = { &dr.V, &dr.C, &dr.D, &dr.Res, &dr.Surr };
+  for (unsigned k=0; k<5; ++k) {
+    *pValue[k] = regression.fitted(x, k);
+    *pdS[k] = regression.derivative(x, 0, k) / x[1]
+            + regression.derivative(x, 1, k);
+    *pdr[k] = regression.derivative(x, 2, k);
+  }
+  double bondDr = regression.derivative(x, 2, 5);
+  if (not (std::fabs(bondDr) > 0.0))
+    return fallback(t, assetPath, contractStatePath, outerPath);
+
+  ResultT result;
+  result.value = value;
+  result.underlyings = Array<>(2);
+  result.underlyings[0] = x[1];
+  result.underlyings[1] = regression.fitted(x, 5);
+  result.deltas = Array<ValueVector>(2);
+  result.deltas[0] = dS;
+  result.deltas[1] = dr / bondDr;
+  return new FixedResultPricingModel(result);
+}
+
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include <algorithm>
 
 #include <iostream>
+#include <sstream>
 
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
@@ -20,6 +21,7 @@
 #include "path.hpp"
 #include "mcmodel.hpp"
 #include "insurance_contract.hpp"
+#include "discount_factors.hpp"
 
 #ifdef PATHDEBUG
 #include "pathdebug.hpp"
@@ -40,6 +42,11 @@ struct HedgeTraits {
     unsigned nSamplesInnerMC;
     double offset_S;
     double offset_r;
+    bool pathwiseDeltas;
+    bool batchedInnerMC;
+    // > 0: regression pricer fitted on this many paths instead of nested MC
+    unsigned regressionPaths;
+    InnerMCTraits innerMC;
 };
 
 void updateDeltasAndMoneyAccount
@@ -47,6 +54,7 @@ void updateDeltasAndMoneyAccount
                 ,const Path<Assets>& assetPath
                 ,const Path<ContractStates>& contractStatePath
                 ,const Shared_PF_Pointer &p_PricerFactory
+                ,unsigned outerPath
                 ,Array<ValueVector>& oldDeltas
                 ,ValueVector& moneyAccount
 #ifdef PATHDEBUG
@@ -55,9 +63,10 @@ void updateDeltasAndMoneyAccount
                 ) 
 {
     boost::shared_ptr<PricingModel<ValT,UnderlT,DeltaT> >
-        p_Pricer(p_PricerFactory->make(t,assetPath,contractStatePath));
-    UnderlT underlyings = p_Pricer->underlyings();
-    DeltaT newDeltas = p_Pricer->deltas();
+        p_Pricer(p_PricerFactory->make(t,assetPath,contractStatePath,outerPath));
+    PricingResult<ValT,UnderlT,DeltaT> prices = p_Pricer->evaluate();
+    const UnderlT& underlyings = prices.underlyings;
+    const DeltaT& newDeltas = prices.deltas;
     moneyAccount = DotProduct(oldDeltas-newDeltas,underlyings,moneyAccount);
     oldDeltas = newDeltas;
 #ifdef PATHDEBUG
@@ -70,7 +79,7 @@ void updateDeltasAndMoneyAccount
                                ,newDeltas[0]
                                ,newDeltas[1]
                                ,moneyAccount
-                               ,p_Pricer->value()));
+                               ,prices.value));
 #endif 
 }
 
@@ -84,35 +93,50 @@ double compoundingFactor(const rational& old_t, const rational& t
     return std::exp(sumIntR);
 }
 
+double compoundingFactor(const rational& old_t, const rational& t 
+                        ,const Path<Assets>& assetPath
+                        ,const DiscountFactors& factors) {
+    return factors.compoundingFactor(assetPath.iteratorAtTime(old_t).index()
+                                    ,assetPath.iteratorAtTime(t).index());
+}
+
 ValueVector computeReplicationProfitAndLoss(
          ValueVector initialValue
         ,const Path<Assets>& assetPath
         ,const Path<ContractStates>& contractStatePath
         ,const Path<ValueVector>& payoffPath
+        ,unsigned outerPath
         ,boost::shared_ptr<InsContrMCPricingModelFactory> p_PricerFactory
         ,rational hedgeDt) 
 {
     ValueVector moneyAccount = initialValue;
     DeltaT deltas = Array<ValueVector>(2); // Constructor initializes with zeros
+    DiscountFactors factors(assetPath);
 
 #ifdef PATHDEBUG
     std::vector<PathDebugInfo> pdi;
 #endif 
 
-    for (rational t, old_t; t <= contractStatePath.T(); t += hedgeDt) {
-        moneyAccount *= compoundingFactor(old_t,t,assetPath);
+    // the hedge dates are counted with integers, t is only formed to call
+    // the path and pricer interfaces
+    unsigned nHedges = boost::rational_cast<unsigned>(contractStatePath.T()/hedgeDt);
+    rational old_t;
+    for (unsigned i=0; i<=nHedges; ++i) {
+        rational t = hedgeDt*int(i);
+        moneyAccount *= compoundingFactor(old_t,t,assetPath,factors);
 
         if (payoffPath.hasTimepointAt(t)) 
             moneyAccount -= payoffPath[t];
 
         updateDeltasAndMoneyAccount(t,assetPath,contractStatePath
-                ,p_PricerFactory,deltas,moneyAccount
+                ,p_PricerFactory,outerPath,deltas,moneyAccount
 #ifdef PATHDEBUG
                 ,pdi
 #endif
                 );
 #ifdef PATHDEBUG
-        pdi.back().intR = std::log(compoundingFactor(old_t,t,assetPath));
+        pdi.back().intR = factors.sumIntR(assetPath.iteratorAtTime(old_t).index()
+                                         ,assetPath.iteratorAtTime(t).index());
 #endif
         old_t = t;
     }
@@ -130,19 +154,26 @@ ValueVector computeZeroHedgeProfitAndLoss(
         ,const Path<ValueVector>& payoffPath)
 {
     ValueVector moneyAccount = initialValue;
+    DiscountFactors factors(assetPath);
+#ifdef PATHDEBUG
+    // written as one block, so the paths of several threads do not mix
+    std::ostringstream trace;
+#endif
 
     rational t, old_t;
     while (true) {
-        double compFact = compoundingFactor(old_t,t,assetPath);
-        moneyAccount *= compoundingFactor(old_t,t,assetPath);
+        double compFact = compoundingFactor(old_t,t,assetPath,factors);
+        moneyAccount *= compFact;
         moneyAccount -= payoffPath[t];
-        std::cout << "t=" << (boost::format("%3d") % t.numerator())
-                  << " || moneyAccount = " << moneyAccount
-                  << " || compFact = " << compFact
-                  << " || assetPath : "
-                  << (boost::format("S: %8.2f, r: %8.4f, intR: %8.4f")
-                      % assetPath[t].S % assetPath[t].r % assetPath[t].intR)
-                  << std::endl;
+#ifdef PATHDEBUG
+        trace << "t=" << (boost::format("%3d") % t.numerator())
+              << " || moneyAccount = " << moneyAccount
+              << " || compFact = " << compFact
+              << " || assetPath : "
+              << (boost::format("S: %8.2f, r: %8.4f, intR: %8.4f")
+                  % assetPath[t].S % assetPath[t].r % assetPath[t].intR)
+              << "\n";
+#endif
 
         if (t < payoffPath.T()) {
             old_t = t;
@@ -150,8 +181,11 @@ ValueVector computeZeroHedgeProfitAndLoss(
         } else
             break;
     }
-    moneyAccount /= compoundingFactor(rational(),payoffPath.T(),assetPath);
+    moneyAccount /= compoundingFactor(rational(),payoffPath.T(),assetPath,factors);
 
+#ifdef PATHDEBUG
+    std::cerr << trace.str() << std::flush;
+#endif
     return moneyAccount;
 }
 
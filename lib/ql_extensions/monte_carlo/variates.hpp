@@ -18,15 +18,24 @@ struct Variates {
 typedef Path<Variates>::iterator VariatePathIter;
 typedef Path<Variates>::const_iterator ConstVariatePathIter;
 
-Path<Variates> makeVariates(const rational &dt ,const rational& T 
-                           ,const rational &t
-                           ,boost::function<double ()> &n) {
-    Path<Variates> path(dt,T,t);
+// Draws the variates of the grid (dt,T,t) into path, reusing its storage
+void fillVariates(Path<Variates> &path
+                 ,const rational &dt ,const rational& T 
+                 ,const rational &t
+                 ,boost::function<double ()> &n) {
+    path.reset(dt,T,t);
     for (Path<Variates>::iterator it=path.begin(); 
             it != path.end(); ++it) {
         it->W1 = n();
         it->W2 = n();
     }
+}
+
+Path<Variates> makeVariates(const rational &dt ,const rational& T 
+                           ,const rational &t
+                           ,boost::function<double ()> &n) {
+    Path<Variates> path;
+    fillVariates(path,dt,T,t,n);
     return path;
 }
 
@@ -42,6 +51,38 @@ struct NormalRandomNumberGenerator {
     boost::variate_generator<boost::mt19937,boost::normal_distribution<> > n_;
 };
 
+// Same stream as NormalRandomNumberGenerator(seed), but on the concrete
+// engine and distribution, so filling a block of variates is an inlined
+// loop instead of a boost::function call per normal.
+class BulkNormalGenerator {
+  public:
+    BulkNormalGenerator(unsigned seed) : rng_(seed) {}
+
+    double operator()() {
+        return normal_(rng_);
+    }
+    void operator()(Variates* first, Variates* last) {
+        for (; first != last; ++first) {
+            first->W1 = normal_(rng_);
+            first->W2 = normal_(rng_);
+        }
+    }
+
+  private:
+    boost::mt19937 rng_;
+    boost::normal_distribution<> normal_;
+};
+
+// fillVariates on the whole storage of path at once
+void fillVariates(Path<Variates> &path
+                 ,const rational &dt ,const rational& T 
+                 ,const rational &t
+                 ,BulkNormalGenerator &n) {
+    path.reset(dt,T,t);
+    Variates* first = &*path.begin();
+    n(first,first+path.size());
+}
+
 class ScenarioGenerator {
   public:
     ScenarioGenerator(const rational& dt, const rational& T 
@@ -54,12 +95,100 @@ class ScenarioGenerator {
     Path<Variates> operator()() {
         return makeVariates(dt_,T_,t_,n_);
     }
+    // Draws the next scenario into the storage of scenario
+    void operator()(Path<Variates>& scenario) {
+        fillVariates(scenario,dt_,T_,t_,n_);
+    }
 
   protected:
     rational dt_, T_, t_;
     mutable boost::function<double ()> n_;
 };
 
+// ScenarioGenerator(dt,T,t,seed) on a BulkNormalGenerator
+class BulkScenarioGenerator {
+  public:
+    BulkScenarioGenerator(const rational& dt, const rational& T 
+                         ,const rational& t, unsigned seed=42u)
+        : dt_(dt), T_(T), t_(t), n_(seed) {}
+
+    Path<Variates> operator()() {
+        Path<Variates> scenario;
+        (*this)(scenario);
+        return scenario;
+    }
+    void operator()(Path<Variates>& scenario) {
+        fillVariates(scenario,dt_,T_,t_,n_);
+    }
+
+  protected:
+    rational dt_, T_, t_;
+    BulkNormalGenerator n_;
+};
+
+// Antithetic variates: every second scenario is the previous one with W1
+// and W2 negated.
+class AntitheticScenarioGenerator {
+  public:
+    AntitheticScenarioGenerator(
+            const boost::function<void (Path<Variates>&)>& generator)
+        : generator_(generator), mirror_(false) {}
+
+    void operator()(Path<Variates>& scenario) {
+        if (mirror_) {
+            scenario = last_;
+            for (Path<Variates>::iterator it=scenario.begin(); 
+                    it != scenario.end(); ++it) {
+                it->W1 = -it->W1;
+                it->W2 = -it->W2;
+            }
+        } else {
+            generator_(scenario);
+            last_ = scenario;
+        }
+        mirror_ = not mirror_;
+    }
+
+  protected:
+    boost::function<void (Path<Variates>&)> generator_;
+    Path<Variates> last_;
+    bool mirror_;
+};
+
+// Makes independent ScenarioGenerators for the blocks of a blocked MC run,
+// block 0 uses seed itself.
+class BlockScenarioGenerator {
+  public:
+    BlockScenarioGenerator(const rational& dt, const rational& T 
+                          ,const rational& t, unsigned seed)
+        : dt_(dt), T_(T), t_(t), seed_(seed) {}
+
+    boost::function<void (Path<Variates>&)> operator()(unsigned block) const {
+        return BulkScenarioGenerator(dt_,T_,t_,seed_ ^ (2654435769u*block));
+    }
+
+  protected:
+    rational dt_, T_, t_;
+    unsigned seed_;
+};
+
+// Antithetic version of the generators of a block generator
+class AntitheticBlockScenarioGenerator {
+  public:
+    AntitheticBlockScenarioGenerator(
+            const boost::function<boost::function<void (Path<Variates>&)> 
+                (unsigned)>& blockGenerator)
+        : blockGenerator_(blockGenerator) {}
+
+    boost::function<void (Path<Variates>&)> operator()(unsigned block) const {
+        return AntitheticScenarioGenerator(blockGenerator_(block));
+    }
+
+  protected:
+    boost::function<boost::function<void (Path<Variates>&)> (unsigned)> 
+        blockGenerator_;
+};
+
 }
 
 #endif
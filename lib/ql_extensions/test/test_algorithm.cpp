@@ -0,0 +1,104 @@
+// Regression tests of parallel_transform: the results are those of
+// std::transform, in input order, for any number of threads, and an
+// error of a worker reaches the caller.
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+#include <algorithm/parallel_transform.hpp>
+#include <utils/test_utils.hpp>
+
+namespace qe = QuantLibExt;
+using namespace PaulsTestUtils;
+
+// uneven work, so the workers finish out of order
+double slowSquareRoot(unsigned i) {
+    double x = i;
+    for (unsigned k=0; k<(i*7919u)%2000u; ++k)
+        x = std::sqrt(x*x + 1.0) - 1e-3;
+    return x;
+}
+
+double weightedSum(unsigned i, double w) {
+    return w*slowSquareRoot(i);
+}
+
+double failOn17(unsigned i) {
+    if (i == 17)
+        throw std::runtime_error("element 17");
+    return i;
+}
+
+bool testUnary(std::string& message) {
+    std::vector<unsigned> input(1000);
+    for (unsigned i=0; i<input.size(); ++i)
+        input[i] = i;
+    std::vector<double> expected(input.size());
+    std::transform(input.begin(),input.end(),expected.begin(),slowSquareRoot);
+
+    bool ok = true;
+    unsigned threads[] = { 1, 2, 3, 8, 2000 };
+    for (unsigned k=0; k<5; ++k) {
+        std::vector<double> result(input.size());
+        qe::parallel_transform(input.begin(),input.end(),result.begin()
+                              ,slowSquareRoot,threads[k]);
+        for (unsigned i=0; i<input.size(); ++i)
+            ok = identicalOrMessage((boost::format("threads %u element %u")
+                                        % threads[k] % i).str()
+                                   ,result[i],expected[i],message) && ok;
+    }
+    return ok;
+}
+
+bool testBinary(std::string& message) {
+    std::vector<unsigned> input(500);
+    std::vector<double> weights(input.size());
+    for (unsigned i=0; i<input.size(); ++i) {
+        input[i] = 3*i;
+        weights[i] = 1.0/(i+1);
+    }
+    std::vector<double> expected(input.size());
+    std::transform(input.begin(),input.end(),weights.begin(),expected.begin()
+                  ,weightedSum);
+
+    bool ok = true;
+    std::vector<double> result(input.size());
+    qe::parallel_transform(input.begin(),input.end(),weights.begin()
+                          ,result.begin(),weightedSum,4);
+    for (unsigned i=0; i<input.size(); ++i)
+        ok = identicalOrMessage((boost::format("element %u") % i).str()
+                               ,result[i],expected[i],message) && ok;
+    return ok;
+}
+
+bool testError(std::string& message) {
+    std::vector<unsigned> input(100);
+    for (unsigned i=0; i<input.size(); ++i)
+        input[i] = i;
+    std::vector<double> result(input.size());
+    try {
+        qe::parallel_transform(input.begin(),input.end(),result.begin()
+                              ,failOn17,4);
+    } catch (std::exception& e) {
+        if (std::string(e.what()).find("element 17") != std::string::npos)
+            return true;
+        message += std::string("wrong error: ") + e.what() + "\n";
+        return false;
+    }
+    message += "the error of the worker was lost\n";
+    return false;
+}
+
+int main() {
+    unsigned failures = 0;
+    failures += runTest("unary parallel_transform",testUnary);
+    failures += runTest("binary parallel_transform",testBinary);
+    failures += runTest("worker errors",testError);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,199 @@
+// Regression tests of the MCMC chain sinks: the running summary agrees with
+// the statistics of the whole sample, and the writers put every draw on disk
+// unchanged.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <boost/format.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/variate_generator.hpp>
+
+#include <mcmc/chain_sink.hpp>
+#include <utils/columnar.hpp>
+#include <utils/test_utils.hpp>
+
+namespace qe = QuantLibExt;
+using namespace PaulsTestUtils;
+
+const std::string filename = "test_chain_sink.out";
+
+// A fixed sample of correlated draws: a normal, a skewed and a heavy tailed
+// parameter
+std::vector<qe::ParamType> testDraws(unsigned nDraws) {
+    boost::variate_generator<boost::mt19937, boost::normal_distribution<> >
+        n(boost::mt19937(11u),boost::normal_distribution<>(0.,1.));
+    std::vector<qe::ParamType> draws(nDraws,qe::ParamType(3));
+    for (unsigned j=0; j<nDraws; ++j) {
+        double z = n();
+        draws[j][0] = 2.0 + 0.5*z;
+        draws[j][1] = std::exp(0.3*z + 0.4*n());
+        draws[j][2] = z*std::exp(0.5*n());
+    }
+    return draws;
+}
+
+// The quantile of the sorted sample at the rank P2Quantile::value() uses
+double exactQuantile(std::vector<double> sample, double p) {
+    std::sort(sample.begin(),sample.end());
+    return sample[unsigned(std::floor(p*(sample.size()-1) + 0.5))];
+}
+
+bool testFewValues(std::string& message) {
+    double values[] = { 3.0, -1.0, 7.5, 2.0 };
+    double probabilities[] = { 0.0, 0.25, 0.5, 0.975, 1.0 };
+    bool ok = true;
+    for (unsigned k=0; k<5; ++k) {
+        qe::P2Quantile quantile(probabilities[k]);
+        for (unsigned n=1; n<=4; ++n) {
+            quantile.add(values[n-1]);
+            std::vector<double> sample(values,values+n);
+            ok = identicalOrMessage((boost::format("p %g n %u")
+                                        % probabilities[k] % n).str()
+                                   ,quantile.value()
+                                   ,exactQuantile(sample,probabilities[k])
+                                   ,message) && ok;
+        }
+    }
+    return ok;
+}
+
+// P^2 is an estimate: the quantiles of 20000 draws must be within a small
+// fraction of the spread of the parameter, mean and covariance agree with
+// the two pass values up to rounding
+bool testSummary(std::string& message) {
+    std::vector<qe::ParamType> draws = testDraws(20000);
+    unsigned nParameters = draws[0].size();
+    std::vector<double> probabilities = qe::ChainSummary::default_probabilities();
+    probabilities.push_back(0.1);
+    probabilities.push_back(0.9);
+    qe::ChainSummary summary(nParameters,probabilities);
+    for (unsigned j=0; j<draws.size(); ++j)
+        summary.add(draws[j]);
+
+    bool ok = true;
+    if (summary.count() != draws.size()) {
+        message += (boost::format("count %u, expected %u\n")
+                    % summary.count() % draws.size()).str();
+        ok = false;
+    }
+    std::vector<double> mean(nParameters,0.0);
+    for (unsigned j=0; j<draws.size(); ++j)
+        for (unsigned i=0; i<nParameters; ++i)
+            mean[i] += draws[j][i]/draws.size();
+    for (unsigned i=0; i<nParameters; ++i) {
+        ok = closeEnoughOrMessage((boost::format("mean %u") % i).str()
+                                 ,summary.mean()[i],mean[i],message) && ok;
+        for (unsigned l=0; l<nParameters; ++l) {
+            double covariance = 0.0;
+            for (unsigned j=0; j<draws.size(); ++j)
+                covariance += (draws[j][i]-mean[i])*(draws[j][l]-mean[l]);
+            covariance /= draws.size()-1;
+            ok = closeEnoughOrMessage((boost::format("covariance %u %u")
+                                         % i % l).str()
+                                     ,summary.covariance(i,l),covariance
+                                     ,message) && ok;
+        }
+
+        std::vector<double> sample(draws.size());
+        for (unsigned j=0; j<draws.size(); ++j)
+            sample[j] = draws[j][i];
+        double spread = exactQuantile(sample,0.975)
+                      - exactQuantile(sample,0.025);
+        for (unsigned k=0; k<probabilities.size(); ++k) {
+            double exact = exactQuantile(sample,probabilities[k]);
+            double estimate = summary.quantile(i,k);
+            if (std::abs(estimate-exact) > 0.01*spread) {
+                message += (boost::format("parameter %u q%g : exact %.6f, "
+                            "P2 %.6f\n") % i % probabilities[k] % exact
+                            % estimate).str();
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+bool testTextWriter(std::string& message) {
+    std::vector<qe::ParamType> draws = testDraws(1000);
+    {
+        qe::TextChainWriter writer(filename,draws[0].size(),false,64);
+        for (unsigned j=0; j<draws.size(); ++j)
+            writer.put(draws[j]);
+        writer.close();
+    }
+    std::ostringstream expected;
+    for (unsigned j=0; j<draws.size(); ++j) {
+        for (unsigned i=0; i<draws[j].size(); ++i)
+            expected << draws[j][i] << ",";
+        expected << '\n';
+    }
+    std::ifstream in(filename.c_str());
+    std::ostringstream written;
+    written << in.rdbuf();
+    if (written.str() != expected.str()) {
+        message += "the text file differs from the draws\n";
+        return false;
+    }
+    return true;
+}
+
+bool testColumnarWriter(std::string& message) {
+    std::vector<std::string> names;
+    names.push_back("mu");
+    names.push_back("sigma");
+    names.push_back("nu");
+    unsigned nDraws = 9000;
+    std::vector<qe::ParamType> draws = testDraws(nDraws);
+    bool ok = true;
+    unsigned blockRows[] = { 0, 512 };
+    for (unsigned b=0; b<2; ++b) {
+        {
+            qe::ColumnarChainWriter writer(filename,names,nDraws,blockRows[b]
+                                          ,true);
+            for (unsigned j=0; j<nDraws; ++j)
+                writer.put(draws[j]);
+            writer.close();
+            if (writer.summary().count() != nDraws) {
+                message += "the summary missed draws\n";
+                ok = false;
+            }
+        }
+        qe::ColumnarFile file(filename);
+        if (file.rows() != nDraws || file.columns() != names.size()) {
+            message += (boost::format("blockRows %u : %u x %u file\n")
+                        % blockRows[b] % file.rows() % file.columns()).str();
+            ok = false;
+            continue;
+        }
+        for (unsigned i=0; i<names.size(); ++i) {
+            const double* column = file.column(names[i]);
+            for (unsigned j=0; j<nDraws; ++j)
+                if (not identicalOrMessage((boost::format("blockRows %u %s[%u]")
+                                              % blockRows[b] % names[i]
+                                              % j).str()
+                                          ,column[j],draws[j][i],message)) {
+                    ok = false;
+                    break;
+                }
+        }
+    }
+    return ok;
+}
+
+int main() {
+    unsigned failures = 0;
+    failures += runTest("P2 quantiles of few values",testFewValues);
+    failures += runTest("chain summary",testSummary);
+    failures += runTest("text chain writer",testTextWriter);
+    failures += runTest("columnar chain writer",testColumnarWriter);
+    std::remove(filename.c_str());
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
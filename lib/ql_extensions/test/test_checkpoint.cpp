@@ -0,0 +1,214 @@
+// Regression tests of the checkpoint files of mc_simulation: the finished
+// paths are read back unchanged, a line cut off by an interruption is
+// dropped, and a checkpoint of a different run is refused.
+
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <map>
+
+#include <boost/format.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <ql_extensions.hpp>
+#include <utils/test_utils.hpp>
+
+#include <checkpoint.hpp>
+
+using namespace PaulsTestUtils;
+
+typedef std::map<unsigned, qe::ValueVector> Finished;
+
+const std::string filename = "test_checkpoint.chk";
+const std::string identity = "test run parameters=0";
+
+// Ordinary values and the ones operator>> can't read back
+Finished testPaths() {
+    double inf = std::numeric_limits<double>::infinity();
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    Finished paths;
+    paths[0] = qe::ValueVector(1.0/3.0, -2.5e-17, 123456.78901234567, 0.0, 1e300);
+    paths[2] = qe::ValueVector(nan, inf, -inf, -0.0,
+                               std::numeric_limits<double>::denorm_min());
+    paths[5] = qe::ValueVector(-nan, 0.1, nan, 7.0, -inf);
+    return paths;
+}
+
+bool sameValueVector(std::string prefix, const qe::ValueVector& result,
+                     const qe::ValueVector& expected, std::string& message) {
+    bool ok = identicalOrMessage(prefix + " V",result.V,expected.V,message);
+    ok = identicalOrMessage(prefix + " C",result.C,expected.C,message) && ok;
+    ok = identicalOrMessage(prefix + " D",result.D,expected.D,message) && ok;
+    ok = identicalOrMessage(prefix + " Res",result.Res,expected.Res,message)
+         && ok;
+    return identicalOrMessage(prefix + " Surr",result.Surr,expected.Surr
+                             ,message) && ok;
+}
+
+bool sameFinished(std::string prefix, const Finished& result,
+                  const Finished& expected, std::string& message) {
+    if (result.size() != expected.size()) {
+        message += (boost::format("%s : %u paths, expected %u\n") % prefix
+                    % result.size() % expected.size()).str();
+        return false;
+    }
+    bool ok = true;
+    for (Finished::const_iterator it = expected.begin(); it != expected.end();
+            ++it) {
+        Finished::const_iterator found = result.find(it->first);
+        if (found == result.end()) {
+            message += (boost::format("%s : path %u is missing\n") % prefix
+                        % it->first).str();
+            ok = false;
+        } else {
+            ok = sameValueVector((boost::format("%s path %u") % prefix
+                                    % it->first).str()
+                                ,found->second,it->second,message) && ok;
+        }
+    }
+    return ok;
+}
+
+bool throws(void (*f)()) {
+    try {
+        f();
+    } catch (std::exception&) {
+        return true;
+    }
+    return false;
+}
+
+void readOtherRun() {
+    readCheckpoint(filename,10,"other run parameters=0");
+}
+
+void readFewerPaths() {
+    readCheckpoint(filename,5,identity);
+}
+
+bool testRoundTrip(std::string& message) {
+    std::remove(filename.c_str());
+    bool ok = true;
+    if (not noCheckpoint(filename) || not readCheckpoint(filename,10,identity)
+                                              .empty()) {
+        message += "a missing file is not an empty checkpoint\n";
+        ok = false;
+    }
+
+    Finished expected = testPaths();
+    {
+        // the first paths are those of an earlier run, the others are
+        // written as they finish
+        Finished earlier;
+        earlier[0] = expected[0];
+        CheckpointFile file(filename,identity,earlier);
+        file.write(5,expected[5]);
+        file.write(2,expected[2]);
+    }
+    if (noCheckpoint(filename)) {
+        message += "the checkpoint file is empty\n";
+        ok = false;
+    }
+    ok = sameFinished("written",readCheckpoint(filename,10,identity),expected
+                     ,message) && ok;
+
+    // replacing the file keeps the paths
+    { CheckpointFile file(filename,identity,expected); }
+    ok = sameFinished("replaced",readCheckpoint(filename,10,identity)
+                     ,expected,message) && ok;
+
+    if (not throws(readOtherRun)) {
+        message += "the checkpoint of a different run was read\n";
+        ok = false;
+    }
+    if (not throws(readFewerPaths)) {
+        message += "a path index beyond nPaths was read\n";
+        ok = false;
+    }
+    return ok;
+}
+
+bool testInterruption(std::string& message) {
+    Finished expected = testPaths();
+    { CheckpointFile file(filename,identity,expected); }
+    {
+        std::ofstream out(filename.c_str(),std::ios::app);
+        out << "7,0.5,nan,-in";
+    }
+    bool ok = sameFinished("cut off",readCheckpoint(filename,10,identity)
+                          ,expected,message);
+
+    // the resumed run drops the cut off line and continues after it
+    {
+        CheckpointFile file(filename,identity
+                           ,readCheckpoint(filename,10,identity));
+        file.write(7,qe::ValueVector(0.5,-1.0,2.0,0.25,1.5));
+    }
+    expected[7] = qe::ValueVector(0.5,-1.0,2.0,0.25,1.5);
+    ok = sameFinished("resumed",readCheckpoint(filename,10,identity),expected
+                     ,message) && ok;
+    return ok;
+}
+
+void readCorrupt() {
+    {
+        std::ofstream out(filename.c_str());
+        out << "# " << identity << "\n" << "3,1,2,3,4,5\n" << "4,1,2,x,4,5\n";
+    }
+    readCheckpoint(filename,10,identity);
+}
+
+void readShortLine() {
+    {
+        std::ofstream out(filename.c_str());
+        out << "# " << identity << "\n" << "3,1,2,3,4\n";
+    }
+    readCheckpoint(filename,10,identity);
+}
+
+bool testCorrupt(std::string& message) {
+    bool ok = true;
+    if (not throws(readCorrupt)) {
+        message += "a line with a bad field was read\n";
+        ok = false;
+    }
+    if (not throws(readShortLine)) {
+        message += "a line with a missing field was read\n";
+        ok = false;
+    }
+    return ok;
+}
+
+bool testIdentity(std::string& message) {
+    std::vector<std::vector<double> > parameters(2,std::vector<double>(3,0.1));
+    std::string id = checkpointIdentity("run",parameters);
+    parameters[1][2] = 0.1 + 1.5e-17;
+    bool ok = true;
+    if (checkpointIdentity("run",parameters) == id) {
+        message += "the identity misses a change of the last digit\n";
+        ok = false;
+    }
+    parameters[1][2] = 0.1;
+    if (checkpointIdentity("run",parameters) != id) {
+        message += "the identity is not reproducible\n";
+        ok = false;
+    }
+    if (checkpointIdentity("other run",parameters) == id) {
+        message += "the identity misses the run identity\n";
+        ok = false;
+    }
+    return ok;
+}
+
+int main() {
+    unsigned failures = 0;
+    failures += runTest("checkpoint round trip",testRoundTrip);
+    failures += runTest("interrupted checkpoint",testInterruption);
+    failures += runTest("corrupt checkpoint",testCorrupt);
+    failures += runTest("checkpoint identity",testIdentity);
+    std::remove(filename.c_str());
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,118 @@
+// Regression tests of the binary columnar files: what is written is read
+// back unchanged, uncompressed and in compressed blocks.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <boost/format.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/variate_generator.hpp>
+
+#include <utils/columnar.hpp>
+#include <utils/test_utils.hpp>
+
+namespace qe = QuantLibExt;
+using namespace PaulsTestUtils;
+
+const std::string filename = "test_columnar.col";
+
+std::vector<std::string> columnNames() {
+    std::vector<std::string> names;
+    names.push_back("V");
+    names.push_back("accepted");
+    names.push_back("special");
+    return names;
+}
+
+// A smooth column, one with long runs of repeated values (as rejected
+// MCMC proposals) and one with zeros, infinities, NaN and subnormals
+std::vector<std::vector<double> > testColumns(unsigned nRows) {
+    boost::variate_generator<boost::mt19937, boost::normal_distribution<> >
+        n(boost::mt19937(23u),boost::normal_distribution<>(0.,1.));
+    std::vector<std::vector<double> > columns(3,std::vector<double>(nRows));
+    double special[] = { 0.0, -0.0, std::numeric_limits<double>::infinity(),
+                         -std::numeric_limits<double>::infinity(),
+                         std::numeric_limits<double>::quiet_NaN(),
+                         std::numeric_limits<double>::denorm_min(),
+                         std::numeric_limits<double>::max(), 1.0 };
+    double accepted = 0.0;
+    for (unsigned j=0; j<nRows; ++j) {
+        columns[0][j] = 100.0*std::exp(0.01*j) + n();
+        if (n() > 1.0)
+            accepted = n();
+        columns[1][j] = accepted;
+        columns[2][j] = special[j % 8];
+    }
+    return columns;
+}
+
+// Same bits, so -0.0 and 0.0 differ and NaN equals NaN
+bool sameBits(double x, double y) {
+    return std::memcmp(&x,&y,sizeof(double)) == 0;
+}
+
+bool sameColumns(std::string prefix, const qe::ColumnarFile& file
+                ,const std::vector<std::string>& names
+                ,const std::vector<std::vector<double> >& columns
+                ,std::string& message) {
+    if (file.columns() != names.size() || file.rows() != columns[0].size()) {
+        message += (boost::format("%s : expected %u x %u, got %u x %u\n")
+                    % prefix % columns[0].size() % names.size()
+                    % file.rows() % file.columns()).str();
+        return false;
+    }
+    bool ok = true;
+    for (unsigned i=0; i<names.size(); ++i) {
+        if (file.name(i) != names[i]) {
+            message += prefix + " : column " + names[i] + " is called "
+                       + file.name(i) + "\n";
+            ok = false;
+        }
+        const double* column = file.column(names[i]);
+        for (unsigned j=0; j<columns[i].size(); ++j) {
+            if (not sameBits(column[j],columns[i][j])) {
+                message += (boost::format("%s %s[%u] : expected %.17g, "
+                            "got %.17g\n") % prefix % names[i] % j
+                            % columns[i][j] % column[j]).str();
+                ok = false;
+                break;
+            }
+        }
+    }
+    return ok;
+}
+
+bool testRoundTrip(std::string& message) {
+    std::vector<std::string> names = columnNames();
+    bool ok = true;
+    unsigned rows[] = { 0, 1, 5000, 10007 };
+    unsigned blockRows[] = { 0, 1, 7, 4096 };
+    for (unsigned r=0; r<4; ++r) {
+        std::vector<std::vector<double> > columns = testColumns(rows[r]);
+        for (unsigned b=0; b<4; ++b) {
+            qe::writeColumnar(filename,names,columns,blockRows[b]);
+            qe::ColumnarFile file(filename);
+            std::string prefix = (boost::format("rows %u blockRows %u")
+                                    % rows[r] % blockRows[b]).str();
+            if (file.compressed() != (blockRows[b] > 0)) {
+                message += prefix + " : wrong compression flag\n";
+                ok = false;
+            }
+            ok = sameColumns(prefix,file,names,columns,message) && ok;
+        }
+    }
+    return ok;
+}
+
+int main() {
+    unsigned failures = 0;
+    failures += runTest("columnar round trip",testRoundTrip);
+    std::remove(filename.c_str());
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,136 @@
+// Regression test of the time series loader: the fast float parse must
+// give the values atof gives (through CSVParser, line by line, as the
+// loader used to), for every number of threads.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include <boost/format.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real.hpp>
+#include <boost/random/uniform_int.hpp>
+#include <boost/random/variate_generator.hpp>
+
+#include <utils/pathparser.hpp>
+#include <utils/test_utils.hpp>
+
+namespace qe = QuantLibExt;
+using namespace PaulsTestUtils;
+
+const std::string filename = "test_pathparser.csv";
+const unsigned numPaths = 3;
+
+// Fields the fast path takes and fields it hands on to strtod
+std::string randomField(boost::mt19937& rng) {
+    boost::variate_generator<boost::mt19937&, boost::uniform_real<> >
+        u(rng,boost::uniform_real<>(-1.0,1.0));
+    boost::variate_generator<boost::mt19937&, boost::uniform_int<> >
+        kind(rng,boost::uniform_int<>(0,13));
+    boost::variate_generator<boost::mt19937&, boost::uniform_int<> >
+        exponent(rng,boost::uniform_int<>(-320,308));
+    double x = u();
+    switch (kind()) {
+      case 0:  return (boost::format("%.17g") % x).str();
+      case 1:  return (boost::format("%.6f") % (1000.0*x)).str();
+      case 2:  return (boost::format("%.3e") % x).str();
+      case 3:  return (boost::format("%.17e") % (x*1e22)).str();
+      case 4:  return (boost::format("%.25f") % x).str();
+      case 5:  return (boost::format("%de%d") % int(1e6*x) % exponent()).str();
+      case 6:  return (boost::format("%.16ge%d") % x % exponent()).str();
+      case 7:  return (boost::format("%d") % int(1e9*x)).str();
+      case 8:  return (boost::format(" %.12g") % x).str();
+      case 9:  return "";
+      case 10: return (x < 0.0) ? "-inf" : "nan";
+      case 11: return (x < 0.0) ? "0x1.8p-3" : "-0x1Fp4";
+      case 12: return (x < 0.0) ? ".5" : "+7.";
+      default: return "12345678901234567890123";
+    }
+}
+
+// The first numPaths fields of the non-empty lines, as the old loader
+std::vector<std::vector<double> > parseWithCsvParser() {
+    std::ifstream in(filename.c_str());
+    std::vector<std::vector<double> > values(numPaths);
+    std::string line;
+    CSVParser parser;
+    while (std::getline(in,line)) {
+        if (line == "")
+            continue;
+        parser << line;
+        for (unsigned i=0; i<numPaths; ++i) {
+            double x;
+            parser >> x;
+            values[i].push_back(x);
+        }
+    }
+    return values;
+}
+
+void writeTestFile() {
+    boost::mt19937 rng(2011u);
+    std::ofstream out(filename.c_str());
+    for (unsigned line=0; line<5000; ++line) {
+        if (line % 97 == 0)
+            out << "\n";                          // blank line
+        unsigned nFields = (line % 89 == 0) ? 1 : numPaths;
+        for (unsigned i=0; i<nFields; ++i)
+            out << randomField(rng) << (i+1 < nFields ? "," : "");
+        out << "\n";
+    }
+}
+
+bool testMultiPath(std::string& message) {
+    std::vector<std::vector<double> > expected = parseWithCsvParser();
+    bool ok = true;
+    for (unsigned nThreads=1; nThreads<=7; nThreads+=3) {
+        ql::MultiPath paths = qe::parseMultiPath(filename,0.01,numPaths
+                                                ,nThreads);
+        for (unsigned i=0; i<numPaths; ++i) {
+            if (paths[i].length() != expected[i].size()) {
+                message += (boost::format("threads %u path %u : expected %u "
+                            "values, got %u\n") % nThreads % i
+                            % expected[i].size() % paths[i].length()).str();
+                ok = false;
+                continue;
+            }
+            for (unsigned j=0; j<expected[i].size(); ++j)
+                ok = identicalOrMessage((boost::format("threads %u path %u "
+                                            "line %u") % nThreads % i % j).str()
+                                       ,paths[i][j],expected[i][j],message)
+                     && ok;
+        }
+    }
+    return ok;
+}
+
+bool testPath(std::string& message) {
+    std::vector<std::vector<double> > expected = parseWithCsvParser();
+    bool ok = true;
+    for (unsigned nThreads=1; nThreads<=4; nThreads+=3) {
+        ql::Path path = qe::parsePath(filename,0.01,nThreads);
+        if (path.length() != expected[0].size()) {
+            message += (boost::format("threads %u : expected %u values, "
+                        "got %u\n") % nThreads % expected[0].size()
+                        % path.length()).str();
+            ok = false;
+            continue;
+        }
+        for (unsigned j=0; j<expected[0].size(); ++j)
+            ok = identicalOrMessage((boost::format("threads %u line %u")
+                                        % nThreads % j).str()
+                                   ,path[j],expected[0][j],message) && ok;
+    }
+    return ok;
+}
+
+int main() {
+    writeTestFile();
+    unsigned failures = 0;
+    failures += runTest("parseMultiPath",testMultiPath);
+    failures += runTest("parsePath",testPath);
+    std::remove(filename.c_str());
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,546 @@
+// Regression tests of the inner MC pricing: the faster ways of pricing
+// must give the same numbers as the plain ones.
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <boost/format.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/variate_generator.hpp>
+
+#include <ql_extensions.hpp>
+#include <utils/test_utils.hpp>
+
+namespace qe = QuantLibExt;
+using namespace PaulsTestUtils;
+
+typedef boost::shared_ptr<qe::PricingModel<qe::ValT,qe::UnderlT,qe::DeltaT> >
+    PricingModelPtr;
+
+bool sameValue(std::string prefix, const qe::ValueVector& result
+              ,const qe::ValueVector& expected, std::string& message) {
+    bool ok = true;
+    ok = identicalOrMessage(prefix + ".V",result.V,expected.V,message) && ok;
+    ok = identicalOrMessage(prefix + ".C",result.C,expected.C,message) && ok;
+    ok = identicalOrMessage(prefix + ".D",result.D,expected.D,message) && ok;
+    ok = identicalOrMessage(prefix + ".Res",result.Res,expected.Res
+                           ,message) && ok;
+    ok = identicalOrMessage(prefix + ".Surr",result.Surr,expected.Surr
+                           ,message) && ok;
+    return ok;
+}
+
+bool sameResult(std::string prefix, const qe::ResultT& result
+               ,const qe::ResultT& expected, std::string& message) {
+    bool ok = sameValue(prefix + " value",result.value,expected.value
+                       ,message);
+    for (unsigned i=0; i<expected.underlyings.size(); ++i)
+        ok = identicalOrMessage((boost::format("%s underlying %u")
+                                    % prefix % i).str()
+                               ,result.underlyings[i],expected.underlyings[i]
+                               ,message) && ok;
+    for (unsigned i=0; i<expected.deltas.size(); ++i)
+        ok = sameValue((boost::format("%s delta %u") % prefix % i).str()
+                      ,result.deltas[i],expected.deltas[i],message) && ok;
+    return ok;
+}
+
+std::vector<double> cevCklsParameters() {
+    double p[] = { 0.0, 0.2, 1.0, 0.2, 0.04, 0.05, 0.5, -0.2 };
+    return std::vector<double>(p,p+8);
+}
+
+std::vector<double> bsVasicekParameters() {
+    double p[] = { 0.0, 0.2, 0.5, 0.04, 0.02, -0.2 };
+    return std::vector<double>(p,p+6);
+}
+
+qe::ContractTraits contractTraits() {
+    qe::ContractTraits ct(0.035,0.5,0.9);
+    ct.T = qe::rational(4);
+    return ct;
+}
+
+// Real world path of the hedging MC on a quarterly grid
+qe::Path<qe::Assets> realWorldPath(const std::vector<double>& p
+                                  ,const std::string& model) {
+    qe::ScenarioGenerator generator(qe::rational(1,4),qe::rational(4)
+                                   ,qe::rational(0),7u);
+    return qe::makePathFromVariates(generator(),qe::Assets(100.0,0.03,0.0)
+                                   ,qe::makeRealWorldDynamics(p,model));
+}
+
+// The real world path up to t, continued with a risk-neutral scenario
+qe::Path<qe::Assets> innerPath(const qe::rational& t
+                              ,const qe::Path<qe::Assets>& assetPath
+                              ,const qe::Path<qe::Variates>& variates
+                              ,const qe::ModelDynamics& dynamics) {
+    qe::Path<qe::Assets> path = assetPath;
+    qe::updatePathFromVariates(path.iteratorAtTime(t),path.end()
+                              ,variates.iteratorAtTime(t),dynamics);
+    return path;
+}
+
+// evaluate() draws each scenario once for the value, the underlyings and
+// the deltas. Value and deltas are the same as those of the separate
+// runs, the zero bond is the same up to rounding.
+bool testOnePassPricing(std::string& message) {
+    std::vector<double> p = cevCklsParameters();
+    qe::ContractTraits ct = contractTraits();
+    qe::Path<qe::Assets> assetPath = realWorldPath(p,"CevCkls");
+    qe::Path<qe::ContractStates> csPath
+        = qe::makeContractStatePath(assetPath,ct);
+
+    bool ok = true;
+    for (unsigned nBlocks=1; nBlocks<=3; nBlocks+=2) {
+        qe::InnerMCTraits innerMC;
+        innerMC.nBlocks = nBlocks;
+        innerMC.nThreads = nBlocks;
+        qe::InsContrMCPricingModelFactory factory(200,qe::rational(1,4)
+                ,qe::makeRiskNeutralDynamics(p,"CevCkls"),ct,0.005,0.002
+                ,innerMC);
+        qe::rational times[] = { qe::rational(0), qe::rational(3,2) };
+        for (unsigned k=0; k<2; ++k) {
+            PricingModelPtr model(factory.make(times[k],assetPath,csPath));
+            qe::ResultT result = model->evaluate();
+            qe::UnderlT underlyings = model->underlyings();
+            std::string prefix
+                = (boost::format("blocks %u t %u") % nBlocks % k).str();
+            ok = sameValue(prefix + " value",result.value,model->value()
+                          ,message) && ok;
+            ok = identicalOrMessage(prefix + " stock",result.underlyings[0]
+                                   ,underlyings[0],message) && ok;
+            ok = closeEnoughOrMessage(prefix + " bond",result.underlyings[1]
+                                     ,underlyings[1],message) && ok;
+            qe::DeltaT deltas = model->deltas();
+            for (unsigned i=0; i<deltas.size(); ++i)
+                ok = sameValue((boost::format("%s delta %u") % prefix % i).str()
+                              ,result.deltas[i],deltas[i],message) && ok;
+        }
+    }
+    return ok;
+}
+
+// The factory on the concrete dynamics prices as the one on ModelDynamics
+bool testStaticDynamics(std::string& message) {
+    qe::ContractTraits ct = contractTraits();
+    qe::rational t(3,2);
+    bool ok = true;
+
+    std::vector<double> p = cevCklsParameters();
+    qe::Path<qe::Assets> assetPath = realWorldPath(p,"CevCkls");
+    qe::Path<qe::ContractStates> csPath
+        = qe::makeContractStatePath(assetPath,ct);
+    qe::InsContrMCPricingModelFactory factory(200,qe::rational(1,4)
+            ,qe::makeRiskNeutralDynamics(p,"CevCkls"),ct,0.005,0.002);
+    qe::StaticInsContrMCPricingModelFactory<qe::RnCevCklsDynamics>
+        staticFactory(200,qe::rational(1,4),qe::RnCevCklsDynamics(p),ct
+                     ,0.005,0.002);
+    PricingModelPtr model(factory.make(t,assetPath,csPath));
+    PricingModelPtr staticModel(staticFactory.make(t,assetPath,csPath));
+    ok = sameResult("CevCkls",staticModel->evaluate(),model->evaluate()
+                   ,message) && ok;
+
+    p = bsVasicekParameters();
+    assetPath = realWorldPath(p,"BS_Vas");
+    csPath = qe::makeContractStatePath(assetPath,ct);
+    qe::InsContrMCPricingModelFactory bsvFactory(200,qe::rational(1,4)
+            ,qe::makeRiskNeutralDynamics(p,"BS_Vas"),ct,0.005,0.002);
+    qe::StaticInsContrMCPricingModelFactory<qe::RnBSVasicekDynamics>
+        staticBsvFactory(200,qe::rational(1,4),qe::RnBSVasicekDynamics(p),ct
+                        ,0.005,0.002);
+    model.reset(bsvFactory.make(t,assetPath,csPath));
+    staticModel.reset(staticBsvFactory.make(t,assetPath,csPath));
+    ok = sameResult("BS_Vas",staticModel->evaluate(),model->evaluate()
+                   ,message) && ok;
+    return ok;
+}
+
+// Scratch paths and workspaces reused for every scenario give the numbers
+// of fresh ones
+bool testScratchPaths(std::string& message) {
+    std::vector<double> p = cevCklsParameters();
+    qe::ModelDynamics dynamics = qe::makeRiskNeutralDynamics(p,"CevCkls");
+    qe::ContractTraits ct = contractTraits();
+    qe::Path<qe::Assets> assetPath = realWorldPath(p,"CevCkls");
+    qe::Path<qe::ContractStates> csPath
+        = qe::makeContractStatePath(assetPath,ct);
+    qe::rational t(5,4);
+    bool ok = true;
+
+    // a path reset from another grid
+    qe::ScenarioGenerator generator(qe::rational(1,4),qe::rational(4),t,11u);
+    qe::Path<qe::Variates> variates = generator();
+    qe::Path<qe::Assets> scratch(qe::rational(1,12),qe::rational(10));
+    scratch.reset(variates.dt(),variates.T(),variates.t0());
+    scratch[t] = assetPath[t];
+    qe::updatePathFromVariates(scratch.begin(),scratch.end()
+                              ,variates.begin(),dynamics);
+    qe::Path<qe::Assets> fresh
+        = qe::makePathFromVariates(variates,assetPath[t],dynamics);
+    for (unsigned i=0; i<fresh.size(); ++i) {
+        std::string point = (boost::format("point %u") % i).str();
+        ok = identicalOrMessage(point + ".S",scratch[i].S,fresh[i].S
+                               ,message) && ok;
+        ok = identicalOrMessage(point + ".r",scratch[i].r,fresh[i].r
+                               ,message) && ok;
+        ok = identicalOrMessage(point + ".intR",scratch[i].intR,fresh[i].intR
+                               ,message) && ok;
+    }
+
+    // one workspace and scratch path for all scenarios
+    qe::Path<qe::Assets> hedgePath = assetPath;
+    qe::ContractValuationWorkspace workspace(csPath);
+    for (unsigned i=0; i<20; ++i) {
+        generator(variates);
+        qe::ValueVector value = qe::valueContractFromVariates(t,hedgePath
+                                    ,variates,workspace,ct,dynamics);
+        qe::ValueVector expected = qe::valueContractFromPath(t
+                                    ,innerPath(t,assetPath,variates,dynamics)
+                                    ,csPath,ct);
+        ok = sameValue((boost::format("scenario %u") % i).str()
+                      ,value,expected,message) && ok;
+    }
+
+    // a pricing model does not carry anything over from one run to the
+    // next
+    qe::InsContrMCPricingModelFactory factory(200,qe::rational(1,4)
+            ,dynamics,ct,0.005,0.002);
+    PricingModelPtr model(factory.make(t,assetPath,csPath));
+    qe::ResultT first = model->evaluate();
+    ok = sameResult("second run",model->evaluate(),first,message) && ok;
+    return ok;
+}
+
+// The streaming valuation equals discounting the payoff path of the
+// recomputed contract states
+bool testStreamingValuation(std::string& message) {
+    std::vector<double> p = cevCklsParameters();
+    qe::ModelDynamics dynamics = qe::makeRiskNeutralDynamics(p,"CevCkls");
+    qe::ContractTraits ct = contractTraits();
+    qe::Path<qe::Assets> assetPath = realWorldPath(p,"CevCkls");
+    qe::Path<qe::ContractStates> csPath
+        = qe::makeContractStatePath(assetPath,ct);
+    bool ok = true;
+
+    qe::rational times[] = { qe::rational(0), qe::rational(1,4)
+                           , qe::rational(1), qe::rational(11,4)
+                           , qe::rational(15,4) };
+    for (unsigned k=0; k<5; ++k) {
+        qe::rational t = times[k];
+        qe::ScenarioGenerator generator(qe::rational(1,4),qe::rational(4)
+                                       ,t,13u+k);
+        for (unsigned i=0; i<5; ++i) {
+            qe::Path<qe::Assets> path
+                = innerPath(t,assetPath,generator(),dynamics);
+            qe::DiscountFactors factors(path);
+            qe::ValueVector expected = qe::discountValue(t,path,factors
+                    ,qe::payoffPathFromContractStates(
+                        qe::makeContractStatePath(path,ct)));
+            ok = sameValue((boost::format("t %u scenario %u") % k % i).str()
+                          ,qe::valueContractFromPath(t,path,csPath,ct)
+                          ,expected,message) && ok;
+        }
+    }
+    return ok;
+}
+
+// Every contract of a portfolio has the value it has on its own
+bool testPortfolio(std::string& message) {
+    std::vector<double> p = cevCklsParameters();
+    qe::ModelDynamics dynamics = qe::makeRiskNeutralDynamics(p,"CevCkls");
+    qe::ContractPortfolio portfolio;
+    portfolio.add(qe::ContractTraits(0.035,0.5,0.9,10000,11000
+                                    ,qe::rational(1),qe::rational(4)));
+    portfolio.add(qe::ContractTraits(0.02,0.8,0.95,5000,5200
+                                    ,qe::rational(1),qe::rational(4)));
+    portfolio.add(qe::ContractTraits(0.0,0.9,1.0,20000,25000
+                                    ,qe::rational(1),qe::rational(4)));
+    qe::Path<qe::Assets> assetPath = realWorldPath(p,"CevCkls");
+    qe::Path<qe::PortfolioStates> psPath
+        = qe::makePortfolioStatePath(assetPath,portfolio);
+    bool ok = true;
+
+    qe::PortfolioValuationWorkspace workspace(psPath);
+    qe::rational times[] = { qe::rational(0), qe::rational(3)
+                           , qe::rational(7,2) };
+    for (unsigned k=0; k<3; ++k) {
+        qe::Array<qe::ValueVector> values = qe::portfolioValuesFromPath(
+                times[k],assetPath,portfolio,workspace);
+        for (unsigned j=0; j<portfolio.size(); ++j) {
+            qe::ContractTraits ct = portfolio.contract(j);
+            ok = sameValue((boost::format("t %u contract %u") % k % j).str()
+                          ,values[j]
+                          ,qe::valueContractFromPath(times[k],assetPath
+                                ,qe::makeContractStatePath(assetPath,ct),ct)
+                          ,message) && ok;
+        }
+    }
+
+    qe::AssetPathTraits apt;
+    apt.dt = qe::rational(1,4);
+    apt.T = qe::rational(4);
+    apt.t0 = qe::rational(0);
+    apt.initialAssetValues = qe::Assets(100.0,0.03,0.0);
+    qe::Array<qe::ValueVector> values
+        = qe::portfolioMC(200,42u,dynamics,apt,portfolio);
+    for (unsigned j=0; j<portfolio.size(); ++j)
+        ok = sameValue((boost::format("MC contract %u") % j).str()
+                      ,values[j]
+                      ,qe::simpleMC(200,42u,dynamics,apt,portfolio.contract(j))
+                      ,message) && ok;
+    return ok;
+}
+
+// exp(-mean + variance/2) of the integrated Vasicek rate, which is normal
+double vasicekBond(double r, double tau, double k, double theta, double sr) {
+    double B = (1.0-std::exp(-k*tau))/k;
+    double mean = theta*tau + (r-theta)*B;
+    double variance = sr*sr/(k*k)*(tau - 2.0*B + (1.0-std::exp(-2.0*k*tau))
+                                                 /(2.0*k));
+    return std::exp(-mean + 0.5*variance);
+}
+
+// If the value is a linear function of the controls the control variate
+// estimate is its value at the control means and no variance is left. A
+// control that is a combination of the others is left out.
+bool testControlVariates(std::string& message) {
+    boost::variate_generator<boost::mt19937, boost::normal_distribution<> >
+        n(boost::mt19937(5u),boost::normal_distribution<>(0.,1.));
+    unsigned nSamples = 1000;
+    double mean = 0.0, meanSquare = 0.0;
+    qe::ControlVariateSample<double> sum;
+    for (unsigned i=0; i<nSamples; ++i) {
+        std::vector<double> x(3);
+        x[0] = 1.0 + n();
+        x[1] = 0.5*n();
+        x[2] = x[0] - 2.0*x[1];
+        double y = 3.0 + 2.0*x[0] - 4.0*x[1];
+        mean += y/nSamples;
+        meanSquare += y*y/nSamples;
+        if (i == 0)
+            sum = qe::ControlVariateSample<double>(y,x);
+        else
+            sum += qe::ControlVariateSample<double>(y,x);
+    }
+    qe::ControlVariateSample<double> means = sum / (double)nSamples;
+    std::vector<double> controlMeans(3);
+    controlMeans[0] = 1.0;
+    controlMeans[1] = 0.0;
+    controlMeans[2] = 1.0;
+    bool ok = closeEnoughOrMessage("estimate",means.estimate(controlMeans)
+                                  ,5.0,message);
+    double variance = meanSquare - mean*mean;
+    double residual = means.residualVariance(variance);
+    if (std::abs(residual) > 1E-9*variance) {
+        message += (boost::format("residual variance %g of %g\n")
+                    % residual % variance).str();
+        ok = false;
+    }
+    return ok;
+}
+
+double quadratic(const std::vector<double>& x) {
+    return 1.5 - 2.0*x[0] + 0.5*x[2] + 3.0*x[0]*x[0] + x[0]*x[2]
+         + 0.25*x[2]*x[2];
+}
+
+// The least squares fit of the regression pricer reproduces a quadratic
+// target and its derivatives, the regressor without spread is left out
+bool testQuadraticRegression(std::string& message) {
+    boost::variate_generator<boost::mt19937, boost::normal_distribution<> >
+        n(boost::mt19937(3u),boost::normal_distribution<>(0.,1.));
+    std::vector<std::vector<double> > xs(200,std::vector<double>(3));
+    std::vector<double> mean(3,0.0), scale(3,0.0);
+    for (unsigned i=0; i<xs.size(); ++i) {
+        xs[i][0] = 100.0 + 10.0*n();
+        xs[i][1] = 7.0;
+        xs[i][2] = 0.03 + 0.01*n();
+    }
+    mean[0] = 100.0;
+    mean[1] = 7.0;
+    mean[2] = 0.03;
+    scale[0] = 10.0;
+    scale[2] = 0.01;
+    qe::QuadraticRegression regression(mean,scale,2);
+    for (unsigned i=0; i<xs.size(); ++i) {
+        std::vector<double> y(2);
+        y[0] = quadratic(xs[i]);
+        y[1] = 4.0*xs[i][2];
+        regression.add(xs[i],y);
+    }
+    bool ok = true;
+    if (regression.isActive(1) || not regression.isActive(0)
+            || not regression.solve()) {
+        message += "wrong regressors or singular fit\n";
+        return false;
+    }
+    for (unsigned i=0; i<5; ++i) {
+        std::vector<double> x(3);
+        x[0] = 80.0 + 10.0*i;
+        x[1] = 7.0;
+        x[2] = 0.01*i;
+        std::string prefix = (boost::format("x %u") % i).str();
+        ok = closeEnoughOrMessage(prefix + " fit",regression.fitted(x,0)
+                                 ,quadratic(x),message) && ok;
+        ok = closeEnoughOrMessage(prefix + " linear fit",regression.fitted(x,1)
+                                 ,4.0*x[2],message) && ok;
+        ok = closeEnoughOrMessage(prefix + " d/dx0"
+                                 ,regression.derivative(x,0,0)
+                                 ,-2.0 + 6.0*x[0] + x[2],message) && ok;
+        ok = closeEnoughOrMessage(prefix + " d/dx2"
+                                 ,regression.derivative(x,2,0)
+                                 ,0.5 + x[0] + 0.5*x[2],message) && ok;
+        ok = identicalOrMessage(prefix + " d/dx1",regression.derivative(x,1,0)
+                               ,0.0,message) && ok;
+    }
+    return ok;
+}
+
+// With analyticBond the bond underlying is the Vasicek price of
+// RnBSVasicekDynamics
+bool testAnalyticBond(std::string& message) {
+    std::vector<double> p = bsVasicekParameters();
+    qe::RnBSVasicekDynamics dynamics(p);
+    bool ok = identicalOrMessage("P(r,0)",dynamics.discountBond(0.03,0.0)
+                                ,1.0,message);
+    double tau[] = { 0.25, 2.5, 10.0 };
+    for (unsigned k=0; k<3; ++k)
+        ok = closeEnoughOrMessage((boost::format("P(r,%g)") % tau[k]).str()
+                                 ,dynamics.discountBond(0.03,tau[k])
+                                 ,vasicekBond(0.03,tau[k],p[2],p[3],p[4])
+                                 ,message) && ok;
+
+    qe::ContractTraits ct = contractTraits();
+    qe::Path<qe::Assets> assetPath = realWorldPath(p,"BS_Vas");
+    qe::Path<qe::ContractStates> csPath
+        = qe::makeContractStatePath(assetPath,ct);
+    qe::InnerMCTraits innerMC;
+    innerMC.analyticBond = true;
+    qe::InsContrMCPricingModelFactory factory(200,qe::rational(1,4)
+            ,qe::makeRiskNeutralDynamics(p,"BS_Vas"),ct,0.005,0.002,innerMC);
+    qe::rational times[] = { qe::rational(0), qe::rational(3,2)
+                           , qe::rational(15,4) };
+    for (unsigned k=0; k<3; ++k) {
+        PricingModelPtr model(factory.make(times[k],assetPath,csPath));
+        double tau = boost::rational_cast<double>(ct.T - times[k]);
+        ok = identicalOrMessage((boost::format("bond t %u") % k).str()
+                               ,model->evaluate().underlyings[1]
+                               ,dynamics.discountBond(assetPath[times[k]].r
+                                                     ,tau)
+                               ,message) && ok;
+    }
+    return ok;
+}
+
+// Adaptive stopping with a target it can't reach runs all scenarios, and
+// the factory refuses it for the blocked model, which can't stop early
+bool testAdaptiveStopping(std::string& message) {
+    std::vector<double> p = cevCklsParameters();
+    qe::ContractTraits ct = contractTraits();
+    qe::Path<qe::Assets> assetPath = realWorldPath(p,"CevCkls");
+    qe::Path<qe::ContractStates> csPath
+        = qe::makeContractStatePath(assetPath,ct);
+    qe::rational t(3,2);
+
+    qe::InsContrMCPricingModelFactory factory(200,qe::rational(1,4)
+            ,qe::makeRiskNeutralDynamics(p,"CevCkls"),ct,0.005,0.002);
+    qe::InnerMCTraits innerMC;
+    innerMC.adaptive = qe::AdaptiveMCTraits(1E-15,50,0.0);
+    qe::InsContrMCPricingModelFactory adaptiveFactory(200,qe::rational(1,4)
+            ,qe::makeRiskNeutralDynamics(p,"CevCkls"),ct,0.005,0.002
+            ,innerMC);
+    PricingModelPtr model(factory.make(t,assetPath,csPath));
+    PricingModelPtr adaptiveModel(adaptiveFactory.make(t,assetPath,csPath));
+    qe::ValueVector value = model->value();
+    qe::ValueVector adaptiveValue = adaptiveModel->evaluate().value;
+    bool ok = closeEnoughOrMessage("V",adaptiveValue.V,value.V,message);
+    ok = closeEnoughOrMessage("C",adaptiveValue.C,value.C,message) && ok;
+    ok = closeEnoughOrMessage("D",adaptiveValue.D,value.D,message) && ok;
+
+    innerMC.nBlocks = 3;
+    qe::InsContrMCPricingModelFactory blockedFactory(200,qe::rational(1,4)
+            ,qe::makeRiskNeutralDynamics(p,"CevCkls"),ct,0.005,0.002
+            ,innerMC);
+    try {
+        PricingModelPtr blockedModel(blockedFactory.make(t,assetPath,csPath));
+        message += "the blocked model was made with adaptive stopping\n";
+        ok = false;
+    } catch (std::exception&) {}
+    return ok;
+}
+
+// Equal up to the rounding of the L-weighted averages of the model points
+bool closeValue(std::string prefix, const qe::ValueVector& result
+               ,const qe::ValueVector& expected, std::string& message) {
+    double error = qe::maxComponent(qe::abs(result-expected));
+    if (error <= 1E-12*qe::maxComponent(qe::abs(expected)))
+        return true;
+    message += (boost::format("%s : expected %.17g, got %.17g\n") % prefix
+                % expected.V % result.V).str();
+    return false;
+}
+
+// A book of policies that differ only in size compresses to one model
+// point per term without error
+bool testModelPoints(std::string& message) {
+    std::vector<double> p = cevCklsParameters();
+    qe::ModelDynamics dynamics = qe::makeRiskNeutralDynamics(p,"CevCkls");
+    double L[] = { 10000, 2500, 40000, 7000, 123.45 };
+    unsigned term[] = { 4, 3, 4, 4, 3 };
+    qe::PolicyBook book;
+    for (unsigned i=0; i<5; ++i)
+        book.add(qe::ContractTraits(0.035,0.5,0.9,L[i],1.1*L[i]
+                                   ,qe::rational(1),qe::rational(term[i])));
+    qe::ModelPoints mp = qe::compressPolicyBook(book,qe::CompressionTraits());
+    bool ok = true;
+    if (mp.size() != 2) {
+        message += (boost::format("%u model points, expected 2\n")
+                    % mp.size()).str();
+        ok = false;
+    }
+
+    qe::AssetPathTraits apt;
+    apt.dt = qe::rational(1,4);
+    apt.T = qe::rational(4);
+    apt.t0 = qe::rational(0);
+    apt.initialAssetValues = qe::Assets(100.0,0.03,0.0);
+    qe::ModelPointValues values = qe::valueModelPoints(mp,200,42u,dynamics
+                                                      ,apt);
+    for (unsigned i=0; i<book.size(); ++i) {
+        qe::AssetPathTraits policyApt = apt;
+        policyApt.T = qe::rational(term[i]);
+        ok = closeValue((boost::format("policy %u") % i).str()
+                       ,qe::policyValue(mp,values,book,i)
+                       ,qe::simpleMC(200,42u,dynamics,policyApt,book.policy(i))
+                       ,message) && ok;
+    }
+
+    qe::CompressionDiagnostics diag = qe::diagnoseCompression(
+            book,mp,values,book.size(),200,42u,dynamics,apt);
+    if (diag.nSampled != book.size() || diag.maxPolicyError > 1E-12) {
+        message += (boost::format("diagnostics: %u sampled, max error %g\n")
+                    % diag.nSampled % diag.maxPolicyError).str();
+        ok = false;
+    }
+    return ok;
+}
+
+int main() {
+    unsigned failures = 0;
+    failures += runTest("one pass pricing",testOnePassPricing);
+    failures += runTest("static dynamics",testStaticDynamics);
+    failures += runTest("scratch paths",testScratchPaths);
+    failures += runTest("streaming valuation",testStreamingValuation);
+    failures += runTest("control variates",testControlVariates);
+    failures += runTest("analytic bond",testAnalyticBond);
+    failures += runTest("quadratic regression",testQuadraticRegression);
+    failures += runTest("adaptive stopping",testAdaptiveStopping);
+    failures += runTest("portfolio",testPortfolio);
+    failures += runTest("model points",testModelPoints);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,207 @@
+// Regression tests of the random number generators of the inner MC.
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include <ql_extensions.hpp>
+#include <utils/test_utils.hpp>
+
+namespace qe = QuantLibExt;
+using namespace PaulsTestUtils;
+
+bool samePath(std::string prefix, const qe::Path<qe::Variates>& result
+             ,const qe::Path<qe::Variates>& expected, std::string& message) {
+    if (result.size() != expected.size()) {
+        message += prefix + " : different number of points\n";
+        return false;
+    }
+    bool ok = true;
+    for (unsigned i=0; i<expected.size() && ok; ++i) {
+        std::string point = (boost::format("%s[%u]") % prefix % i).str();
+        ok = identicalOrMessage(point + ".W1",result[i].W1,expected[i].W1
+                               ,message) && ok;
+        ok = identicalOrMessage(point + ".W2",result[i].W2,expected[i].W2
+                               ,message) && ok;
+    }
+    return ok;
+}
+
+// Known answers of Philox4x32-10 from the Random123 distribution
+// (kat_vectors): counter, key, output
+bool testPhiloxKnownAnswers(std::string& message) {
+    const qe::Philox4x32::Word kat[3][10] = {
+        { 0x00000000u, 0x00000000u, 0x00000000u, 0x00000000u,
+          0x00000000u, 0x00000000u,
+          0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u },
+        { 0xffffffffu, 0xffffffffu, 0xffffffffu, 0xffffffffu,
+          0xffffffffu, 0xffffffffu,
+          0x408f276du, 0x41c83b0eu, 0xa20bc7c6u, 0x6d5451fdu },
+        { 0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0x03707344u,
+          0xa4093822u, 0x299f31d0u,
+          0xd16cfe09u, 0x94fdccebu, 0x5001e420u, 0x24126ea1u } };
+    bool ok = true;
+    for (unsigned k=0; k<3; ++k) {
+        qe::Philox4x32 philox(kat[k][4],kat[k][5]);
+        qe::Philox4x32::Word out[4];
+        philox(kat[k],out);
+        for (unsigned j=0; j<4; ++j) {
+            if (out[j] != kat[k][6+j]) {
+                message += (boost::format("kat %u word %u : expected %08x, "
+                            "got %08x\n") % k % j % kat[k][6+j] % out[j]).str();
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+// The blocks of a blocked run draw the scenarios of the unblocked run
+bool testPhiloxBlocks(std::string& message) {
+    qe::rational dt(1,4), T(4), t(3,2);
+    unsigned nScenarios = 10;
+    qe::PhiloxScenarioGenerator single(dt,T,t,42u,3,5);
+    qe::PhiloxBlockScenarioGenerator blocks(dt,T,t,42u,3,5,nScenarios,3);
+    std::vector<qe::Path<qe::Variates> > expected(nScenarios);
+    for (unsigned i=0; i<nScenarios; ++i)
+        single(expected[i]);
+
+    bool ok = true;
+    unsigned first[] = { 0, 3, 6, 10 };
+    for (unsigned b=0; b<3; ++b) {
+        boost::function<void (qe::Path<qe::Variates>&)> block = blocks(b);
+        qe::Path<qe::Variates> scenario;
+        for (unsigned i=first[b]; i<first[b+1]; ++i) {
+            block(scenario);
+            ok = samePath((boost::format("scenario %u") % i).str()
+                         ,scenario,expected[i],message) && ok;
+        }
+    }
+    return ok;
+}
+
+// Scenario k is Sobol point k through the W1 bridge (coordinates 0, 2,
+// 4, ...) and the W2 bridge (1, 3, 5, ...), so the first two coordinates
+// give the end points of the paths. A block of a blocked run is the same
+// scenarios again under another shift.
+bool testSobolBridge(std::string& message) {
+    qe::rational dt(1,4), T(4), t(3,2);
+    unsigned nSteps = 10;
+    QuantLib::SobolRsg points(2*nSteps,1ul,QuantLib::SobolRsg::JoeKuoD7);
+    QuantLib::InverseCumulativeNormal normal;
+    QuantLib::BrownianBridge bridge(nSteps);
+    qe::SobolScenarioGenerator sobol(dt,T,t);
+    bool ok = true;
+    qe::Path<qe::Variates> scenario;
+    for (unsigned k=0; k<20; ++k) {
+        const std::vector<QuantLib::Real>& u = points.nextSequence().value;
+        std::vector<double> z1(nSteps), z2(nSteps), w1(nSteps), w2(nSteps);
+        for (unsigned i=0; i<nSteps; ++i) {
+            z1[i] = normal(u[2*i]);
+            z2[i] = normal(u[2*i+1]);
+        }
+        bridge.transform(z1.begin(),z1.end(),w1.begin());
+        bridge.transform(z2.begin(),z2.end(),w2.begin());
+        sobol(scenario);
+        for (unsigned i=0; i<nSteps; ++i) {
+            std::string point = (boost::format("point %u[%u]") % k % i).str();
+            ok = identicalOrMessage(point + ".W1",scenario[i+1].W1,w1[i]
+                                   ,message) && ok;
+            ok = identicalOrMessage(point + ".W2",scenario[i+1].W2,w2[i]
+                                   ,message) && ok;
+        }
+    }
+
+    qe::SobolBlockScenarioGenerator blocks(dt,T,t,42u);
+    boost::function<void (qe::Path<qe::Variates>&)> block0 = blocks(0);
+    boost::function<void (qe::Path<qe::Variates>&)> again = blocks(0);
+    boost::function<void (qe::Path<qe::Variates>&)> block1 = blocks(1);
+    qe::Path<qe::Variates> scenario0, scenario1;
+    block0(scenario0);
+    again(scenario);
+    block1(scenario1);
+    ok = samePath("block 0 again",scenario,scenario0,message) && ok;
+    if (scenario1[1u].W1 == scenario0[1u].W1) {
+        message += "blocks 0 and 1 have the same shift\n";
+        ok = false;
+    }
+    return ok;
+}
+
+// Sobol points and Philox variates can't be combined, the factory refuses
+// them instead of dropping one
+bool testSobolWithPhilox(std::string& message) {
+    double p[] = { 0.0, 0.2, 1.0, 0.2, 0.04, 0.05, 0.5, -0.2 };
+    qe::InnerMCTraits innerMC;
+    innerMC.quasiMonteCarlo = true;
+    innerMC.counterBasedRng = true;
+    try {
+        qe::InsContrMCPricingModelFactory factory(200,qe::rational(1,4)
+                ,qe::makeRiskNeutralDynamics(std::vector<double>(p,p+8)
+                                            ,"CevCkls")
+                ,qe::ContractTraits(0.035,0.5,0.9),0.0,0.0,innerMC);
+    } catch (std::exception&) {
+        return true;
+    }
+    message += "the factory takes Sobol points with Philox variates\n";
+    return false;
+}
+
+// The antithetic generator draws every second scenario and mirrors it
+bool testAntithetic(std::string& message) {
+    qe::rational dt(1,4), T(4), t(3,2);
+    qe::ScenarioGenerator expected(dt,T,t,23u);
+    qe::AntitheticScenarioGenerator antithetic(qe::ScenarioGenerator(dt,T,t
+                                                                     ,23u));
+    bool ok = true;
+    qe::Path<qe::Variates> scenario;
+    for (unsigned i=0; i<10; ++i) {
+        qe::Path<qe::Variates> drawn = expected();
+        antithetic(scenario);
+        ok = samePath((boost::format("scenario %u") % (2*i)).str()
+                     ,scenario,drawn,message) && ok;
+        for (qe::Path<qe::Variates>::iterator it = drawn.begin();
+                it != drawn.end(); ++it) {
+            it->W1 = -it->W1;
+            it->W2 = -it->W2;
+        }
+        antithetic(scenario);
+        ok = samePath((boost::format("scenario %u") % (2*i+1)).str()
+                     ,scenario,drawn,message) && ok;
+    }
+    return ok;
+}
+
+// The bulk generator draws the stream of NormalRandomNumberGenerator
+bool testBulkNormals(std::string& message) {
+    qe::rational dt(1,12), T(10), t(7,12);
+    qe::ScenarioGenerator expected(dt,T,t,17u);
+    qe::BulkScenarioGenerator bulk(dt,T,t,17u);
+    bool ok = true;
+    qe::Path<qe::Variates> scenario;
+    for (unsigned i=0; i<20; ++i) {
+        bulk(scenario);
+        ok = samePath((boost::format("scenario %u") % i).str()
+                     ,scenario,expected(),message) && ok;
+    }
+
+    qe::NormalRandomNumberGenerator n(5u);
+    qe::BulkNormalGenerator bulkN(5u);
+    for (unsigned i=0; i<100; ++i)
+        ok = identicalOrMessage((boost::format("normal %u") % i).str()
+                               ,bulkN(),n(),message) && ok;
+    return ok;
+}
+
+int main() {
+    unsigned failures = 0;
+    failures += runTest("Philox known answers",testPhiloxKnownAnswers);
+    failures += runTest("Philox blocks",testPhiloxBlocks);
+    failures += runTest("Sobol bridge",testSobolBridge);
+    failures += runTest("Sobol with Philox",testSobolWithPhilox);
+    failures += runTest("antithetic scenarios",testAntithetic);
+    failures += runTest("bulk normals",testBulkNormals);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
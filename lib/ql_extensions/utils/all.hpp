@@ -3,3 +3,4 @@
 #include "csvparser.hpp"
 #include "filereader.hpp"
 #include "pathparser.hpp"
+#include "columnar.hpp"
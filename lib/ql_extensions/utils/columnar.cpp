@@ -0,0 +1,321 @@
+#include "columnar.hpp"
+
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ql/errors.hpp>
+
+namespace QuantLibExt {
+
+namespace {
+
+    const char magic[8] = { 'Q','E','C','O','L','S','0','1' };
+    const std::size_t fixedHeaderSize = 24;
+
+    bool hostIsLittleEndian() {
+        boost::uint16_t one = 1;
+        return *reinterpret_cast<unsigned char*>(&one) == 1;
+    }
+
+    boost::uint64_t toBits(double x) {
+        boost::uint64_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        return bits;
+    }
+
+    double fromBits(boost::uint64_t bits) {
+        double x;
+        std::memcpy(&x, &bits, sizeof(x));
+        return x;
+    }
+
+    void putUnsigned(std::string& out, boost::uint64_t x, unsigned nBytes) {
+        for (unsigned b=0; b<nBytes; ++b)
+            out += char((x >> (8*b)) & 0xFF);
+    }
+
+    boost::uint64_t getUnsigned(const unsigned char* p, unsigned nBytes) {
+        boost::uint64_t x = 0;
+        for (unsigned b=0; b<nBytes; ++b)
+            x |= boost::uint64_t(p[b]) << (8*b);
+        return x;
+    }
+
+    unsigned leadingZeroBytes(boost::uint64_t x) {
+        unsigned n = 0;
+        while (n < 8 && ((x >> (8*(7-n))) & 0xFF) == 0)
+            ++n;
+        return n;
+    }
+
+    void encodeBlock(const double* x, std::size_t n, std::string& out) {
+        boost::uint64_t previous = 0;
+        for (std::size_t i=0; i<n; i+=2) {
+            boost::uint64_t d[2] = { 0, 0 };
+            unsigned zeros[2] = { 8, 8 };
+            for (std::size_t k=0; k<2 && i+k<n; ++k) {
+                boost::uint64_t bits = toBits(x[i+k]);
+                d[k] = bits ^ previous;
+                zeros[k] = leadingZeroBytes(d[k]);
+                previous = bits;
+            }
+            out += char(zeros[0] | (zeros[1] << 4));
+            for (std::size_t k=0; k<2; ++k)
+                putUnsigned(out, d[k], 8-zeros[k]);
+        }
+    }
+
+    void decodeBlock(const unsigned char* p, const unsigned char* end,
+                     std::size_t n, double* x) {
+        boost::uint64_t previous = 0;
+        for (std::size_t i=0; i<n; i+=2) {
+            QL_REQUIRE(p < end, "ColumnarFile: truncated block");
+            unsigned zeros[2] = { p[0] & 0x0Fu, unsigned(p[0] >> 4) };
+            ++p;
+            for (std::size_t k=0; k<2; ++k) {
+                QL_REQUIRE(zeros[k] <= 8 && p + (8-zeros[k]) <= end,
+                           "ColumnarFile: corrupt block");
+                boost::uint64_t d = getUnsigned(p, 8-zeros[k]);
+                p += 8-zeros[k];
+                if (i+k < n) {
+                    previous ^= d;
+                    x[i+k] = fromBits(previous);
+                }
+            }
+        }
+    }
+
+    std::size_t paddedTo8(std::size_t n) {
+        return (n + 7) / 8 * 8;
+    }
+
+}
+
+ColumnarWriter::ColumnarWriter(const std::string& filename,
+                               const std::vector<std::string>& names,
+                               std::size_t nRows,
+                               unsigned blockRows)
+    : filename_(filename), nColumns_(names.size()), nRows_(nRows),
+      blockRows_(blockRows), batchRows_(blockRows > 0 ? blockRows : 4096),
+      dataStart_(0), nBuffered_(0), nWritten_(0), closed_(false)
+{
+    std::string header(magic, magic+8);
+    putUnsigned(header, nColumns_, 4);
+    putUnsigned(header, blockRows_, 4);
+    putUnsigned(header, nRows_, 8);
+    for (std::size_t i=0; i<names.size(); ++i) {
+        QL_REQUIRE(names[i].size() < 0x10000,
+                   "ColumnarWriter: column name too long");
+        putUnsigned(header, Float64Column, 1);
+        putUnsigned(header, 0, 1);
+        putUnsigned(header, names[i].size(), 2);
+        header += names[i];
+    }
+    header.resize(paddedTo8(header.size()), '\0');
+    dataStart_ = header.size();
+    if (blockRows_ > 0) {
+        std::size_t nBlocks = (nRows_ + blockRows_ - 1) / blockRows_;
+        // the table is written on close
+        header.resize(header.size() + 8*(nColumns_*nBlocks + 1), '\0');
+    }
+
+    out_.open(filename.c_str(), std::ios::binary);
+    QL_REQUIRE(out_.is_open(), "Can't open file for writing: " + filename);
+    out_.write(header.data(), header.size());
+    batch_.resize(nColumns_*batchRows_);
+}
+
+ColumnarWriter::~ColumnarWriter()
+{
+    try {
+        if (not closed_)
+            close();
+    } catch (...) {}
+}
+
+void ColumnarWriter::append(const double* row)
+{
+    QL_REQUIRE(nWritten_ + nBuffered_ < nRows_,
+               "ColumnarWriter: more rows than announced for " + filename_);
+    for (std::size_t i=0; i<nColumns_; ++i)
+        batch_[i*batchRows_ + nBuffered_] = row[i];
+    if (++nBuffered_ == batchRows_)
+        flush();
+}
+
+void ColumnarWriter::flush()
+{
+    if (nBuffered_ == 0)
+        return;
+    std::string bytes;
+    if (blockRows_ == 0) {
+        for (std::size_t i=0; i<nColumns_; ++i) {
+            bytes.clear();
+            for (std::size_t j=0; j<nBuffered_; ++j)
+                putUnsigned(bytes, toBits(batch_[i*batchRows_ + j]), 8);
+            out_.seekp(dataStart_ + 8*(i*nRows_ + nWritten_));
+            out_.write(bytes.data(), bytes.size());
+        }
+    } else {
+        boost::uint64_t offset = out_.tellp();
+        for (std::size_t i=0; i<nColumns_; ++i) {
+            blockOffsets_.push_back(offset + bytes.size());
+            encodeBlock(&batch_[i*batchRows_], nBuffered_, bytes);
+        }
+        out_.write(bytes.data(), bytes.size());
+    }
+    nWritten_ += nBuffered_;
+    nBuffered_ = 0;
+}
+
+void ColumnarWriter::close()
+{
+    closed_ = true;
+    flush();
+    QL_REQUIRE(nWritten_ == nRows_,
+               "ColumnarWriter: fewer rows than announced for " + filename_);
+    if (blockRows_ > 0) {
+        blockOffsets_.push_back(out_.tellp());
+        std::string table;
+        for (std::size_t k=0; k<blockOffsets_.size(); ++k)
+            putUnsigned(table, blockOffsets_[k], 8);
+        out_.seekp(dataStart_);
+        out_.write(table.data(), table.size());
+    }
+    out_.close();
+    QL_REQUIRE(not out_.fail(), "ColumnarWriter: error writing " + filename_);
+}
+
+void writeColumnar(const std::string& filename,
+                   const std::vector<std::string>& names,
+                   const std::vector<std::vector<double> >& columns,
+                   unsigned blockRows)
+{
+    QL_REQUIRE(names.size() == columns.size(),
+               "writeColumnar: one name per column needed");
+    std::size_t nRows = columns.empty() ? 0 : columns[0].size();
+    for (std::size_t i=0; i<columns.size(); ++i)
+        QL_REQUIRE(columns[i].size() == nRows,
+                   "writeColumnar: columns of different length");
+
+    ColumnarWriter writer(filename, names, nRows, blockRows);
+    std::vector<double> row(columns.size());
+    for (std::size_t j=0; j<nRows; ++j) {
+        for (std::size_t i=0; i<columns.size(); ++i)
+            row[i] = columns[i][j];
+        writer.append(&row[0]);
+    }
+    writer.close();
+}
+
+ColumnarFile::ColumnarFile(const std::string& filename)
+    : filename_(filename), data_(0), length_(0), nRows_(0), blockRows_(0),
+      dataStart_(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    QL_REQUIRE(fd >= 0, "Can't open file " + filename);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)fixedHeaderSize) {
+        close(fd);
+        QL_FAIL("ColumnarFile: " + filename + " is no columnar file");
+    }
+    length_ = st.st_size;
+    void* p = mmap(0, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    QL_REQUIRE(p != MAP_FAILED, "ColumnarFile: can't map " + filename);
+    data_ = static_cast<const unsigned char*>(p);
+
+    try {
+        QL_REQUIRE(std::memcmp(data_, magic, 8) == 0,
+                   "ColumnarFile: " + filename + " is no columnar file");
+        std::size_t nColumns = getUnsigned(data_+8, 4);
+        blockRows_ = getUnsigned(data_+12, 4);
+        nRows_ = getUnsigned(data_+16, 8);
+
+        std::size_t pos = fixedHeaderSize;
+        for (std::size_t i=0; i<nColumns; ++i) {
+            QL_REQUIRE(pos + 4 <= length_, "ColumnarFile: truncated header");
+            QL_REQUIRE(data_[pos] == Float64Column,
+                       "ColumnarFile: unsupported column type");
+            std::size_t nameLength = getUnsigned(data_+pos+2, 2);
+            pos += 4;
+            QL_REQUIRE(pos + nameLength <= length_,
+                       "ColumnarFile: truncated header");
+            names_.push_back(std::string(
+                reinterpret_cast<const char*>(data_+pos), nameLength));
+            pos += nameLength;
+        }
+        dataStart_ = paddedTo8(pos);
+
+        std::size_t dataLength = 8*nColumns*nRows_;
+        if (blockRows_ > 0) {
+            std::size_t nBlocks = (nRows_ + blockRows_ - 1) / blockRows_;
+            dataLength = 8*(nColumns*nBlocks + 1);
+        }
+        QL_REQUIRE(dataStart_ + dataLength <= length_,
+                   "ColumnarFile: " + filename + " is truncated");
+    } catch (...) {
+        munmap(const_cast<unsigned char*>(data_), length_);
+        throw;
+    }
+    decoded_.resize(names_.size());
+}
+
+ColumnarFile::~ColumnarFile()
+{
+    munmap(const_cast<unsigned char*>(data_), length_);
+}
+
+std::size_t ColumnarFile::index(const std::string& name) const
+{
+    for (std::size_t i=0; i<names_.size(); ++i)
+        if (names_[i] == name)
+            return i;
+    QL_FAIL("ColumnarFile: no column " + name + " in " + filename_);
+}
+
+const double* ColumnarFile::column(std::size_t i) const
+{
+    QL_REQUIRE(i < names_.size(), "ColumnarFile: column index out of range");
+    if (nRows_ == 0)
+        return 0;
+    if (blockRows_ == 0 && hostIsLittleEndian())
+        return reinterpret_cast<const double*>(data_ + dataStart_)
+               + i*nRows_;
+    if (decoded_[i].empty())
+        decodeColumn(i);
+    return &decoded_[i][0];
+}
+
+void ColumnarFile::decodeColumn(std::size_t i) const
+{
+    std::vector<double> x(nRows_);
+    if (blockRows_ == 0) {
+        const unsigned char* p = data_ + dataStart_ + 8*i*nRows_;
+        for (std::size_t j=0; j<nRows_; ++j)
+            x[j] = fromBits(getUnsigned(p + 8*j, 8));
+    } else {
+        std::size_t nBlocks = (nRows_ + blockRows_ - 1) / blockRows_;
+        const unsigned char* table = data_ + dataStart_;
+        for (std::size_t b=0; b<nBlocks; ++b) {
+            std::size_t k = b*names_.size() + i;
+            std::size_t begin = getUnsigned(table + 8*k, 8);
+            std::size_t end = getUnsigned(table + 8*(k+1), 8);
+            QL_REQUIRE(begin <= end && end <= length_,
+                       "ColumnarFile: corrupt block table");
+            std::size_t first = b*blockRows_;
+            decodeBlock(data_ + begin, data_ + end,
+                        std::min<std::size_t>(blockRows_, nRows_-first),
+                        &x[first]);
+        }
+    }
+    decoded_[i].swap(x);
+}
+
+} // namespace QuantLibExt
@@ -0,0 +1,118 @@
+#ifndef ql_extensions__utils__columnar_hpp
+#define ql_extensions__utils__columnar_hpp
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstddef>
+
+#include <boost/cstdint.hpp>
+
+namespace QuantLibExt {
+
+/*
+ * Binary columnar result files
+ *
+ * Header (all integers little-endian):
+ *   char[8]  magic "QECOLS01"
+ *   uint32   nColumns
+ *   uint32   blockRows, 0 for uncompressed columns
+ *   uint64   nRows
+ *   per column: uint8 dtype (1 = little-endian float64), uint8 0,
+ *               uint16 length of the name, the name
+ *   zero padding to a multiple of 8 bytes
+ *
+ * Uncompressed, the columns follow one after the other, nRows doubles each,
+ * aligned to 8 bytes, so a memory-mapped file can be read in place.
+ *
+ * Compressed, the rows are cut into blocks of blockRows rows. The header
+ * is followed by a table of uint64 file offsets, the starts of the blocks
+ * in file order (block 0 of every column, block 1 of every column, ...)
+ * and the end of the last one, then the blocks. Every block is decoded on
+ * its own: each double is XORed with the one before it (0 for the first of
+ * the block) and stored without the leading zero bytes of the XOR, a byte
+ * of two 4 bit counts of leading zero bytes goes before every pair of
+ * values. Repeated values (rejected MCMC proposals) take half a byte.
+ */
+
+enum ColumnType { Float64Column = 1 };
+
+// Writes a columnar file row by row with bounded memory: rows are
+// buffered up to a block (compressed) or 4096 rows and then written to
+// their places in the columns. The number of rows is fixed up front.
+class ColumnarWriter {
+  public:
+    ColumnarWriter(const std::string& filename,
+                   const std::vector<std::string>& names,
+                   std::size_t nRows,
+                   unsigned blockRows = 0);
+    ~ColumnarWriter();
+
+    // one value per column
+    void append(const double* row);
+    void append(const std::vector<double>& row) { append(&row[0]); }
+    // writes what is left, all nRows rows must have been appended
+    void close();
+
+  private:
+    ColumnarWriter(const ColumnarWriter& other);
+    ColumnarWriter& operator=(const ColumnarWriter& other);
+
+    void flush();
+
+    std::string filename_;
+    std::ofstream out_;
+    std::size_t nColumns_, nRows_;
+    unsigned blockRows_, batchRows_;
+    std::size_t dataStart_, nBuffered_, nWritten_;
+    // column-major, batchRows_ rows
+    std::vector<double> batch_;
+    std::vector<boost::uint64_t> blockOffsets_;
+    bool closed_;
+};
+
+void writeColumnar(const std::string& filename,
+                   const std::vector<std::string>& names,
+                   const std::vector<std::vector<double> >& columns,
+                   unsigned blockRows = 0);
+
+// Read access to a columnar file through a read-only memory map. Columns
+// of an uncompressed file on a little-endian host point into the map,
+// others are decoded on first access and kept.
+class ColumnarFile {
+  public:
+    ColumnarFile(const std::string& filename);
+    ~ColumnarFile();
+
+    std::size_t rows() const { return nRows_; }
+    std::size_t columns() const { return names_.size(); }
+    const std::string& name(std::size_t i) const { return names_[i]; }
+    // index of the column called name, throws if there is none
+    std::size_t index(const std::string& name) const;
+    bool compressed() const { return blockRows_ > 0; }
+
+    // rows() doubles, valid as long as the ColumnarFile
+    const double* column(std::size_t i) const;
+    const double* column(const std::string& name) const {
+        return column(index(name));
+    }
+
+  private:
+    ColumnarFile(const ColumnarFile& other);
+    ColumnarFile& operator=(const ColumnarFile& other);
+
+    void decodeColumn(std::size_t i) const;
+
+    std::string filename_;
+    const unsigned char* data_;
+    std::size_t length_;
+    std::size_t nRows_;
+    unsigned blockRows_;
+    std::vector<std::string> names_;
+    std::size_t dataStart_;
+    mutable std::vector<std::vector<double> > decoded_;
+};
+
+} // namespace QuantLibExt
+
+#endif
@@ -1,94 +1,249 @@
 #include "pathparser.hpp"
 
-namespace QuantLibExt {
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
 
-ql::Path parsePath(std::string filename, double dt)
-{
-    // Parse file
-    std::string sLine;
-    CSVParser csvparser;
-
-    std::ifstream infile(filename.c_str());
-    if (not infile.good())
-        throw "Can't open file!";
-
-    std::vector<double> path_vals;
-    while (!infile.eof()) {
-        getline(infile,sLine);
-        if (sLine == "")
-            continue;
-
-        double tmp;
-        csvparser << sLine;
-        csvparser >> tmp;
-        path_vals.push_back(tmp);
-    }
-    infile.close();
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-    ql::Size n = path_vals.size();
-    // Set up time grid
-    ql::TimeGrid myGrid(dt*n,n-1);
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/thread.hpp>
 
-    // Set up array
-    ql::Array tmpArray(n);
+namespace QuantLibExt {
 
-    for (unsigned i=0; i<n; ++i)
-        tmpArray[i] = path_vals[i];
+namespace {
+
+    // Read-only map of a whole file
+    class MappedFile {
+      public:
+        MappedFile(const std::string& filename) : data_(0), length_(0) {
+            int fd = open(filename.c_str(), O_RDONLY);
+            QL_REQUIRE(fd >= 0, "Can't open file " + filename);
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                close(fd);
+                QL_FAIL("Can't open file " + filename);
+            }
+            length_ = st.st_size;
+            if (length_ > 0) {
+                void* p = mmap(0, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) {
+                    close(fd);
+                    QL_FAIL("Can't map file " + filename);
+                }
+                data_ = static_cast<const char*>(p);
+                madvise(p, length_, MADV_SEQUENTIAL);
+            }
+            close(fd);
+        }
+        ~MappedFile() {
+            if (data_)
+                munmap(const_cast<char*>(data_), length_);
+        }
 
-    return ql::Path(myGrid, tmpArray);
-}
+        const char* begin() const { return data_; }
+        const char* end() const { return data_ + length_; }
+        std::size_t size() const { return length_; }
 
-ql::MultiPath parseMultiPath(std::string filename, double dt, unsigned numPaths)
-{
-    // Parse file
-    std::string sLine;
-    CSVParser csvparser;
+      private:
+        MappedFile(const MappedFile& other);
+        MappedFile& operator=(const MappedFile& other);
 
-    std::ifstream infile(filename.c_str());
-    if (not infile.good())
-        QL_FAIL("Can't open file!");
-    
-    const unsigned buf_size = 10000;
+        const char* data_;
+        std::size_t length_;
+    };
 
-    std::vector<std::vector<double> > path_vals(numPaths,std::vector<double>());
+    const char* lineEnd(const char* p, const char* end) {
+        const void* nl = std::memchr(p, '\n', end - p);
+        return nl ? static_cast<const char*>(nl) : end;
+    }
 
-    for (unsigned i=0; i<numPaths; ++i)
-        path_vals[i].reserve(buf_size);
+    // Same value as atof on the characters [p,end): decimal numbers of up
+    // to 19 digits with a power of ten of at most 22 are exact in doubles
+    // (Clinger's fast path), so one rounded multiplication or division
+    // gives the correctly rounded result, everything else goes to strtod.
+    double parseDouble(const char* p, const char* end) {
+        const char* s = p;
+        while (s < end && (*s == ' ' || (*s >= '\t' && *s <= '\r')))
+            ++s;
+        bool negative = false;
+        if (s < end && (*s == '-' || *s == '+'))
+            negative = (*s++ == '-');
+
+        boost::uint64_t mantissa = 0;
+        int nDigits = 0, exponent = 0;
+        bool anyDigit = false;
+        for (; s < end && *s >= '0' && *s <= '9'; ++s, anyDigit = true) {
+            if (mantissa > 0 || *s != '0')
+                ++nDigits;
+            mantissa = 10*mantissa + (*s - '0');
+        }
+        if (s < end && *s == '.') {
+            for (++s; s < end && *s >= '0' && *s <= '9'; ++s, anyDigit = true) {
+                if (mantissa > 0 || *s != '0')
+                    ++nDigits;
+                mantissa = 10*mantissa + (*s - '0');
+                --exponent;
+            }
+        }
+        if (anyDigit && s < end && (*s == 'e' || *s == 'E')) {
+            const char* e = s + 1;
+            bool negativeExponent = false;
+            if (e < end && (*e == '-' || *e == '+'))
+                negativeExponent = (*e++ == '-');
+            if (e < end && *e >= '0' && *e <= '9') {
+                int exp10 = 0;
+                for (; e < end && *e >= '0' && *e <= '9'; ++e)
+                    exp10 = std::min(10*exp10 + (*e - '0'), 100000);
+                exponent += negativeExponent ? -exp10 : exp10;
+            }
+        }
 
-    double tmp;
+        static const double powersOf10[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        bool hexadecimal = s < end && (*s == 'x' || *s == 'X');
+        if (anyDigit && not hexadecimal && nDigits <= 19
+                && mantissa <= (boost::uint64_t(1) << 53)
+                && exponent >= -22 && exponent <= 22) {
+            double x = double(mantissa);
+            x = exponent < 0 ? x / powersOf10[-exponent]
+                             : x * powersOf10[exponent];
+            return negative ? -x : x;
+        }
+        return std::strtod(std::string(p, end).c_str(), 0);
+    }
 
-    // now for the actual parsing
-    while (!infile.eof()) {
+    // Lines [begin,end) of the file, the rows of the path from firstRow on
+    struct Chunk {
+        const char* begin;
+        const char* end;
+        std::size_t firstRow;
+        std::size_t nRows;
+    };
+
+    // Empty lines are skipped, as getline and the CSVParser did
+    void countRows(Chunk& chunk) {
+        chunk.nRows = 0;
+        for (const char* p = chunk.begin; p < chunk.end; ) {
+            const char* e = lineEnd(p, chunk.end);
+            if (e > p)
+                ++chunk.nRows;
+            p = e + 1;
+        }
+    }
 
-        getline(infile,sLine);
+    // The first columns.size() fields of each row (leading blanks skipped,
+    // up to the next comma) into the columns, missing fields are 0
+    void parseRows(const Chunk& chunk, const std::vector<double*>& columns) {
+        std::size_t row = chunk.firstRow;
+        for (const char* p = chunk.begin; p < chunk.end; ) {
+            const char* e = lineEnd(p, chunk.end);
+            if (e > p) {
+                const char* field = p;
+                for (std::size_t i=0; i<columns.size(); ++i) {
+                    while (field < e && *field == ' ')
+                        ++field;
+                    const void* comma = std::memchr(field, ',', e - field);
+                    const char* fieldEnd
+                        = comma ? static_cast<const char*>(comma) : e;
+                    columns[i][row] = parseDouble(field, fieldEnd);
+                    field = std::min(fieldEnd + 1, e);
+                }
+                ++row;
+            }
+            p = e + 1;
+        }
+    }
 
-        if (sLine == "")
-            continue;
+    // One chunk per thread, cut at line ends. nThreads == 0 takes one
+    // thread per 4MB of file, at most one per core.
+    std::vector<Chunk> splitIntoChunks(const MappedFile& file, unsigned nThreads) {
+        if (nThreads == 0) {
+            std::size_t bySize = file.size() / (std::size_t(1) << 22) + 1;
+            unsigned nCores = std::max(boost::thread::hardware_concurrency(), 1u);
+            nThreads = (unsigned)std::min<std::size_t>(bySize, nCores);
+        }
+        std::vector<Chunk> chunks;
+        const char* p = file.begin();
+        for (unsigned k=1; k<=nThreads && p < file.end(); ++k) {
+            const char* e = file.end();
+            if (k < nThreads) {
+                e = std::max(p, file.begin() + file.size()/nThreads*k);
+                e = std::min(lineEnd(e, file.end()) + 1, file.end());
+            }
+            Chunk chunk = { p, e, 0, 0 };
+            chunks.push_back(chunk);
+            p = e;
+        }
+        return chunks;
+    }
 
-        csvparser << sLine;
-        for (unsigned i=0; i<numPaths; ++i) {
-            csvparser >> tmp;
-            path_vals[i].push_back(tmp);
+    template <class F>
+    void forEachChunk(std::vector<Chunk>& chunks, F f) {
+        if (chunks.size() <= 1) {
+            std::for_each(chunks.begin(), chunks.end(), f);
+            return;
         }
+        boost::thread_group workers;
+        for (std::size_t k=0; k<chunks.size(); ++k)
+            workers.create_thread(boost::bind<void>(f, boost::ref(chunks[k])));
+        workers.join_all();
     }
-    infile.close();
 
-    ql::Size n = path_vals[0].size();
-    ql::TimeGrid myGrid(dt*n,n-1);
+    // The rows of a file, counted on opening so that the caller can
+    // allocate the final buffers, then parsed straight into them
+    class RowParser {
+      public:
+        RowParser(const std::string& filename, unsigned nThreads)
+            : file_(filename), chunks_(splitIntoChunks(file_, nThreads)),
+              nRows_(0) {
+            forEachChunk(chunks_, countRows);
+            for (std::size_t k=0; k<chunks_.size(); ++k) {
+                chunks_[k].firstRow = nRows_;
+                nRows_ += chunks_[k].nRows;
+            }
+            QL_REQUIRE(nRows_ > 0, "No data in file " + filename);
+        }
 
-    std::vector< ql::Path > paths;
+        std::size_t rows() const { return nRows_; }
 
-    for (unsigned i=0; i<numPaths; ++i) {
-        // Set up array
-        ql::Array tmpArray(n);
+        void parseInto(const std::vector<double*>& columns) {
+            forEachChunk(chunks_, boost::bind(parseRows, _1, boost::cref(columns)));
+        }
 
-        for (unsigned j=0; j<n; ++j)
-            tmpArray[j] = path_vals[i][j];
+      private:
+        MappedFile file_;
+        std::vector<Chunk> chunks_;
+        std::size_t nRows_;
+    };
 
-        paths.push_back(ql::Path(myGrid,tmpArray)); 
-    }
+}
 
-    return ql::MultiPath(paths);
+ql::Path parsePath(std::string filename, double dt, unsigned nThreads)
+{
+    RowParser rows(filename, nThreads);
+    ql::Size n = rows.rows();
+    ql::Path path(ql::TimeGrid(dt*n,n-1));
+    rows.parseInto(std::vector<double*>(1, &path[0]));
+    return path;
+}
+
+ql::MultiPath parseMultiPath(std::string filename, double dt, unsigned numPaths,
+                             unsigned nThreads)
+{
+    RowParser rows(filename, nThreads);
+    ql::Size n = rows.rows();
+    ql::MultiPath paths(numPaths, ql::TimeGrid(dt*n,n-1));
+    std::vector<double*> columns(numPaths);
+    for (unsigned i=0; i<numPaths; ++i)
+        columns[i] = &paths[i][0];
+    rows.parseInto(columns);
+    return paths;
 }
 
 } // namespace QuantLibExt
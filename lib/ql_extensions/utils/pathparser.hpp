@@ -13,8 +13,12 @@ namespace ql=QuantLib;
 
 namespace QuantLibExt {
 
-ql::Path parsePath(std::string filename, double dt);
-ql::MultiPath parseMultiPath(std::string filename, double dt, unsigned numPaths);
+// The first (first numPaths) comma separated values of the non-empty lines
+// of the file. The file is memory-mapped and parsed in nThreads chunks,
+// 0 for one thread per 4MB of file.
+ql::Path parsePath(std::string filename, double dt, unsigned nThreads = 0);
+ql::MultiPath parseMultiPath(std::string filename, double dt, unsigned numPaths,
+                             unsigned nThreads = 0);
 
 }
 
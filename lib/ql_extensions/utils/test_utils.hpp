@@ -2,6 +2,9 @@
 #define PaulsExtensions__TestUtils__hpp__
 
 #include <cmath>
+#include <string>
+#include <iostream>
+#include <exception>
 #include <boost/format.hpp>
 
 namespace PaulsTestUtils {
@@ -42,6 +45,34 @@ bool closeEnoughOrMessage(std::string prefix
     }
 }
 
+// For results that must not change at all (two NaNs are the same result)
+bool identicalOrMessage(std::string prefix
+        , double result, double expected, std::string &message) {
+    if (result == expected || (result != result && expected != expected)) {
+        return true;
+    } else {
+        message += (boost::format("%5s : expected %.17g, got %.17g\n") 
+                % prefix % expected % result).str();
+        return false;
+    }
+}
+
+// Runs test, which writes what went wrong to its message, and prints the
+// outcome. Returns the number of failures (0 or 1).
+unsigned runTest(std::string name, bool (*test)(std::string&)) {
+    std::string message;
+    bool passed;
+    try {
+        passed = test(message);
+    } catch (std::exception& e) {
+        message += std::string(e.what()) + "\n";
+        passed = false;
+    }
+    std::cout << (passed ? "ok     " : "FAILED ") << name << std::endl
+              << message;
+    return passed ? 0 : 1;
+}
+
 }
 
 #endif